@@ -26,6 +26,12 @@ namespace CGL {
 class Renderer {
  public:
 
+  /**
+   * Constructor.
+   * A new renderer asks for its first frame to be drawn.
+   */
+  Renderer( void ) : use_hdpi( false ), redraw_requested( true ) { }
+
   /**
    * Virtual Destructor.
    * Each renderer implementation should define its own destructor 
@@ -118,16 +124,38 @@ class Renderer {
    */
   virtual void mouse_button_event( int button, int event ) { }
 
+  /**
+   * Ask the viewer for another frame.
+   * When the viewer draws on demand (see Viewer::set_on_demand), it only
+   * draws a frame after some window event, or after the renderer has called
+   * this (e.g. from render(), while something on screen is still changing).
+   */
+  void redraw( void ) { redraw_requested = true; }
+
   /**
    * Internal - 
    * The viewer will tell the renderer if the screen is in HDPI mode.
    */ 
   void use_hdpi_reneder_target() { use_hdpi = true; }
 
+  /**
+   * Internal -
+   * The viewer takes (and clears) the renderer's request for a frame.
+   */
+  bool take_redraw_request() {
+    bool requested = redraw_requested;
+    redraw_requested = false;
+    return requested;
+  }
+
  protected:
 
   bool use_hdpi; ///< if the render target is using HIDPI
 
+ private:
+
+  bool redraw_requested; ///< if the renderer has asked for a frame
+
 };
 
 } // namespace CGL
@@ -1,5 +1,7 @@
 #include "osdtext.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 #include "ft2build.h"
@@ -13,12 +15,13 @@ using namespace std;
 
 namespace CGL {
 
-struct point {
-    GLfloat x;
-    GLfloat y;
-    GLfloat s;
-    GLfloat t;
-};
+// initial size of the glyph atlas, which grows as needed
+static const int atlas_init_w = 512;
+static const int atlas_init_h = 128;
+
+// padding between glyphs in the atlas, so that linear filtering doesn't
+// bleed neighbours into each other
+static const int atlas_padding = 1;
 
 OSDText::OSDText() {
 
@@ -28,6 +31,16 @@ OSDText::OSDText() {
   face = new FT_Face;
 
   lines = vector<OSDLine>(); next_id = 0;
+
+  sx = sy = 0;
+  face_pixel_size = 0;
+
+  atlas_w = atlas_init_w; atlas_h = atlas_init_h;
+  atlas = vector<unsigned char>(atlas_w * atlas_h, 0);
+  shelf_x = shelf_y = shelf_h = 0;
+  atlas_dirty = true;
+
+  batch_dirty = true;
 }
 
 OSDText::~OSDText() {
@@ -38,6 +51,8 @@ OSDText::~OSDText() {
 
   lines.clear();
 
+  glDeleteBuffers(1, &vbo);
+  glDeleteTextures(1, &atlas_tex);
   glDeleteProgram(program);
 }
 
@@ -69,10 +84,12 @@ int OSDText::init(bool use_hdpi) {
   // compile shaders
   program = compile_shaders();
   if(program) {
-      attribute_coord = get_attribu ( program, "coord" );
-      uniform_tex     = get_uniform ( program, "tex"   );
-      uniform_color   = get_uniform ( program, "color" );
-      if (attribute_coord == -1 || uniform_tex == -1 || uniform_color == -1) {
+      attribute_coord    = get_attribu ( program, "coord"      );
+      attribute_color    = get_attribu ( program, "color"      );
+      uniform_tex        = get_uniform ( program, "tex"        );
+      uniform_atlas_size = get_uniform ( program, "atlas_size" );
+      if (attribute_coord == -1 || attribute_color == -1 ||
+          uniform_tex == -1 || uniform_atlas_size == -1) {
           return -1;
       }
   } else return -1;
@@ -80,29 +97,94 @@ int OSDText::init(bool use_hdpi) {
   // create the vbo
   glGenBuffers(1, &vbo);
 
+  // create the atlas texture, which is uploaded on the first render
+  glGenTextures(1, &atlas_tex);
+  glBindTexture(GL_TEXTURE_2D, atlas_tex);
+
+  // clamping to edges is important to prevent artifacts when scaling
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // linear filtering usually looks best for text
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
   return 0;
 }
 
 void OSDText::render() {
 
-  glUseProgram(program);
+  // rebuild the lines that changed, and the batch if any did
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (lines[i].dirty) {
+      build_line(lines[i]);
+      batch_dirty = true;
+    }
+  }
 
-  vector<OSDLine>::iterator it = lines.begin();
-  while(it != lines.end()) {
-    draw_line(*it);
-    ++it;
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, atlas_tex);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+  if (atlas_dirty) {
+
+    // require 1 byte alignment when uploading texture data
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D,
+                 0, GL_ALPHA, atlas_w, atlas_h,
+                 0, GL_ALPHA, GL_UNSIGNED_BYTE, &atlas[0]);
+    atlas_dirty = false;
   }
 
-  glUseProgram(0);
+  if (batch_dirty) {
+    batch.clear();
+    for (size_t i = 0; i < lines.size(); i++) {
+      batch.insert(batch.end(), lines[i].vertices.begin(), lines[i].vertices.end());
+    }
+    glBufferData(GL_ARRAY_BUFFER, batch.size() * sizeof(float),
+                 batch.empty() ? NULL : &batch[0], GL_DYNAMIC_DRAW);
+    batch_dirty = false;
+  }
+
+  if (!batch.empty()) {
+
+    glUseProgram(program);
+    glUniform1i(uniform_tex, 0);
+    glUniform2f(uniform_atlas_size, (float) atlas_w, (float) atlas_h);
+
+    // each vertex is x, y, s, t, r, g, b, a
+    GLsizei stride = 8 * sizeof(float);
+    glEnableVertexAttribArray(attribute_coord);
+    glEnableVertexAttribArray(attribute_color);
+    glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, stride, 0);
+    glVertexAttribPointer(attribute_color, 4, GL_FLOAT, GL_FALSE, stride,
+                          (const GLvoid*) (4 * sizeof(float)));
+
+    // draw all the lines at once
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei) (batch.size() / 8));
+
+    glDisableVertexAttribArray(attribute_coord);
+    glDisableVertexAttribArray(attribute_color);
+    glUseProgram(0);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void OSDText::clear() {
 	lines.clear();
+	batch_dirty = true;
 }
 
 void OSDText::resize(size_t w, size_t h) {
-    sx = 2.0f / w;
-    sy = 2.0f / h;
+    sx = 2.0f / (float) w;
+    sy = 2.0f / (float) h;
+
+    // glyph quads are in screen space
+    for (size_t i = 0; i < lines.size(); i++) lines[i].dirty = true;
 }
 
 
@@ -115,6 +197,7 @@ int OSDText::add_line(float x, float y, string text,
   new_line.text = text;
   new_line.size = size;
   new_line.color = color;
+  new_line.dirty = true;
 
   // handle HDPI display
   if (use_hdpi) new_line.size *= 2;
@@ -134,134 +217,177 @@ void OSDText::del_line(int line_id) {
   while(it != lines.end()) {
     if(it->id == line_id) {
       lines.erase(it);
+      batch_dirty = true;
       break;
     }
     ++it;
   }
 }
 
-void OSDText::set_anchor(int line_id, float x, float y) {
+OSDLine* OSDText::find_line(int line_id) {
   vector<OSDLine>::iterator it = lines.begin();
   while(it != lines.end()) {
-    if(it->id == line_id) {
-      it->x = x;
-      it->y = y;
-      break;
-    }
+    if(it->id == line_id) return &*it;
     ++it;
   }
+  return NULL;
+}
+
+void OSDText::set_anchor(int line_id, float x, float y) {
+  OSDLine* line = find_line(line_id);
+  if (line && (line->x != x || line->y != y)) {
+    line->x = x;
+    line->y = y;
+    line->dirty = true;
+  }
 }
 
 void OSDText::set_text(int line_id, string text) {
-  vector<OSDLine>::iterator it = lines.begin();
-  while(it != lines.end()) {
-    if(it->id == line_id) {
-      it->text = text;
-      break;
-    }
-    ++it;
+  OSDLine* line = find_line(line_id);
+  if (line && line->text != text) {
+    line->text = text;
+    line->dirty = true;
   }
 }
 
 void OSDText::set_size(int line_id, size_t size) {
-  vector<OSDLine>::iterator it = lines.begin();
-  while(it != lines.end()) {
-    if(it->id == line_id) {
-      it->size = size;
-      break;
-    }
-    ++it;
+  if (use_hdpi) size *= 2;
+  OSDLine* line = find_line(line_id);
+  if (line && line->size != size) {
+    line->size = size;
+    line->dirty = true;
   }
 }
 
 void OSDText::set_color(int line_id, Color color) {
-  vector<OSDLine>::iterator it = lines.begin();
-  while(it != lines.end()) {
-    if(it->id == line_id) {
-      it->color = color;
-      break;
-    }
-    ++it;
+  OSDLine* line = find_line(line_id);
+  if (line && (line->color.r != color.r || line->color.g != color.g ||
+               line->color.b != color.b || line->color.a != color.a)) {
+    line->color = color;
+    line->dirty = true;
   }
 }
 
-void OSDText::draw_line(OSDLine line) {
+void OSDText::build_line(OSDLine& line) {
 
-  // set font size
-  FT_Set_Pixel_Sizes(*face, 0, line.size);
-
-  // set font color
-  float color_rgba[4];
-  color_rgba[0] = line.color.r;
-  color_rgba[1] = line.color.g;
-  color_rgba[2] = line.color.b;
-  color_rgba[3] = 1.0f;
-  glUniform4fv(uniform_color, 1, (GLfloat*) color_rgba);
-
-  // get glyph
-  const char *p;
-  FT_GlyphSlot g = (*face)->glyph;
+  line.vertices.clear();
+  line.dirty = false;
 
-  // gen texture
-  GLuint tex;
-  glActiveTexture(GL_TEXTURE0);
-  glGenTextures(1, &tex);
-  glBindTexture(GL_TEXTURE_2D, tex);
-  glUniform1i(uniform_tex, 0);
+  float x = line.x, y = line.y;
+  float r = line.color.r, g = line.color.g, b = line.color.b, a = line.color.a;
 
-  // require 1 byte alignment when uploading texture data
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  // loop through all characters
+  const char* text = line.text.c_str();
+  for (const char* p = text; *p; p++) {
+
+    const OSDGlyph& glyph = get_glyph(line.size, (unsigned char) *p);
+
+    if (glyph.width && glyph.rows) {
+
+      // calculate the vertex coordinates, and the texture coordinates in
+      // atlas pixels (the shader divides them by the size of the atlas)
+      float x2 =  x + (float) glyph.left * sx;
+      float y2 = -y - (float) glyph.top  * sy;
+      float w = (float) glyph.width * sx;
+      float h = (float) glyph.rows  * sy;
+      float s0 = (float) glyph.x, t0 = (float) glyph.y;
+      float s1 = s0 + (float) glyph.width, t1 = t0 + (float) glyph.rows;
+
+      float quad[6][8] = {
+        {x2,     -y2,     s0, t0, r, g, b, a},
+        {x2 + w, -y2,     s1, t0, r, g, b, a},
+        {x2,     -y2 - h, s0, t1, r, g, b, a},
+        {x2 + w, -y2,     s1, t0, r, g, b, a},
+        {x2,     -y2 - h, s0, t1, r, g, b, a},
+        {x2 + w, -y2 - h, s1, t1, r, g, b, a},
+      };
+      line.vertices.insert(line.vertices.end(), &quad[0][0], &quad[0][0] + 6 * 8);
+    }
 
-  // clamping to edges is important to prevent artifacts when scaling
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Advance the cursor to the start of the next character
+    x += (float) glyph.advance_x * sx;
+    y += (float) glyph.advance_y * sy;
+  }
+}
 
-  // linear filtering usually looks best for text
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+const OSDGlyph& OSDText::get_glyph(size_t size, unsigned char c) {
 
-  // set up the VBO for our vertex data
-  glEnableVertexAttribArray(attribute_coord);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
+  // find the glyph set of the size, or start a new one
+  size_t i = 0;
+  while (i < glyph_sets.size() && glyph_sets[i].size != size) i++;
+  if (i == glyph_sets.size()) {
+    glyph_sets.push_back(OSDGlyphSet());
+    glyph_sets[i].size = size;
+    for (int k = 0; k < 256; k++) glyph_sets[i].glyphs[k].loaded = false;
+  }
 
-  // loop through all characters
-  const char* text = line.text.c_str();
-  for (p = text; *p; p++) {
+  OSDGlyph& glyph = glyph_sets[i].glyphs[c];
+  if (glyph.loaded) return glyph;
 
-    // Try to load and render the character
-    if (FT_Load_Char(*face, *p, FT_LOAD_RENDER)) continue;
+  glyph.loaded = true;
+  glyph.x = glyph.y = 0;
+  glyph.width = glyph.rows = 0;
+  glyph.left = glyph.top = 0;
+  glyph.advance_x = glyph.advance_y = 0;
 
-    // Upload the glyph bitmap as an alpha texture
-    glTexImage2D(GL_TEXTURE_2D,
-                 0, GL_ALPHA, g->bitmap.width, g->bitmap.rows,
-                 0, GL_ALPHA, GL_UNSIGNED_BYTE, g->bitmap.buffer);
-
-    // calculate the vertex and texture coordinates
-    float x2 =  line.x + g->bitmap_left * sx;
-    float y2 = -line.y - g->bitmap_top  * sy;
-    float w = g->bitmap.width * sx;
-    float h = g->bitmap.rows  * sy;
-
-    point box[4] = {
-      {x2, -y2, 0, 0},
-      {x2 + w, -y2, 1, 0},
-      {x2, -y2 - h, 0, 1},
-      {x2 + w, -y2 - h, 1, 1},
-    };
-
-    // draw the character to screen
-    glBufferData(GL_ARRAY_BUFFER, sizeof box, box, GL_DYNAMIC_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  // set font size
+  if (face_pixel_size != size) {
+    FT_Set_Pixel_Sizes(*face, 0, (FT_UInt) size);
+    face_pixel_size = size;
+  }
 
-    // Advance the cursor to the start of the next character
-    line.x += (g->advance.x >> 6) * sx;
-    line.y += (g->advance.y >> 6) * sy;
+  // Try to load and render the character (characters that fail to load
+  // are skipped, without advancing)
+  if (FT_Load_Char(*face, (char) c, FT_LOAD_RENDER)) return glyph;
+
+  FT_GlyphSlot g = (*face)->glyph;
+  glyph.width = g->bitmap.width;
+  glyph.rows  = g->bitmap.rows;
+  glyph.left  = g->bitmap_left;
+  glyph.top   = g->bitmap_top;
+  glyph.advance_x = (int) (g->advance.x >> 6);
+  glyph.advance_y = (int) (g->advance.y >> 6);
+
+  // copy the bitmap into the atlas
+  if (glyph.width && glyph.rows) {
+    pack_glyph(glyph.width, glyph.rows, glyph.x, glyph.y);
+    for (int row = 0; row < glyph.rows; row++) {
+      const unsigned char* src = g->bitmap.buffer + row * g->bitmap.pitch;
+      memcpy(&atlas[(glyph.y + row) * atlas_w + glyph.x], src, glyph.width);
+    }
+    atlas_dirty = true;
   }
 
-  glDisableVertexAttribArray(attribute_coord);
-  glDeleteTextures(1, &tex);
+  return glyph;
+}
+
+void OSDText::pack_glyph(int width, int rows, int& x, int& y) {
+
+  // start a new shelf when the current one is full
+  if (shelf_x + width + atlas_padding > atlas_w) {
+    shelf_x = 0;
+    shelf_y += shelf_h;
+    shelf_h = 0;
+  }
+
+  // grow the atlas (by doubling) until the bitmap fits; glyphs already in
+  // it keep their positions in pixels, so no line has to be rebuilt
+  int w = atlas_w, h = atlas_h;
+  while (width + atlas_padding > w) w *= 2;
+  while (shelf_y + rows + atlas_padding > h) h *= 2;
+  if (w != atlas_w || h != atlas_h) {
+    vector<unsigned char> grown(w * h, 0);
+    for (int row = 0; row < atlas_h; row++) {
+      memcpy(&grown[row * w], &atlas[row * atlas_w], atlas_w);
+    }
+    atlas.swap(grown);
+    atlas_w = w; atlas_h = h;
+  }
 
+  x = shelf_x;
+  y = shelf_y;
+  shelf_x += width + atlas_padding;
+  shelf_h = max(shelf_h, rows + atlas_padding);
 }
 
 GLuint OSDText::compile_shaders() {
@@ -272,18 +398,22 @@ GLuint OSDText::compile_shaders() {
 
   const char *vert_shader_src = "#version 120"
   "\nattribute vec4 coord;"
+  "\nattribute vec4 color;"
+  "\nuniform vec2 atlas_size;"
   "\nvarying vec2 texpos;"
+  "\nvarying vec4 texcolor;"
   "\nvoid main(void) {"
   "\n  gl_Position = vec4(coord.xy, 0, 1);"
-  "\n  texpos = coord.zw;"
+  "\n  texpos = coord.zw / atlas_size;"
+  "\n  texcolor = color;"
   "\n}";
 
   const char *frag_shader_src = "#version 120"
   "\nvarying vec2 texpos;"
+  "\nvarying vec4 texcolor;"
   "\nuniform sampler2D tex;"
-  "\nuniform vec4 color;"
   "\nvoid main(void) {"
-  "\n  gl_FragColor = vec4(1, 1, 1, texture2D(tex, texpos).a) * color;"
+  "\n  gl_FragColor = vec4(1, 1, 1, texture2D(tex, texpos).a) * texcolor;"
   "\n}";
 
 // with drop shadow
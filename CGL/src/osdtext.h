@@ -38,13 +38,51 @@ struct OSDLine {
   // font color
   Color color;
 
+  // glyph quads of the line, rebuilt when any of the above changes
+  std::vector<float> vertices;
+  bool dirty;
+
+};
+
+/**
+ * A glyph rendered into the atlas of its font size, and its metrics (all in
+ * pixels).  Glyphs are rendered the first time they are drawn.
+ */
+struct OSDGlyph {
+
+  // whether the glyph has been rendered yet
+  bool loaded;
+
+  // position of the bitmap in the atlas
+  int x, y;
+
+  // size of the bitmap, and its offset from the pen position
+  int width, rows;
+  int left, top;
+
+  // pen advance
+  int advance_x, advance_y;
+
+};
+
+/**
+ * The glyphs of the font at one size, indexed by character.
+ */
+struct OSDGlyphSet {
+
+  size_t size;
+  OSDGlyph glyphs[256];
+
 };
 
 /**
  * Provides an interface for text on-screen display.
- * Note that this requires GL_BLEND enabled to work. Do note this is a very
- * basic implementation and the cost of all operations increases linearly with
- * respect to the number of lines and the length of the lines.
+ * Note that this requires GL_BLEND enabled to work. Glyphs are rendered once
+ * per font size into a single texture atlas, and each line keeps its quads
+ * until its text, anchor, size or color changes. All the lines are drawn
+ * with one vertex buffer and a single draw call, which is only re-uploaded
+ * after some line has changed. Looking up a line by id is still linear in
+ * the number of lines.
  */
 class OSDText {
  public:
@@ -130,7 +168,8 @@ class OSDText {
 
   /**
    * Set the font size of a given line.
-   * If the given id is not valid, the call has no effect.
+   * If the given id is not valid, the call has no effect. As with add_line,
+   * the size is doubled on HDPI displays.
    * \param line_id Index of the line to set the text.
    * \param size The new size to set for the line.
    */
@@ -146,8 +185,17 @@ class OSDText {
 
  private:
 
-  // draw a single line
-  void draw_line(OSDLine line);
+  // find a line by id, or return NULL
+  OSDLine* find_line(int line_id);
+
+  // rebuild the glyph quads of a line
+  void build_line(OSDLine& line);
+
+  // get a glyph, rendering it into the atlas if it isn't there yet
+  const OSDGlyph& get_glyph(size_t size, unsigned char c);
+
+  // make room for a bitmap in the atlas, and return its position
+  void pack_glyph(int width, int rows, int& x, int& y);
 
   // HDPI displays
   bool use_hdpi;
@@ -158,6 +206,9 @@ class OSDText {
   // line id counter
   int next_id;
 
+  // pixel size currently set on the face
+  size_t face_pixel_size;
+
   // freetype
   char* font; size_t font_size;
   FT_Library* ft; FT_Face* face;
@@ -165,12 +216,27 @@ class OSDText {
   // lines to draw
   std::vector<OSDLine> lines;
 
+  // glyphs rendered so far, one set per font size
+  std::vector<OSDGlyphSet> glyph_sets;
+
+  // glyph atlas (8-bit alpha, rows top to bottom), packed in shelves
+  std::vector<unsigned char> atlas;
+  int atlas_w, atlas_h;
+  int shelf_x, shelf_y, shelf_h;
+  bool atlas_dirty;
+
+  // quads of all the lines, as uploaded to the vbo
+  std::vector<float> batch;
+  bool batch_dirty;
+
   // GL stuff
   GLuint vbo;
+  GLuint atlas_tex;
   GLuint program;
   GLint attribute_coord;
+  GLint attribute_color;
   GLint uniform_tex;
-  GLint uniform_color;
+  GLint uniform_atlas_size;
 
   // GL helpers
   GLuint compile_shaders();
@@ -16,6 +16,9 @@ using namespace chrono;
 #define DEFAULT_W 960
 #define DEFAULT_H 640
 
+// number of recent frames in the frame time histogram
+#define FRAME_HISTORY 128
+
 namespace CGL {
 
 // HDPI display
@@ -26,6 +29,15 @@ int Viewer::framecount;
 time_point<system_clock> Viewer::sys_last;
 time_point<system_clock> Viewer::sys_curr;
 
+// frame time history
+double Viewer::frame_times[FRAME_HISTORY];
+size_t Viewer::frame_times_next;
+size_t Viewer::frame_times_count;
+
+// draw mode
+bool Viewer::on_demand = false;
+bool Viewer::dirty = true;
+
 // draw toggles
 bool Viewer::showInfo = true;
 
@@ -41,6 +53,8 @@ Renderer* Viewer::renderer;
 OSDText* Viewer::osd_text;
 int Viewer::line_id_renderer;
 int Viewer::line_id_framerate;
+int Viewer::line_id_frametime;
+int Viewer::line_id_histogram;
 
 Viewer::Viewer() {
 
@@ -95,6 +109,9 @@ void Viewer::init() {
   glfwSetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS, 1);
   glfwSetMouseButtonCallback(window, mouse_button_callback);
 
+  // window contents damaged (only matters when drawing on demand)
+  glfwSetWindowRefreshCallback(window, refresh_callback);
+
   // initialize glew
   if (glewInit() != GLEW_OK) {
     out_err("Error: could not initialize GLEW!");
@@ -123,11 +140,15 @@ void Viewer::init() {
     exit( 1 );
   }
 
-  // add lines for renderer and fps
+  // add lines for renderer, fps and frame times
   line_id_renderer  = osd_text->add_line(-0.95,  0.90, "Renderer",
                                           18, Color(0.15, 0.5, 0.15));
   line_id_framerate = osd_text->add_line(-0.98, -0.96, "Framerate",
                                           14, Color(0.15, 0.5, 0.15));
+  line_id_frametime = osd_text->add_line(-0.98, -0.90, "",
+                                          14, Color(0.15, 0.5, 0.15));
+  line_id_histogram = osd_text->add_line(-0.98, -0.84, "",
+                                          14, Color(0.15, 0.5, 0.15));
 
   // resize elements to current size
   resize_callback(window, buffer_w, buffer_h);
@@ -140,6 +161,15 @@ void Viewer::start() {
 
   // run update loop
   while( !glfwWindowShouldClose( window ) ) {
+
+    // on demand, sleep until there is something new to draw
+    bool requested = renderer && renderer->take_redraw_request();
+    if( on_demand && !dirty && !requested ) {
+      glfwWaitEvents();
+      continue;
+    }
+
+    dirty = false;
     update();
   }
 }
@@ -148,8 +178,14 @@ void Viewer::set_renderer(Renderer *renderer) {
   this->renderer = renderer;
 }
 
+void Viewer::set_on_demand(bool on_demand) {
+  this->on_demand = on_demand;
+}
+
 void Viewer::update() {
 
+  time_point<steady_clock> frame_start = steady_clock::now();
+
   // clear frame
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -163,6 +199,13 @@ void Viewer::update() {
     drawInfo();
   }
 
+  // record how long the frame took to draw (not counting the wait for
+  // the swap, which is tied to the display's refresh rate)
+  frame_times[frame_times_next] =
+    ((duration<double>) (steady_clock::now() - frame_start)).count();
+  frame_times_next = (frame_times_next + 1) % FRAME_HISTORY;
+  frame_times_count = min(frame_times_count + 1, (size_t) FRAME_HISTORY);
+
   // swap buffers
   glfwSwapBuffers(window);
 
@@ -178,11 +221,20 @@ void Viewer::drawInfo() {
   double elapsed = ((duration<double>) (sys_curr - sys_last)).count();
   if (elapsed >= 1.0f) {
 
-    // update framecount OSD
-    Color c = framecount < 20 ? Color(1.0, 0.35, 0.35) : Color(0.15, 0.5, 0.15);
-    osd_text->set_color(line_id_framerate, c);
-    string framerate_info = "Framerate: " + to_string(framecount) + " fps";
-    osd_text->set_text(line_id_framerate, framerate_info);
+    // update framecount OSD (on demand, a low framerate just means that
+    // little is happening)
+    if (on_demand) {
+      osd_text->set_color(line_id_framerate, Color(0.15f, 0.5f, 0.15f));
+      string framerate_info = "Framerate: " + to_string(framecount) +
+                              " frames in " + to_string((int) elapsed) +
+                              " s (on demand)";
+      osd_text->set_text(line_id_framerate, framerate_info);
+    } else {
+      Color c = framecount < 20 ? Color(1.0f, 0.35f, 0.35f) : Color(0.15f, 0.5f, 0.15f);
+      osd_text->set_color(line_id_framerate, c);
+      string framerate_info = "Framerate: " + to_string(framecount) + " fps";
+      osd_text->set_text(line_id_framerate, framerate_info);
+    }
 
     // reset timer and counter
     framecount = 0;
@@ -195,10 +247,33 @@ void Viewer::drawInfo() {
 
   }
 
-  // udpate renderer OSD
-  // TODO: This is done on every update and it shouldn't be!
-  // The viewer should only update when the renderer needs to
-  // update the info text.
+  // update frame time OSD: percentiles of the recent frames, and how many
+  // of them took under 1, 2, 4, ... 64 ms
+  if (frame_times_count) {
+    vector<double> times(frame_times, frame_times + frame_times_count);
+    sort(times.begin(), times.end());
+    double p50 = times[times.size() / 2] * 1e3;
+    double p95 = times[times.size() * 95 / 100] * 1e3;
+    double tmax = times.back() * 1e3;
+
+    char frametime_info[128];
+    snprintf(frametime_info, sizeof(frametime_info),
+             "Frame time: %.1f ms median, %.1f ms 95th, %.1f ms max (last %zu)",
+             p50, p95, tmax, frame_times_count);
+    osd_text->set_text(line_id_frametime, frametime_info);
+
+    string histogram_info;
+    size_t i = 0;
+    for (int ms = 1; ms <= 64; ms *= 2) {
+      size_t count = 0;
+      while (i < times.size() && times[i] * 1e3 < ms) { i++; count++; }
+      histogram_info += "<" + to_string(ms) + ": " + to_string(count) + "  ";
+    }
+    histogram_info += "more: " + to_string(times.size() - i);
+    osd_text->set_text(line_id_histogram, histogram_info);
+  }
+
+  // udpate renderer OSD (the line is only rebuilt if the text changed)
   if (renderer) {
     string renderer_info = renderer->info();
     osd_text->set_text(line_id_renderer, renderer_info);
@@ -218,6 +293,7 @@ void Viewer::err_callback( int error, const char* description ) {
 
 void Viewer::key_callback( GLFWwindow* window,
                            int key, int scancode, int action, int mods ) {
+  dirty = true;
   if( action == GLFW_PRESS ) {
     if( key == GLFW_KEY_ESCAPE ) {
       glfwSetWindowShouldClose( window, true );
@@ -231,6 +307,8 @@ void Viewer::key_callback( GLFWwindow* window,
 
 void Viewer::resize_callback( GLFWwindow* window, int width, int height ) {
 
+  dirty = true;
+
   // get framebuffer size
   int w, h;
   glfwGetFramebufferSize(window, &w, &h );
@@ -248,6 +326,8 @@ void Viewer::resize_callback( GLFWwindow* window, int width, int height ) {
 
 void Viewer::cursor_callback( GLFWwindow* window, double xpos, double ypos ) {
 
+  dirty = true;
+
   // get keydown bitmask
   unsigned char keys;
   keys  |= (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT)   == GLFW_PRESS);
@@ -271,14 +351,23 @@ void Viewer::cursor_callback( GLFWwindow* window, double xpos, double ypos ) {
 
 void Viewer::scroll_callback( GLFWwindow* window, double xoffset, double yoffset) {
 
+  dirty = true;
+
   renderer->scroll_event(xoffset, yoffset);
 
 }
 
 void Viewer::mouse_button_callback( GLFWwindow* window, int button, int action, int mods ) {
 
+  dirty = true;
   renderer->mouse_button_event( button, action );
 
 }
 
+void Viewer::refresh_callback( GLFWwindow* window ) {
+
+  dirty = true;
+
+}
+
 } // namespace CGL
@@ -59,6 +59,15 @@ class Viewer {
    */
   void set_renderer( Renderer *renderer );
 
+  /**
+   * Choose when the viewer draws.
+   * By default it draws frames continuously. On demand, it sleeps until a
+   * window event arrives (input, resize, expose) or the renderer asks for a
+   * frame with Renderer::redraw(), so an idle viewer uses no CPU or GPU.
+   * \param on_demand Whether to only draw frames on demand.
+   */
+  void set_on_demand( bool on_demand );
+
  private:
 
   /**
@@ -78,6 +87,7 @@ class Viewer {
   static void cursor_callback( GLFWwindow* window, double xpos, double ypos );
   static void scroll_callback( GLFWwindow* window, double xoffset, double yoffset);
   static void mouse_button_callback( GLFWwindow* window, int button, int action, int mods );
+  static void refresh_callback( GLFWwindow* window );
 
   // HDPI display
   static bool HDPI;
@@ -87,6 +97,15 @@ class Viewer {
   static std::chrono::time_point<std::chrono::system_clock> sys_last; 
   static std::chrono::time_point<std::chrono::system_clock> sys_curr; 
 
+  // times taken by the most recent frames (in seconds), in a ring buffer
+  static double frame_times[];
+  static size_t frame_times_next;
+  static size_t frame_times_count;
+
+  // draw on demand, and whether a frame has been asked for
+  static bool on_demand;
+  static bool dirty;
+
   // info toggle
   static bool showInfo;
 
@@ -102,6 +121,8 @@ class Viewer {
   static OSDText* osd_text;
   static int line_id_renderer;
   static int line_id_framerate;
+  static int line_id_frametime;
+  static int line_id_histogram;
 
 
 }; // class Viewer
@@ -0,0 +1,450 @@
+#include "halfEdgeMesh.h"
+#include "student_code.h"
+#include "collada.h"
+#include "bezierPatch.h"
+#include "mergeVertices.h"
+#include "meshCache.h"
+#include "faceBVH.h"
+
+#include "CGL/timer.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace std;
+using namespace CGL;
+
+// Measures the throughput of the halfedge mesh operations on the shipped
+// assets and on synthetic tori of growing size. Every row reports the number
+// of operations, the time they took, the resulting rate, the number and size
+// of the heap allocations made along the way, and the peak resident set size
+// of the process so far.
+//
+// usage: meshBench [file.dae|file.bez ...]
+//
+// Without arguments, the meshes in dae/ and bez/ (or ../dae/ and ../bez/) are
+// used.  Each .dae file is also cached (see meshCache.h), which leaves a
+// .dae.cache file next to it.
+
+////////////////////////
+// Allocation counter //
+////////////////////////
+
+static atomic<size_t> allocations(0);
+static atomic<size_t> allocatedBytes(0);
+
+void* operator new(size_t size) {
+  allocations++;
+  allocatedBytes += size;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+// Peak resident set size of this process, in megabytes.
+double peakRSS() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return (double) usage.ru_maxrss / (1024. * 1024.); // bytes
+#else
+  return (double) usage.ru_maxrss / 1024.; // kilobytes
+#endif
+}
+
+///////////////
+// Reporting //
+///////////////
+
+// Times one run of an operation, along with the allocations it made.
+struct Sample {
+  Timer timer;
+  size_t allocations, allocatedBytes;
+
+  void start() {
+    allocations = ::allocations;
+    allocatedBytes = ::allocatedBytes;
+    timer.start();
+  }
+
+  void stop() {
+    timer.stop();
+    allocations = ::allocations - allocations;
+    allocatedBytes = ::allocatedBytes - allocatedBytes;
+  }
+};
+
+void printHeader() {
+  cout << left << setw(24) << "mesh" << setw(26) << "operation" << right
+       << setw(10) << "count" << setw(12) << "seconds" << setw(14) << "count/sec"
+       << setw(12) << "allocs" << setw(12) << "alloc MB" << setw(12) << "peak MB" << endl;
+}
+
+void printRow(const string& mesh, const string& operation, size_t count, Sample& sample) {
+  double seconds = sample.timer.duration();
+  cout << left << setw(24) << mesh << setw(26) << operation << right
+       << setw(10) << count
+       << setw(12) << fixed << setprecision(6) << seconds
+       << setw(14) << setprecision(0) << (seconds > 0. ? (double) count / seconds : 0.)
+       << setw(12) << sample.allocations
+       << setw(12) << setprecision(2) << (double) sample.allocatedBytes / (1024. * 1024.)
+       << setw(12) << setprecision(2) << peakRSS() << endl;
+}
+
+void printSkipped(const string& mesh, const string& operation, const string& reason) {
+  cout << left << setw(24) << mesh << setw(26) << operation << "skipped (" << reason << ")" << endl;
+}
+
+/////////////
+// Loading //
+/////////////
+
+bool endsWith(const string& s, const string& suffix) {
+  return s.length() >= suffix.length() && s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+// Loads the polygon meshes of a .dae or .bez file (the latter exactly as the
+// viewer does), timing the whole load.
+bool loadMeshes(const string& path, vector<Polymesh*>& meshes, Sample& sample) {
+
+  if (endsWith(path, ".dae")) {
+    Scene* scene = new Scene();
+    sample.start();
+    int loaded = ColladaParser::load(path.c_str(), scene);
+    sample.stop();
+    if (loaded < 0) return false;
+
+    for (size_t i = 0; i < scene->nodes.size(); i++) {
+      Instance* instance = scene->nodes[i].instance;
+      if (instance && instance->type == POLYMESH) meshes.push_back(static_cast<Polymesh*>(instance));
+    }
+    return true;
+  }
+
+  if (endsWith(path, ".bez")) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) return false;
+
+    Polymesh* mesh = new Polymesh();
+    mesh->type = POLYMESH;
+
+    sample.start();
+    vector<BezierPatch> patches;
+    bool loaded = BezierPatch::loadPatches(file, patches);
+    if (loaded) BezierPatch::add2mesh(patches, mesh);
+    sample.stop();
+    fclose(file);
+    if (!loaded) return false;
+
+    meshes.push_back(mesh);
+    return true;
+  }
+
+  return false;
+}
+
+// A triangulated n x n torus.
+Polymesh* makeTorus(size_t n) {
+  Polymesh* mesh = new Polymesh();
+  mesh->type = POLYMESH;
+
+  for (size_t i = 0; i < n; i++) {
+    double u = 2. * M_PI * (double) i / (double) n;
+    for (size_t j = 0; j < n; j++) {
+      double v = 2. * M_PI * (double) j / (double) n;
+      mesh->vertices.push_back(Vector3D((1. + .4 * cos(v)) * cos(u), (1. + .4 * cos(v)) * sin(u), .4 * sin(v)));
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < n; j++) {
+      size_t a = i * n + j, b = ((i + 1) % n) * n + j;
+      size_t c = ((i + 1) % n) * n + (j + 1) % n, d = i * n + (j + 1) % n;
+      Polygon t0, t1;
+      t0.vertex_indices.push_back(a); t0.vertex_indices.push_back(b); t0.vertex_indices.push_back(c);
+      t1.vertex_indices.push_back(a); t1.vertex_indices.push_back(c); t1.vertex_indices.push_back(d);
+      mesh->polygons.push_back(t0);
+      mesh->polygons.push_back(t1);
+    }
+  }
+
+  return mesh;
+}
+
+////////////////
+// Benchmarks //
+////////////////
+
+// Writes the cache of a .dae file, and loads it back (faces per second), then
+// builds the halfedge meshes from the cached connectivity.
+void benchmarkCache(const string& path, const string& name) {
+  Scene scene;
+  if (ColladaParser::load(path.c_str(), &scene) < 0) return;
+
+  size_t faces = 0;
+  for (size_t i = 0; i < scene.nodes.size(); i++) {
+    Instance* instance = scene.nodes[i].instance;
+    if (instance && instance->type == POLYMESH) faces += static_cast<Polymesh*>(instance)->polygons.size();
+  }
+
+  Sample sample;
+  sample.start();
+  bool written = writeMeshCache(path.c_str(), scene);
+  sample.stop();
+  if (!written) {
+    printSkipped(name, "cache", "could not write " + meshCachePath(path.c_str()));
+    return;
+  }
+  printRow(name, "write cache (faces)", faces, sample);
+
+  Scene cached;
+  sample.start();
+  bool loaded = loadMeshCache(path.c_str(), &cached);
+  sample.stop();
+  if (!loaded) {
+    printSkipped(name, "cache", "could not load " + meshCachePath(path.c_str()));
+    return;
+  }
+  printRow(name, "load cache (faces)", faces, sample);
+
+  for (size_t i = 0; i < cached.nodes.size(); i++) {
+    Instance* instance = cached.nodes[i].instance;
+    if (!instance || instance->type != POLYMESH) continue;
+    const Polymesh& polymesh = *static_cast<Polymesh*>(instance);
+    if (polymesh.halfedge_twins.empty()) continue;
+
+    HalfedgeMesh mesh;
+    sample.start();
+    buildHalfedgeMesh(polymesh, mesh);
+    sample.stop();
+    printRow(name, "build cached (faces)", mesh.nFaces(), sample);
+  }
+}
+
+bool isTriangleMesh(const HalfedgeMesh& mesh) {
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+    if (f->degree() != 3) return false;
+  }
+  return true;
+}
+
+void benchmark(const string& name, const Polymesh& polymesh) {
+
+  vector< vector<size_t> > polygons;
+  polygons.reserve(polymesh.polygons.size());
+  for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+    polygons.push_back(polymesh.polygons[i].vertex_indices);
+  }
+
+  Sample sample;
+
+  // HalfedgeMesh::build
+  HalfedgeMesh mesh;
+  sample.start();
+  mesh.build(polygons, polymesh.vertices);
+  sample.stop();
+  printRow(name, "build (faces)", mesh.nFaces(), sample);
+
+  // HalfedgeMesh::operator=
+  {
+    HalfedgeMesh copy;
+    sample.start();
+    copy = mesh;
+    sample.stop();
+    printRow(name, "operator= (faces)", mesh.nFaces(), sample);
+  }
+
+  // Vertex::computeNormal, without and with the cache
+  {
+    double sum = 0.;
+    sample.start();
+    for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+      sum += v->computeNormal().x;
+    }
+    sample.stop();
+    printRow(name, "Vertex::computeNormal", mesh.nVertices(), sample);
+    if (sum != sum) cerr << "NaN normal in " << name << endl;
+
+    mesh.invalidateNormals();
+    sample.start();
+    mesh.updateNormals();
+    sample.stop();
+    printRow(name, "updateNormals (vertices)", mesh.nVertices(), sample);
+  }
+
+  // FaceBVH, building it with the first query and then casting rays from
+  // outside the mesh towards its vertices, as the viewer does when picking
+  {
+    Vector3D center;
+    for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) center += v->position;
+    center /= (double) mesh.nVertices();
+
+    FaceBVH bvh;
+    FaceIter face;
+    double t;
+    sample.start();
+    bvh.intersect(mesh, center, Vector3D(0., 0., 1.), numeric_limits<double>::infinity(), face, t);
+    sample.stop();
+    printRow(name, "FaceBVH build (faces)", mesh.nFaces(), sample);
+
+    size_t rays = 0, hits = 0, i = 0;
+    size_t stride = max((size_t) 1, mesh.nVertices() / 10000);
+    sample.start();
+    for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+      if (i++ % stride != 0) continue;
+      Vector3D o = center + 3. * (v->position - center) + Vector3D(1e-3, 2e-3, 3e-3);
+      if (bvh.intersect(mesh, o, v->position - o, numeric_limits<double>::infinity(), face, t)) hits++;
+      rays++;
+    }
+    sample.stop();
+    printRow(name, "FaceBVH::intersect (rays)", rays, sample);
+    if (hits == 0 && rays > 0) cerr << "No rays hit " << name << endl;
+  }
+
+  // mergeVertices, on a copy in which every polygon has its own vertices
+  {
+    Polymesh soup;
+    for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+      Polygon polygon;
+      const vector<size_t>& indices = polymesh.polygons[i].vertex_indices;
+      for (size_t k = 0; k < indices.size(); k++) {
+        polygon.vertex_indices.push_back(soup.vertices.size());
+        soup.vertices.push_back(polymesh.vertices[indices[k]]);
+      }
+      soup.polygons.push_back(polygon);
+    }
+
+    size_t n = soup.vertices.size();
+    sample.start();
+    mergeVertices(&soup);
+    sample.stop();
+    printRow(name, "mergeVertices (vertices)", n, sample);
+  }
+
+  if (!isTriangleMesh(mesh)) {
+    printSkipped(name, "flipEdge/splitEdge/upsample", "not a triangle mesh");
+    return;
+  }
+
+  // HalfedgeMesh::flipEdge, flipping every interior edge there and back
+  {
+    HalfedgeMesh copy = mesh;
+    size_t flips = 0;
+    sample.start();
+    for (EdgeIter e = copy.edgesBegin(); e != copy.edgesEnd(); e++) {
+      if (e->isBoundary()) continue;
+      copy.flipEdge(copy.flipEdge(e));
+      flips += 2;
+    }
+    sample.stop();
+    printRow(name, "flipEdge", flips, sample);
+  }
+
+  // HalfedgeMesh::splitEdge, splitting every original edge once
+  {
+    HalfedgeMesh copy = mesh;
+    vector<EdgeIter> edges;
+    edges.reserve(copy.nEdges());
+    for (EdgeIter e = copy.edgesBegin(); e != copy.edgesEnd(); e++) edges.push_back(e);
+
+    sample.start();
+    for (size_t i = 0; i < edges.size(); i++) copy.splitEdge(edges[i]);
+    sample.stop();
+    printRow(name, "splitEdge", edges.size(), sample);
+  }
+
+  // MeshResampler::upsample (output faces per second)
+  MeshResampler resampler;
+  {
+    HalfedgeMesh copy = mesh;
+    sample.start();
+    resampler.upsample(copy);
+    sample.stop();
+    printRow(name, "upsample (faces)", copy.nFaces(), sample);
+  }
+  {
+    HalfedgeMesh copy = mesh;
+    sample.start();
+    resampler.upsampleParallel(copy);
+    sample.stop();
+    printRow(name, "upsampleParallel (faces)", copy.nFaces(), sample);
+  }
+}
+
+int main( int argc, char** argv ) {
+
+  vector<string> paths;
+  for (int a = 1; a < argc; a++) paths.push_back(argv[a]);
+
+  if (paths.empty()) {
+    const char* assets[] = { "dae/cube.dae", "dae/quadball.dae", "dae/bean.dae", "dae/teapot.dae",
+                             "dae/cow.dae", "dae/weird.dae", "dae/beetle.dae", "dae/peter.dae",
+                             "bez/wavy_cube.bez", "bez/teapot.bez" };
+    for (size_t i = 0; i < sizeof(assets) / sizeof(assets[0]); i++) {
+      string path = assets[i];
+      FILE* file = fopen(path.c_str(), "r");
+      if (!file) {
+        path = "../" + path;
+        file = fopen(path.c_str(), "r");
+      }
+      if (!file) continue;
+      fclose(file);
+      paths.push_back(path);
+    }
+  }
+
+  printHeader();
+
+  for (size_t i = 0; i < paths.size(); i++) {
+    vector<Polymesh*> meshes;
+    Sample sample;
+    if (!loadMeshes(paths[i], meshes, sample)) {
+      cerr << "Could not load " << paths[i] << endl;
+      continue;
+    }
+
+    string name = paths[i].substr(paths[i].find_last_of('/') + 1);
+    size_t faces = 0;
+    for (size_t m = 0; m < meshes.size(); m++) faces += meshes[m]->polygons.size();
+    printRow(name, "load (faces)", faces, sample);
+    if (endsWith(paths[i], ".dae")) benchmarkCache(paths[i], name);
+
+    for (size_t m = 0; m < meshes.size(); m++) {
+      benchmark(meshes.size() > 1 ? name + "[" + meshes[m]->name + "]" : name, *meshes[m]);
+    }
+  }
+
+  // Synthetic meshes of growing size
+  for (size_t n = 32; n <= 512; n *= 2) {
+    Polymesh* torus = makeTorus(n);
+    stringstream name;
+    name << "torus " << n << "x" << n;
+    benchmark(name.str(), *torus);
+    delete torus;
+  }
+
+  return 0;
+}
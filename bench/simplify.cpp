@@ -0,0 +1,67 @@
+#include "halfEdgeMesh.h"
+#include "student_code.h"
+#include "collada.h"
+
+#include "CGL/timer.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace CGL;
+
+// Loads each given COLLADA file, simplifies every mesh in it to a range of
+// target face counts with MeshResampler::downsample(), and reports the time
+// taken and the resulting throughput (collapsed faces per second).
+//
+// usage: simplify file.dae [file.dae ...]
+int main( int argc, char** argv ) {
+
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " file.dae [file.dae ...]" << endl;
+    return 1;
+  }
+
+  const double ratios[] = { 0.5, 0.25, 0.1 };
+  MeshResampler resampler;
+
+  for (int a = 1; a < argc; a++) {
+    Scene scene;
+    if (ColladaParser::load(argv[a], &scene) < 0) {
+      cerr << "Could not load " << argv[a] << endl;
+      continue;
+    }
+
+    for (size_t n = 0; n < scene.nodes.size(); n++) {
+      Instance* instance = scene.nodes[n].instance;
+      if (!instance || instance->type != POLYMESH) continue;
+      Polymesh& polymesh = static_cast<Polymesh&>(*instance);
+
+      vector<vector<size_t> > polygons;
+      polygons.reserve(polymesh.polygons.size());
+      for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+        polygons.push_back(polymesh.polygons[i].vertex_indices);
+      }
+
+      HalfedgeMesh original;
+      original.build(polygons, polymesh.vertices);
+
+      for (size_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); r++) {
+        HalfedgeMesh mesh = original;
+        Size target = (Size) (ratios[r] * (double) mesh.nFaces());
+
+        Timer timer;
+        timer.start();
+        Size collapses = resampler.downsample(mesh, target);
+        timer.stop();
+
+        double seconds = timer.duration();
+        cout << argv[a] << " [" << polymesh.name << "] "
+             << original.nFaces() << " -> " << mesh.nFaces() << " faces (target " << target << "), "
+             << collapses << " collapses in " << seconds << "s ("
+             << (double) (original.nFaces() - mesh.nFaces()) / seconds << " faces/sec)" << endl;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,208 @@
+#include "texture.h"
+
+#include "CGL/timer.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace CGL;
+
+// Compares the optimized texture sampler (Sampler2DImp) with the plain
+// floating point one (Sampler2DRef) on synthetic textures of a few sizes.
+// Every row reports the number of texels or samples, the time they took, the
+// resulting rate, and the largest difference of any channel from what
+// Sampler2DRef computes for the same input, in 1/255ths.
+//
+// usage: textureBench [samples]
+//
+// Both samplers read the mipmaps Sampler2DImp generated, so that the sampling
+// rows only measure the filtering itself.
+
+///////////////
+// Reporting //
+///////////////
+
+void printHeader() {
+  cout << left << setw(16) << "texture" << setw(30) << "operation" << right
+       << setw(10) << "count" << setw(12) << "seconds" << setw(14) << "count/sec"
+       << setw(10) << "max diff" << endl;
+}
+
+void printRow(const string& texture, const string& operation, size_t count, Timer& timer, int diff) {
+  double seconds = timer.duration();
+  cout << left << setw(16) << texture << setw(30) << operation << right
+       << setw(10) << count
+       << setw(12) << fixed << setprecision(6) << seconds
+       << setw(14) << setprecision(0) << (seconds > 0. ? (double) count / seconds : 0.);
+  if (diff >= 0) cout << setw(10) << diff;
+  cout << endl;
+}
+
+// Largest difference of any channel, in 1/255ths.
+int difference(const Color& a, const Color& b) {
+  float d = max(max(fabsf(a.r - b.r), fabsf(a.g - b.g)), max(fabsf(a.b - b.b), fabsf(a.a - b.a)));
+  return (int) lroundf(d * 255.f);
+}
+
+int difference(const unsigned char* a, const Color& b) {
+  return difference(Color(a[0] / 255.f, a[1] / 255.f, a[2] / 255.f, a[3] / 255.f), b);
+}
+
+///////////////////////
+// Synthetic content //
+///////////////////////
+
+// A small linear congruential generator, so that runs are repeatable.
+struct Random {
+  unsigned int state;
+  Random(unsigned int seed) : state(seed) { }
+  unsigned int next() { return state = state * 1664525u + 1013904223u; }
+  float uniform(float low, float high) { return low + (high - low) * (next() >> 8) / 16777216.f; }
+};
+
+// Smooth gradients with a high frequency checkerboard and some noise on top,
+// so that every level of the mipmap differs from the next.
+Texture makeTexture(size_t width, size_t height) {
+  Texture tex;
+  tex.width = width;
+  tex.height = height;
+  tex.mipmap.resize(1);
+  MipLevel& base = tex.mipmap[0];
+  base.width = width;
+  base.height = height;
+  base.texels.resize(4 * width * height);
+
+  Random random(1);
+  for (size_t y = 0; y < height; y++) {
+    for (size_t x = 0; x < width; x++) {
+      unsigned char* texel = &base.texels[4 * (y * width + x)];
+      int checker = ((x / 4 + y / 4) & 1) ? 40 : -40;
+      texel[0] = (unsigned char) max(0, min(255, (int) (255 * x / width) + checker));
+      texel[1] = (unsigned char) max(0, min(255, (int) (255 * y / height) - checker));
+      texel[2] = (unsigned char) (random.next() >> 24);
+      texel[3] = (unsigned char) (192 + (random.next() >> 26));
+    }
+  }
+  return tex;
+}
+
+int compareMips(const Texture& a, const Texture& b) {
+  if (a.mipmap.size() != b.mipmap.size()) return 256;
+  int diff = 0;
+  for (size_t l = 0; l < a.mipmap.size(); l++) {
+    const vector<unsigned char>& ta = a.mipmap[l].texels;
+    const vector<unsigned char>& tb = b.mipmap[l].texels;
+    if (ta.size() != tb.size()) return 256;
+    for (size_t i = 0; i < ta.size(); i++) diff = max(diff, abs((int) ta[i] - (int) tb[i]));
+  }
+  return diff;
+}
+
+size_t texels(const Texture& tex) {
+  size_t count = 0;
+  for (size_t l = 1; l < tex.mipmap.size(); l++) count += tex.mipmap[l].width * tex.mipmap[l].height;
+  return count;
+}
+
+////////////////
+// Benchmarks //
+////////////////
+
+void benchmark(size_t width, size_t height, size_t samples) {
+
+  stringstream name;
+  name << width << "x" << height;
+  Timer timer;
+
+  // Mipmap generation
+  Texture ref = makeTexture(width, height);
+  Texture tex = makeTexture(width, height);
+  Sampler2DRef refSampler;
+  Sampler2DImp impSampler;
+
+  timer.start();
+  refSampler.generate_mips(ref, 0);
+  timer.stop();
+  printRow(name.str(), "Ref generate_mips (texels)", texels(ref), timer, -1);
+
+  timer.start();
+  impSampler.generate_mips(tex, 0);
+  timer.stop();
+  printRow(name.str(), "Imp generate_mips (texels)", texels(tex), timer, compareMips(tex, ref));
+
+  // Sample points slightly outside of [0, 1] too, to exercise clamping, and
+  // footprints from magnification up to the smallest levels
+  Random random(2);
+  vector<float> uv(2 * samples), scale(2 * samples);
+  for (size_t i = 0; i < samples; i++) {
+    uv[2 * i] = random.uniform(-.05f, 1.05f);
+    uv[2 * i + 1] = random.uniform(-.05f, 1.05f);
+    scale[2 * i] = exp2f(random.uniform(-2.f, 12.f));
+    scale[2 * i + 1] = scale[2 * i] * random.uniform(.5f, 2.f);
+  }
+
+  const char* methods[] = { "nearest", "bilinear", "trilinear" };
+  vector<Color> expected(samples), actual(samples);
+  vector<unsigned char> rgba(4 * samples);
+
+  for (int m = NEAREST; m <= TRILINEAR; m++) {
+    SampleMethod method = (SampleMethod) m;
+    Sampler2DRef refMethod(method);
+    Sampler2DImp impMethod(method);
+    int level = method == TRILINEAR ? 0 : 1;
+
+    timer.start();
+    for (size_t i = 0; i < samples; i++) {
+      float u = uv[2 * i], v = uv[2 * i + 1];
+      if (method == NEAREST) expected[i] = refMethod.sample_nearest(tex, u, v, level);
+      else if (method == BILINEAR) expected[i] = refMethod.sample_bilinear(tex, u, v, level);
+      else expected[i] = refMethod.sample_trilinear(tex, u, v, scale[2 * i], scale[2 * i + 1]);
+    }
+    timer.stop();
+    printRow(name.str(), string("Ref sample_") + methods[m], samples, timer, -1);
+
+    timer.start();
+    for (size_t i = 0; i < samples; i++) {
+      float u = uv[2 * i], v = uv[2 * i + 1];
+      if (method == NEAREST) actual[i] = impMethod.sample_nearest(tex, u, v, level);
+      else if (method == BILINEAR) actual[i] = impMethod.sample_bilinear(tex, u, v, level);
+      else actual[i] = impMethod.sample_trilinear(tex, u, v, scale[2 * i], scale[2 * i + 1]);
+    }
+    timer.stop();
+    int diff = 0;
+    for (size_t i = 0; i < samples; i++) diff = max(diff, difference(actual[i], expected[i]));
+    printRow(name.str(), string("Imp sample_") + methods[m], samples, timer, diff);
+
+    timer.start();
+    impMethod.sample(tex, &uv[0], &scale[0], samples, &rgba[0], level);
+    timer.stop();
+    diff = 0;
+    for (size_t i = 0; i < samples; i++) diff = max(diff, difference(&rgba[4 * i], expected[i]));
+    printRow(name.str(), string("Imp sample (") + methods[m] + ")", samples, timer, diff);
+  }
+}
+
+int main( int argc, char** argv ) {
+
+  size_t samples = 1000000;
+  if (argc > 1) samples = strtoul(argv[1], NULL, 10);
+  if (samples == 0) {
+    cerr << "usage: " << argv[0] << " [samples]" << endl;
+    return 1;
+  }
+
+  printHeader();
+
+  benchmark(1024, 1024, samples);
+  benchmark(2048, 2048, samples);
+  benchmark(1000, 600, samples);  // odd sizes further down the mipmap
+  benchmark(4096, 64, samples);   // one side down to a single texel early
+
+  return 0;
+}
@@ -2,6 +2,7 @@
 #include "CGL/misc.h"
 #include <unordered_map>
 #include <unordered_set>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -119,24 +120,109 @@ namespace CGL {
     glFlush();
   }
 
-  void BezierCurve::drawCurve()
+  void BezierCurve::evaluate(const double* t, size_t n, Vector2D* points, Vector2D* derivatives)
   {
-    std::vector<Vector2D> curvePoints;
+    if (controlPoints.empty()) return;
+    size_t degree = controlPoints.size() - 1;
+    scratch.resize(controlPoints.size());
 
-    float old_t = t;
+    for (size_t k = 0; k < n; k++)
+    {
+      // Each level overwrites the one before it, leaving the last two points
+      // of the evaluation in scratch[0] and scratch[1].
+      copy(controlPoints.begin(), controlPoints.end(), scratch.begin());
+      for (size_t level = degree; level > 1; level--)
+      {
+        for (size_t i = 0; i < level; i++)
+        {
+          scratch[i] = (1 - t[k]) * scratch[i] + t[k] * scratch[i + 1];
+        }
+      }
+
+      if (degree == 0)
+      {
+        points[k] = scratch[0];
+        if (derivatives) derivatives[k] = Vector2D(0, 0);
+        continue;
+      }
 
-    for (float p = 0.0; p <= 1.0f; p += 0.005f)
+      // The curve is an interpolation between the two, and its derivative
+      // is the degree times their difference.
+      points[k] = (1 - t[k]) * scratch[0] + t[k] * scratch[1];
+      if (derivatives) derivatives[k] = (double) degree * (scratch[1] - scratch[0]);
+    }
+  }
+
+  // Whether the n control points of a piece of the curve all lie within
+  // tolerance of the chord between its endpoints.  The piece lies within
+  // their convex hull, so then it does too.
+  static bool isFlat(const Vector2D* p, size_t n, double tolerance)
+  {
+    Vector2D chord = p[n - 1] - p[0];
+    double length2 = chord.norm2();
+    for (size_t i = 1; i + 1 < n; i++)
     {
-      t = p;
-      evaluatedLevels.clear();
-      evaluatedLevels.push_back(controlPoints);
-      for (int i = 0; i < numControlPoints - 1; i++)
+      Vector2D d = p[i] - p[0];
+      double s = length2 > 0 ? clamp(dot(d, chord) / length2, 0., 1.) : 0.;
+      if ((d - s * chord).norm2() > tolerance * tolerance) return false;
+    }
+    return true;
+  }
+
+  void BezierCurve::flatten(double tolerance, std::vector<Vector2D>& polyline)
+  {
+    polyline.clear();
+    if (controlPoints.empty()) return;
+    polyline.push_back(controlPoints[0]);
+    if (controlPoints.size() == 1) return;
+
+    // Pieces are split at most this many times (into 2^20 segments), in case
+    // the tolerance is too small for the precision of the points.
+    const int maxDepth = 20;
+
+    // The pieces are stacked as consecutive runs of n control points, the
+    // one that comes first along the curve on top.
+    size_t n = controlPoints.size();
+    pieces.assign(controlPoints.begin(), controlPoints.end());
+    pieceDepths.assign(1, 0);
+    while (!pieceDepths.empty())
+    {
+      size_t top = pieces.size() - n;
+      int depth = pieceDepths.back();
+      if (depth == maxDepth || isFlat(&pieces[top], n, tolerance))
       {
-        evaluateStep();
+        polyline.push_back(pieces[top + n - 1]);
+        pieces.resize(top);
+        pieceDepths.pop_back();
+        continue;
       }
-      std::vector<Vector2D>& lastLevel = evaluatedLevels[evaluatedLevels.size() - 1];
-      curvePoints.push_back(lastLevel[0]);
+
+      // Split the piece at t = 1/2.  The first points of the levels of de
+      // Casteljau's algorithm are the control points of the first half, and
+      // the last points (which the in-place evaluation leaves behind) those
+      // of the second half.
+      pieces.resize(top + 2 * n);
+      Vector2D* second = &pieces[top];
+      Vector2D* first = second + n;
+      for (size_t level = 0; level < n; level++)
+      {
+        first[level] = second[0];
+        for (size_t i = 0; i + level + 1 < n; i++)
+        {
+          second[i] = .5 * (second[i] + second[i + 1]);
+        }
+      }
+
+      pieceDepths.back() = depth + 1;
+      pieceDepths.push_back(depth + 1);
     }
+  }
+
+  void BezierCurve::drawCurve()
+  {
+    // Half a pixel, in the units of the control points (the shorter side of
+    // the window is one unit long).
+    flatten(.5 / max(min(width, height), (size_t) 1), curvePoints);
 
     glColor3f(0.0, 1.0, 0.0);
 
@@ -147,8 +233,6 @@ namespace CGL {
       glVertex2f(pt.x, pt.y);
     }
     glEnd();
-
-    t = old_t;
   }
 
   void BezierCurve::key_event(char key)
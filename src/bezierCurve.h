@@ -16,6 +16,21 @@ namespace CGL {
     void evaluateStep();
     void drawCurve();
 
+    // Evaluates the curve (of any degree) at the n parameters t[k], writing
+    // the points to points[k] and, unless derivatives is null, the first
+    // derivatives to derivatives[k].  Each evaluation runs de Casteljau's
+    // algorithm in place, in a scratch buffer that is kept between calls, so
+    // nothing is allocated once it holds all the control points.
+    void evaluate(const double* t, size_t n, Vector2D* points, Vector2D* derivatives = NULL);
+
+    // Replaces polyline with one that stays within tolerance of the curve.
+    // The curve is split in half (by de Casteljau's algorithm) until the
+    // control points of each piece lie within tolerance of the chord between
+    // its endpoints, so straight stretches get a single segment and tight
+    // bends as many as they need.  The pieces are kept on a stack that is
+    // reused between calls.
+    void flatten(double tolerance, std::vector<Vector2D>& polyline);
+
     // inherited Renderer interface functions
     void render();
     void init() {}
@@ -41,6 +56,11 @@ namespace CGL {
                                                           // * *
                                                           // *
 
+    std::vector<Vector2D> scratch;         // Intermediate points of evaluate()
+    std::vector<Vector2D> pieces;          // Control points of the pieces still to be flattened, and their depths
+    std::vector<int> pieceDepths;
+    std::vector<Vector2D> curvePoints;     // Polyline drawn by drawCurve()
+
     float t; // Value between 0 and 1 to evaluate the Bezier curve at
     int numControlPoints;
 
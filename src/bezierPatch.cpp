@@ -1,6 +1,8 @@
 #include "bezierPatch.h"
-#include <unordered_map>
-#include <unordered_set>
+#include "mergeVertices.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
 
 using namespace std;
 
@@ -17,34 +19,374 @@ namespace CGL {
 
   void BezierPatch::add2mesh(Polymesh* mesh) const
   {
-    int nu = 16;
-    int nv = 16;
-    for (int i = 0; i < nu; i++)
+    tessellate(this, 1, 0., mesh);
+  }
+
+  void BezierPatch::add2mesh(Polymesh* mesh, double tolerance) const
+  {
+    tessellate(this, 1, tolerance, mesh);
+  }
+
+  void BezierPatch::add2mesh(const vector<BezierPatch>& patches, Polymesh* mesh, double tolerance)
+  {
+    if (patches.empty()) return;
+    tessellate(&patches[0], patches.size(), tolerance, mesh);
+
+    // Close the seams between patches that meet without sharing control points.
+    mergeVertices(mesh);
+  }
+
+  void BezierPatch::segments(double tolerance, int& nu, int& nv) const
+  {
+    if (tolerance <= 0.)
+    {
+      nu = nv = 16;
+      return;
+    }
+
+    // Bounds on the second differences of the control points along u (the
+    // second index), along v (the first index), and across both.
+    double duu = 0., dvv = 0., duv = 0.;
+    for (int i = 0; i < 4; i++)
+    {
+      for (int j = 0; j < 4; j++)
+      {
+        const vector< vector<Vector3D> >& p = controlPoints;
+        if (j < 2) duu = max(duu, (p[i][j] - 2. * p[i][j+1] + p[i][j+2]).norm());
+        if (i < 2) dvv = max(dvv, (p[i][j] - 2. * p[i+1][j] + p[i+2][j]).norm());
+        if (i < 3 && j < 3) duv = max(duv, (p[i+1][j+1] - p[i+1][j] - p[i][j+1] + p[i][j]).norm());
+      }
+    }
+
+    // A grid of nu x nv cells stays within (6 duu / nu^2 + 18 duv / (nu nv)
+    // + 6 dvv / nv^2) / 8 of a bicubic patch; each direction gets half of the
+    // tolerance, and half of the mixed term.
+    const int maxSegments = 128;
+    nu = (int) ceil(sqrt((6. * duu + 9. * duv) / (4. * tolerance)));
+    nv = (int) ceil(sqrt((6. * dvv + 9. * duv) / (4. * tolerance)));
+    nu = min(max(nu, 1), maxSegments);
+    nv = min(max(nv, 1), maxSegments);
+  }
+
+  // The cubic Bernstein weights of n parameters, one array per weight.
+  static void bernstein(const double* t, size_t n, double* b0, double* b1, double* b2, double* b3)
+  {
+    for (size_t k = 0; k < n; k++)
+    {
+      double s = 1. - t[k];
+      b0[k] = s * s * s;
+      b1[k] = 3. * s * s * t[k];
+      b2[k] = 3. * s * t[k] * t[k];
+      b3[k] = t[k] * t[k] * t[k];
+    }
+  }
+
+  // Number of samples evaluated together (in arrays on the stack).
+  static const size_t blockSize = 64;
+
+  void BezierPatch::evaluate(const double* u, const double* v, size_t n, Vector3D* points) const
+  {
+    double bu[4][blockSize], bv[4][blockSize], p[3][blockSize];
+    for (size_t begin = 0; begin < n; begin += blockSize)
+    {
+      size_t m = min(n - begin, blockSize);
+      bernstein(u + begin, m, bu[0], bu[1], bu[2], bu[3]);
+      bernstein(v + begin, m, bv[0], bv[1], bv[2], bv[3]);
+      for (int c = 0; c < 3; c++) fill(p[c], p[c] + m, 0.);
+
+      // Control point (i, j) is weighted by the jth weight of u and the ith
+      // weight of v.
+      for (int i = 0; i < 4; i++)
+      {
+        for (int j = 0; j < 4; j++)
+        {
+          const Vector3D& cp = controlPoints[i][j];
+          for (size_t k = 0; k < m; k++)
+          {
+            double w = bu[j][k] * bv[i][k];
+            p[0][k] += w * cp.x;
+            p[1][k] += w * cp.y;
+            p[2][k] += w * cp.z;
+          }
+        }
+      }
+
+      for (size_t k = 0; k < m; k++) points[begin + k] = Vector3D(p[0][k], p[1][k], p[2][k]);
+    }
+  }
+
+  void BezierPatch::evaluateGrid(int nu, int nv, Vector3D* points) const
+  {
+    double v[blockSize], bv[4][blockSize], p[3][blockSize];
+    for (int begin = 0; begin <= nv; begin += blockSize)
+    {
+      int m = min(nv + 1 - begin, (int) blockSize);
+      for (int k = 0; k < m; k++) v[k] = (begin + k) / double(nv);
+      bernstein(v, m, bv[0], bv[1], bv[2], bv[3]);
+
+      for (int i = 0; i <= nu; i++)
+      {
+        // Row i lies on the curve of constant u = i / nu, whose control
+        // points are those of the rows of the patch evaluated at u.
+        double t = i / double(nu), s = 1. - t;
+        double bu[4] = { s * s * s, 3. * s * s * t, 3. * s * t * t, t * t * t };
+        double curve[3][4];
+        for (int a = 0; a < 4; a++)
+        {
+          const vector<Vector3D>& row = controlPoints[a];
+          for (int c = 0; c < 3; c++)
+          {
+            curve[c][a] = bu[0] * row[0][c] + bu[1] * row[1][c] + bu[2] * row[2][c] + bu[3] * row[3][c];
+          }
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+          for (int k = 0; k < m; k++)
+          {
+            p[c][k] = bv[0][k] * curve[c][0] + bv[1][k] * curve[c][1] + bv[2][k] * curve[c][2] + bv[3][k] * curve[c][3];
+          }
+        }
+
+        Vector3D* out = points + i * (nv + 1) + begin;
+        for (int k = 0; k < m; k++) out[k] = Vector3D(p[0][k], p[1][k], p[2][k]);
+      }
+    }
+  }
+
+  // Union-find over the samples of all patches; the root of each set is its
+  // lowest-numbered sample.
+  static size_t findSample(vector<size_t>& parent, size_t i)
+  {
+    while (parent[i] != i)
+    {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  static void shareSample(vector<size_t>& parent, size_t a, size_t b)
+  {
+    a = findSample(parent, a);
+    b = findSample(parent, b);
+    if (a < b) parent[b] = a;
+    else parent[a] = b;
+  }
+
+  // Sample k along a side of a patch with the given first sample and
+  // number of segments (sides 0 and 1 run along v, sides 2 and 3 along u).
+  static size_t sideSample(size_t first, int nu, int nv, int side, int k)
+  {
+    switch (side)
+    {
+      case 0:  return first + k;
+      case 1:  return first + nu * (nv + 1) + k;
+      case 2:  return first + k * (nv + 1);
+      default: return first + k * (nv + 1) + nv;
+    }
+  }
+
+  void BezierPatch::tessellate(const BezierPatch* patches, size_t nPatches, double tolerance, Polymesh* mesh)
+  {
+    // The four sides of a patch (u = 0, u = 1, v = 0 and v = 1) are Bezier
+    // curves, each defined by a row or column of control points.  Sides with
+    // the same control points (in either order) are the same curve, so their
+    // samples will be shared.
+    vector<int> nu(nPatches), nv(nPatches);
+    vector<bool> reversed(nPatches * 4), collapsed(nPatches * 4);
+    vector< vector<size_t> > curves; // sides (4 * patch + side) that are the same curve
+    map< vector<double>, size_t > curveIndex;
+    for (size_t p = 0; p < nPatches; p++)
     {
-      for (int j = 0; j < nv; j++)
+      patches[p].segments(tolerance, nu[p], nv[p]);
+
+      const vector< vector<Vector3D> >& cp = patches[p].controlPoints;
+      for (int side = 0; side < 4; side++)
       {
-        Vector3D v0, v1, v2, v3;
-        v0 = evaluate(i/double(nu), j/double(nv));
-        v1 = evaluate((i+1)/double(nu), j/double(nv));
-        v2 = evaluate((i+1)/double(nu), (j+1)/double(nv));
-        v3 = evaluate(i/double(nu), (j+1)/double(nv));
-        addTriangle(mesh, v1, v2, v0);
-        addTriangle(mesh, v2, v3, v0);
+        Vector3D points[4];
+        for (int k = 0; k < 4; k++)
+        {
+          points[k] = side == 0 ? cp[k][0] : side == 1 ? cp[k][3] : side == 2 ? cp[0][k] : cp[3][k];
+        }
+
+        bool same = true;
+        for (int k = 1; k < 4; k++)
+        {
+          same = same && points[k].x == points[0].x && points[k].y == points[0].y && points[k].z == points[0].z;
+        }
+        collapsed[4 * p + side] = same;
+        if (same) continue;
+
+        // Key the curve by its control points, in whichever order is smaller.
+        vector<double> forward, backward;
+        for (int k = 0; k < 4; k++)
+        {
+          for (int c = 0; c < 3; c++)
+          {
+            forward.push_back(points[k][c]);
+            backward.push_back(points[3 - k][c]);
+          }
+        }
+        reversed[4 * p + side] = backward < forward;
+
+        map< vector<double>, size_t >::iterator curve = curveIndex.find(backward < forward ? backward : forward);
+        if (curve == curveIndex.end())
+        {
+          curveIndex[backward < forward ? backward : forward] = curves.size();
+          curves.push_back(vector<size_t>(1, 4 * p + side));
+        }
+        else
+        {
+          curves[curve->second].push_back(4 * p + side);
+        }
       }
     }
+
+    // Sides 0 and 1 run along v, and sides 2 and 3 along u.  All the sides
+    // of a curve must have the same number of segments, so raise them to the
+    // largest one until every curve agrees.
+    bool changed = true;
+    while (changed)
+    {
+      changed = false;
+      for (size_t c = 0; c < curves.size(); c++)
+      {
+        int n = 0;
+        for (size_t k = 0; k < curves[c].size(); k++)
+        {
+          size_t p = curves[c][k] / 4;
+          n = max(n, curves[c][k] % 4 < 2 ? nv[p] : nu[p]);
+        }
+        for (size_t k = 0; k < curves[c].size(); k++)
+        {
+          size_t p = curves[c][k] / 4;
+          int& m = curves[c][k] % 4 < 2 ? nv[p] : nu[p];
+          if (m < n)
+          {
+            m = n;
+            changed = true;
+          }
+        }
+      }
+    }
+
+    // Sample (i, j) of patch p lies at (u, v) = (i / nu, j / nv), and is
+    // evaluated just once, along with the rest of the grid of the patch.
+    vector<size_t> first(nPatches + 1, 0), firstTriangle(nPatches + 1, 0);
+    for (size_t p = 0; p < nPatches; p++)
+    {
+      first[p + 1] = first[p] + (nu[p] + 1) * (nv[p] + 1);
+      firstTriangle[p + 1] = firstTriangle[p] + 2 * nu[p] * nv[p];
+    }
+
+    vector<Vector3D> grid(first[nPatches]);
+    #pragma omp parallel for
+    for (long p = 0; p < (long) nPatches; p++)
+    {
+      patches[p].evaluateGrid(nu[p], nv[p], &grid[first[p]]);
+    }
+
+    // Share the samples of the sides of each curve, and all the samples of
+    // a side that has collapsed to a point.
+    vector<size_t> parent(grid.size());
+    for (size_t i = 0; i < parent.size(); i++) parent[i] = i;
+
+    for (size_t s = 0; s < 4 * nPatches; s++)
+    {
+      if (!collapsed[s]) continue;
+      size_t p = s / 4;
+      int side = s % 4, n = side < 2 ? nv[p] : nu[p];
+      for (int k = 1; k <= n; k++)
+      {
+        shareSample(parent, sideSample(first[p], nu[p], nv[p], side, 0), sideSample(first[p], nu[p], nv[p], side, k));
+      }
+    }
+
+    for (size_t c = 0; c < curves.size(); c++)
+    {
+      size_t s0 = curves[c][0], p0 = s0 / 4;
+      int n = s0 % 4 < 2 ? nv[p0] : nu[p0];
+      for (size_t k = 1; k < curves[c].size(); k++)
+      {
+        size_t s1 = curves[c][k], p1 = s1 / 4;
+        for (int t = 0; t <= n; t++)
+        {
+          // Sample t along the curve, counted from the end that comes first in its key.
+          size_t a = sideSample(first[p0], nu[p0], nv[p0], s0 % 4, reversed[s0] ? n - t : t);
+          size_t b = sideSample(first[p1], nu[p1], nv[p1], s1 % 4, reversed[s1] ? n - t : t);
+          shareSample(parent, a, b);
+        }
+      }
+    }
+
+    // Number the vertices in order of their lowest-numbered sample.
+    vector<size_t> index(grid.size());
+    for (size_t i = 0; i < grid.size(); i++)
+    {
+      size_t root = findSample(parent, i);
+      if (root == i)
+      {
+        index[i] = mesh->vertices.size();
+        mesh->vertices.push_back(grid[i]);
+      }
+      else
+      {
+        index[i] = index[root];
+      }
+    }
+
+    // Two triangles per grid cell, leaving out those that have collapsed
+    // along with a side.
+    size_t base = mesh->polygons.size();
+    mesh->polygons.resize(base + firstTriangle[nPatches]);
+    vector<char> valid(firstTriangle[nPatches]);
+    #pragma omp parallel for
+    for (long p = 0; p < (long) nPatches; p++)
+    {
+      for (int i = 0; i < nu[p]; i++)
+      {
+        for (int j = 0; j < nv[p]; j++)
+        {
+          size_t v0 = index[first[p] + i * (nv[p] + 1) + j];
+          size_t v1 = index[first[p] + (i + 1) * (nv[p] + 1) + j];
+          size_t v2 = index[first[p] + (i + 1) * (nv[p] + 1) + j + 1];
+          size_t v3 = index[first[p] + i * (nv[p] + 1) + j + 1];
+          size_t t = firstTriangle[p] + 2 * (i * nv[p] + j);
+
+          vector<size_t>& t0 = mesh->polygons[base + t].vertex_indices;
+          t0.push_back(v1); t0.push_back(v2); t0.push_back(v0);
+          valid[t] = v1 != v2 && v2 != v0 && v0 != v1;
+
+          vector<size_t>& t1 = mesh->polygons[base + t + 1].vertex_indices;
+          t1.push_back(v2); t1.push_back(v3); t1.push_back(v0);
+          valid[t + 1] = v2 != v3 && v3 != v0 && v0 != v2;
+        }
+      }
+    }
+
+    size_t kept = base;
+    for (size_t t = 0; t < valid.size(); t++)
+    {
+      if (!valid[t]) continue;
+      if (kept != base + t) swap(mesh->polygons[kept], mesh->polygons[base + t]);
+      kept++;
+    }
+    mesh->polygons.resize(kept);
   }
 
-  void BezierPatch::addTriangle(Polymesh* mesh, const Vector3D& v0, const Vector3D& v1, const Vector3D& v2) const
+  bool BezierPatch::loadPatches(FILE* file, vector<BezierPatch>& patches)
   {
-    size_t base = mesh->vertices.size();
-    mesh->vertices.push_back(v0);
-    mesh->vertices.push_back(v1);
-    mesh->vertices.push_back(v2);
-    Polygon poly;
-    poly.vertex_indices.push_back(base);
-    poly.vertex_indices.push_back(base+1);
-    poly.vertex_indices.push_back(base+2);
-    mesh->polygons.push_back(poly);
+    int n = 0;
+    if (fscanf(file, "%d", &n) != 1 || n < 0) return false;
+
+    size_t base = patches.size();
+    patches.resize(base + n);
+    for (int i = 0; i < n; i++)
+    {
+      patches[base + i].loadControlPoints(file);
+    }
+    return true;
   }
 
   void BezierPatch::loadControlPoints(FILE* file)
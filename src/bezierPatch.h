@@ -10,13 +10,49 @@ namespace CGL {
   public:
     BezierPatch();
 
+    // Appends a 16 x 16 grid of samples of the patch to the mesh, two
+    // triangles per cell; or, given a tolerance, the coarsest grid that stays
+    // within that distance of the surface (see segments()).
     void add2mesh(Polymesh* mesh) const;
+    void add2mesh(Polymesh* mesh, double tolerance) const;
     void loadControlPoints(FILE* file);
+
+    // Tessellates all the given patches into the mesh, in parallel.  Patches
+    // whose boundary curves have the same control points share the vertices
+    // along them (and the same number of segments, so that the seams have no
+    // cracks), and the result is welded just once, with mergeVertices().
+    // A tolerance of zero gives every patch a 16 x 16 grid.
+    static void add2mesh(const std::vector<BezierPatch>& patches, Polymesh* mesh, double tolerance = 0.);
+
+    // Number of segments along u and v for the tessellation to deviate from
+    // the surface by at most the given distance, according to a bound on the
+    // second derivatives of the patch (16 x 16 if the tolerance is zero, and
+    // at most 128 x 128 otherwise).  A screen-space bound can be turned into
+    // such a distance by multiplying it with the size of a pixel at the depth
+    // of the patch.
+    void segments(double tolerance, int& nu, int& nv) const;
+
+    // Evaluates the patch at the n parameter pairs (u[k], v[k]), writing the
+    // results to points[k].  Unlike the single-point evaluate(), the samples
+    // are taken a block at a time: the Bernstein weights in u and v are
+    // computed once for the whole block, then summed over the control points
+    // row by row, in loops that vectorize across the samples.
+    void evaluate(const double* u, const double* v, size_t n, Vector3D* points) const;
+
+    // Evaluates the (nu + 1) x (nv + 1) grid of samples at (u, v) = (i / nu,
+    // j / nv), writing sample (i, j) to points[i * (nv + 1) + j].  The weights
+    // of each column are shared by all the rows, so this takes about a
+    // quarter of the work of evaluating the samples one by one.
+    void evaluateGrid(int nu, int nv, Vector3D* points) const;
+
+    // Reads the number of patches, followed by their control points (as in a
+    // .bez file), and appends them to the given list.
+    static bool loadPatches(FILE* file, std::vector<BezierPatch>& patches);
   protected:
     std::vector< std::vector<Vector3D> > controlPoints;
     Vector3D evaluate(double u, double v) const;
-    Vector3D evaluate1D(std::vector<Vector3D> points, double t) const;
-    void addTriangle(Polymesh* mesh, const Vector3D& v0, const Vector3D& v1, const Vector3D& v2) const;
+    Vector3D evaluate1D(const Vector3D points[4], double t) const;
+    static void tessellate(const BezierPatch* patches, size_t nPatches, double tolerance, Polymesh* mesh);
   };
 
 }
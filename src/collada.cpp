@@ -1,6 +1,9 @@
 #include "collada.h"
+#include "CGL/timer.h"
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <map>
 #include <string>
 #include <iomanip>
@@ -29,6 +32,8 @@ namespace CGL {
   XMLElement* ColladaParser::e_materials;    // COLLADA library: materials
   XMLElement* ColladaParser::e_effects;      // COLLADA library: effects
 
+  ColladaLoadStats ColladaParser::loadStats;
+
   XMLElement* find_instance( XMLElement* entry, string id ) {
 
     assert( entry );
@@ -55,29 +60,155 @@ namespace CGL {
     return NULL;
   }
 
-  Color rgb_from_string ( string color_string ) {
+  // Number scanning //
 
-    Color c;
+  // The number arrays of a mesh make up most of a document, so they are
+  // scanned by hand rather than through a stringstream.  Decimals that fit
+  // the fast path are converted with a single (correctly rounded) float or
+  // double operation, and anything else goes to strtof / strtod, so the
+  // results are the same as those of operator>>.
+
+  static inline bool is_space( char c ) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+  }
+
+  // Reads the digits of a decimal (without a sign) as mantissa * 10^exponent;
+  // returns false if they don't fit in the mantissa, or there are none.
+  static bool scan_decimal( const char*& s, uint64_t& mantissa, int& exponent ) {
+
+    mantissa = 0; exponent = 0;
+    int digits = 0; bool exact = true, any = false;
+
+    for ( ; *s >= '0' && *s <= '9'; s++, any = true ) {
+      if ( digits < 19 ) { mantissa = 10 * mantissa + (*s - '0'); digits += mantissa > 0; }
+      else { exponent++; exact = false; }
+    }
+    if ( *s == '.' ) {
+      for ( s++; *s >= '0' && *s <= '9'; s++, any = true ) {
+        if ( digits < 19 ) { mantissa = 10 * mantissa + (*s - '0'); digits += mantissa > 0; exponent--; }
+        else exact = false;
+      }
+    }
+    if ( any && (*s == 'e' || *s == 'E') ) {
+      const char* e = s + 1;
+      bool negative = *e == '-';
+      if ( *e == '-' || *e == '+' ) e++;
+      if ( *e < '0' || *e > '9' ) return false;
+      int n = 0;
+      for ( ; *e >= '0' && *e <= '9'; e++ ) n = n < 10000 ? 10 * n + (*e - '0') : n;
+      exponent += negative ? -n : n;
+      s = e;
+    }
+
+    return any && exact;
+  }
+
+  static bool scan_number( const char*& s, float& f ) {
+
+    static const float powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+    while ( is_space(*s) ) s++;
+    const char* start = s;
+    bool negative = *s == '-';
+    if ( *s == '-' || *s == '+' ) s++;
+
+    // Both the mantissa and the power of ten are exact floats.
+    uint64_t mantissa; int exponent;
+    if ( scan_decimal(s, mantissa, exponent) && mantissa <= (1 << 24) && exponent >= -10 && exponent <= 10 ) {
+      f = exponent < 0 ? (float) mantissa / powers[-exponent] : (float) mantissa * powers[exponent];
+      if ( negative ) f = -f;
+      return true;
+    }
+
+    char* end;
+    f = strtof( start, &end );
+    s = end;
+    return end != start;
+  }
+
+  static bool scan_number( const char*& s, double& d ) {
+
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    while ( is_space(*s) ) s++;
+    const char* start = s;
+    bool negative = *s == '-';
+    if ( *s == '-' || *s == '+' ) s++;
+
+    // Both the mantissa and the power of ten are exact doubles.
+    uint64_t mantissa; int exponent;
+    if ( scan_decimal(s, mantissa, exponent) && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22 ) {
+      d = exponent < 0 ? (double) mantissa / powers[-exponent] : (double) mantissa * powers[exponent];
+      if ( negative ) d = -d;
+      return true;
+    }
+
+    char* end;
+    d = strtod( start, &end );
+    s = end;
+    return end != start;
+  }
+
+  static bool scan_number( const char*& s, size_t& i ) {
+
+    while ( is_space(*s) ) s++;
+    if ( *s < '0' || *s > '9' ) return false;
+
+    for ( i = 0; *s >= '0' && *s <= '9'; s++ ) i = 10 * i + (*s - '0');
+    return true;
+  }
+
+  // Scans up to n numbers from the text of an element into out, and returns
+  // how many were read; the time taken and the amount of text count towards
+  // the load statistics.
+  template< class T >
+  static size_t scan_array( const char* text, T* out, size_t n, ColladaLoadStats& stats ) {
+
+    if ( !text ) return 0;
+
+    Timer timer;
+    timer.start();
+    const char* s = text;
+    size_t read = 0;
+    while ( read < n && scan_number(s, out[read]) ) read++;
+    timer.stop();
+
+    stats.numberBytes += s - text;
+    stats.numberSeconds += timer.duration();
+    return read;
+  }
 
-    stringstream ss (color_string);
-    ss >> c.r;
-    ss >> c.g;
-    ss >> c.b;
+  // Scans n numbers from text, leaving those that are missing as they were.
+  template< class T >
+  static void scan_numbers( const char* text, T* out, size_t n ) {
+    if ( !text ) return;
+    for ( size_t i = 0; i < n && scan_number(text, out[i]); i++ );
+  }
+
+  Color rgb_from_string ( const char* color_string ) {
+
+    Color c;
+    float rgb[3] = { 0, 0, 0 };
+    scan_numbers( color_string, rgb, 3 );
+    c.r = rgb[0];
+    c.g = rgb[1];
+    c.b = rgb[2];
     c.a = 1.0;
 
     return c;
 
   }
 
-  Color rgba_from_string ( string color_string ) {
+  Color rgba_from_string ( const char* color_string ) {
 
     Color c;
-
-    stringstream ss (color_string);
-    ss >> c.r;
-    ss >> c.g;
-    ss >> c.b;
-    ss >> c.a;
+    float rgba[4] = { 0, 0, 0, 0 };
+    scan_numbers( color_string, rgba, 4 );
+    c.r = rgba[0];
+    c.g = rgba[1];
+    c.b = rgba[2];
+    c.a = rgba[3];
 
     return c;
 
@@ -85,13 +216,23 @@ namespace CGL {
 
   int ColladaParser::load( const char* filename, Scene* scene ) {
 
-    ifstream in( filename );
+    Timer total;
+    total.start();
+    loadStats = ColladaLoadStats();
+
+    ifstream in( filename, ios::binary | ios::ate );
     if ( !in.is_open() ) {
       return -1;
-    } in.close();
+    }
+    loadStats.fileBytes = in.tellg();
+    in.close();
 
+    Timer timer;
+    timer.start();
     XMLDocument doc;
     doc.LoadFile( filename );
+    timer.stop();
+    loadStats.xmlSeconds = timer.duration();
     if ( doc.Error() ) {
       doc.PrintError();
       exit( 1 );
@@ -162,20 +303,272 @@ namespace CGL {
           // Note (Sky):
           // not sure if there are non-indirection encodings but
           // if there is then it should be handled here
+          total.stop();
+          loadStats.totalSeconds = total.duration();
           return 0;
 
         }
       }
     }
 
+    total.stop();
+    loadStats.totalSeconds = total.duration();
     return 0;
 
   }
 
+  // Writer //
+
+  string floats_to_string( const float* f, size_t n ) {
+
+    stringstream ss;
+    ss << setprecision(9); // enough digits to read back the same float
+    for (size_t i = 0; i < n; ++i) {
+      if ( i ) ss << " ";
+      ss << f[i];
+    }
+
+    return ss.str();
+  }
+
+  string color_to_string( const Color& c ) {
+
+    float rgba[4] = { c.r, c.g, c.b, c.a };
+    return floats_to_string( rgba, 4 );
+  }
+
+  void write_color( XMLPrinter& out, const char* name, const Color& c ) {
+
+    out.OpenElement( name );
+    out.OpenElement( "color" );
+    out.PushText( color_to_string(c).c_str() );
+    out.CloseElement();
+    out.CloseElement();
+  }
+
+  void write_float( XMLPrinter& out, const char* name, float f ) {
+
+    out.OpenElement( name );
+    out.OpenElement( "float" );
+    out.PushText( floats_to_string(&f, 1).c_str() );
+    out.CloseElement();
+    out.CloseElement();
+  }
+
+  void write_source( XMLPrinter& out, const string& id, const vector<float>& floats, size_t stride ) {
+
+    out.OpenElement( "source" );
+    out.PushAttribute( "id", id.c_str() );
+
+    out.OpenElement( "float_array" );
+    out.PushAttribute( "id", (id + "-array").c_str() );
+    out.PushAttribute( "count", (unsigned) floats.size() );
+    out.PushText( floats_to_string(floats.data(), floats.size()).c_str() );
+    out.CloseElement();
+
+    out.OpenElement( "technique_common" );
+    out.OpenElement( "accessor" );
+    out.PushAttribute( "source", ("#" + id + "-array").c_str() );
+    out.PushAttribute( "count", (unsigned) (floats.size() / stride) );
+    out.PushAttribute( "stride", (unsigned) stride );
+    const char* params[3] = { "X", "Y", "Z" };
+    for (size_t i = 0; i < stride; ++i) {
+      out.OpenElement( "param" );
+      out.PushAttribute( "name", params[i] );
+      out.PushAttribute( "type", "float" );
+      out.CloseElement();
+    }
+    out.CloseElement();
+    out.CloseElement();
+
+    out.CloseElement();
+  }
+
+  // NOTE:
+  // Only polygon meshes are written, along with their materials and node
+  // transformations; cameras and lights are skipped, and so are normals and
+  // texture coordinates, which the viewer recomputes anyway. Every mesh gets
+  // its own material, named after the mesh, so that the file can be read
+  // back by load().
   int ColladaParser::save( const char* filename, const Scene* scene ) {
 
-    // TODO: not yet supported
-    return 0;
+    FILE* file = fopen( filename, "w" );
+    if ( !file ) {
+      return -1;
+    }
+
+    // collect meshes and give each one a unique id
+    vector<const Node*> nodes; vector<string> ids;
+    for (size_t i = 0; i < scene->nodes.size(); ++i) {
+      const Instance* instance = scene->nodes[i].instance;
+      if ( !instance || instance->type != POLYMESH ) continue;
+      stringstream ss; ss << "mesh" << nodes.size();
+      nodes.push_back( &scene->nodes[i] );
+      ids.push_back( ss.str() );
+    }
+
+    XMLPrinter out( file );
+    out.PushHeader( false, true );
+
+    out.OpenElement( "COLLADA" );
+    out.PushAttribute( "xmlns", "http://www.collada.org/2005/11/COLLADASchema" );
+    out.PushAttribute( "version", "1.4.1" );
+
+    out.OpenElement( "asset" );
+    out.OpenElement( "up_axis" );
+    out.PushText( "Y_UP" );
+    out.CloseElement();
+    out.CloseElement();
+
+    // effects
+    out.OpenElement( "library_effects" );
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      const Polymesh& polymesh = static_cast<const Polymesh&>( *nodes[i]->instance );
+
+      Material material = Material();
+      material.diff = Color( 0.8f, 0.8f, 0.8f, 1.0f );
+      material.refractive_index = 1.0f;
+      if ( polymesh.material ) material = *polymesh.material;
+
+      out.OpenElement( "effect" );
+      out.PushAttribute( "id", (ids[i] + "-effect").c_str() );
+      out.OpenElement( "profile_COMMON" );
+      out.OpenElement( "technique" );
+      out.PushAttribute( "sid", "common" );
+      out.OpenElement( "phong" );
+      write_color( out, "emission", material.emit );
+      write_color( out, "ambient" , material.ambi );
+      write_color( out, "diffuse" , material.diff );
+      write_color( out, "specular", material.spec );
+      write_float( out, "shininess", material.shininess );
+      write_float( out, "index_of_refraction", material.refractive_index );
+      out.CloseElement();
+      out.CloseElement();
+      out.CloseElement();
+      out.CloseElement();
+    }
+    out.CloseElement();
+
+    // materials
+    out.OpenElement( "library_materials" );
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      out.OpenElement( "material" );
+      out.PushAttribute( "id", (ids[i] + "-material").c_str() );
+      out.PushAttribute( "name", (ids[i] + "-material").c_str() );
+      out.OpenElement( "instance_effect" );
+      out.PushAttribute( "url", ("#" + ids[i] + "-effect").c_str() );
+      out.CloseElement();
+      out.CloseElement();
+    }
+    out.CloseElement();
+
+    // geometries
+    out.OpenElement( "library_geometries" );
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      const Polymesh& polymesh = static_cast<const Polymesh&>( *nodes[i]->instance );
+      const string& id = ids[i];
+
+      out.OpenElement( "geometry" );
+      out.PushAttribute( "id", id.c_str() );
+      out.PushAttribute( "name", polymesh.name.empty() ? id.c_str() : polymesh.name.c_str() );
+      out.OpenElement( "mesh" );
+
+      vector<float> positions;
+      positions.reserve( 3 * polymesh.vertices.size() );
+      for (size_t j = 0; j < polymesh.vertices.size(); ++j) {
+        positions.push_back( (float) polymesh.vertices[j].x );
+        positions.push_back( (float) polymesh.vertices[j].y );
+        positions.push_back( (float) polymesh.vertices[j].z );
+      }
+      write_source( out, id + "-positions", positions, 3 );
+
+      out.OpenElement( "vertices" );
+      out.PushAttribute( "id", (id + "-vertices").c_str() );
+      out.OpenElement( "input" );
+      out.PushAttribute( "semantic", "POSITION" );
+      out.PushAttribute( "source", ("#" + id + "-positions").c_str() );
+      out.CloseElement();
+      out.CloseElement();
+
+      out.OpenElement( "polylist" );
+      out.PushAttribute( "material", (id + "-material").c_str() );
+      out.PushAttribute( "count", (unsigned) polymesh.polygons.size() );
+
+      out.OpenElement( "input" );
+      out.PushAttribute( "semantic", "VERTEX" );
+      out.PushAttribute( "source", ("#" + id + "-vertices").c_str() );
+      out.PushAttribute( "offset", 0 );
+      out.CloseElement();
+
+      stringstream vcount, p;
+      for (size_t j = 0; j < polymesh.polygons.size(); ++j) {
+        const vector<size_t>& indices = polymesh.polygons[j].vertex_indices;
+        if ( j ) vcount << " ";
+        vcount << indices.size();
+        for (size_t k = 0; k < indices.size(); ++k) {
+          if ( j || k ) p << " ";
+          p << indices[k];
+        }
+      }
+
+      out.OpenElement( "vcount" );
+      out.PushText( vcount.str().c_str() );
+      out.CloseElement();
+      out.OpenElement( "p" );
+      out.PushText( p.str().c_str() );
+      out.CloseElement();
+
+      out.CloseElement(); // polylist
+      out.CloseElement(); // mesh
+      out.CloseElement(); // geometry
+    }
+    out.CloseElement();
+
+    // scene
+    out.OpenElement( "library_visual_scenes" );
+    out.OpenElement( "visual_scene" );
+    out.PushAttribute( "id", "scene" );
+    out.PushAttribute( "name", "scene" );
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      const Node& node = *nodes[i];
+
+      out.OpenElement( "node" );
+      out.PushAttribute( "id", node.id.empty() ? (ids[i] + "-node").c_str() : node.id.c_str() );
+      out.PushAttribute( "name", node.name.empty() ? (ids[i] + "-node").c_str() : node.name.c_str() );
+
+      // collada uses row-majored representation
+      float mat[16];
+      for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+          mat[4 * r + c] = (float) node.transform(r, c);
+        }
+      }
+      out.OpenElement( "matrix" );
+      out.PushAttribute( "sid", "transform" );
+      out.PushText( floats_to_string(mat, 16).c_str() );
+      out.CloseElement();
+
+      out.OpenElement( "instance_geometry" );
+      out.PushAttribute( "url", ("#" + ids[i]).c_str() );
+      out.CloseElement();
+
+      out.CloseElement();
+    }
+    out.CloseElement();
+    out.CloseElement();
+
+    out.OpenElement( "scene" );
+    out.OpenElement( "instance_visual_scene" );
+    out.PushAttribute( "url", "#scene" );
+    out.CloseElement();
+    out.CloseElement();
+
+    out.CloseElement(); // COLLADA
+
+    bool ok = !ferror( file );
+    fclose( file );
+
+    return ok ? 0 : -1;
 
   }
 
@@ -202,14 +595,13 @@ namespace CGL {
     XMLElement* e_mat = xml->FirstChildElement("matrix");
     if ( e_mat ) { // given as matrix
 
-      string s = e_mat->GetText();
-      stringstream ss (s);
+      double m[16] = { 0 };
+      scan_numbers( e_mat->GetText(), m, 16 );
 
       Matrix4x4 mat; // collada uses row-majored representation
-      ss >> mat(0,0); ss >> mat(0,1); ss >> mat(0,2); ss >> mat(0,3);
-      ss >> mat(1,0); ss >> mat(1,1); ss >> mat(1,2); ss >> mat(1,3);
-      ss >> mat(2,0); ss >> mat(2,1); ss >> mat(2,2); ss >> mat(2,3);
-      ss >> mat(3,0); ss >> mat(3,1); ss >> mat(3,2); ss >> mat(3,3);
+      for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) mat(i,j) = m[4 * i + j];
+      }
 
       node.transform = mat;
 
@@ -222,22 +614,22 @@ namespace CGL {
 
         Matrix4x4 r = Matrix4x4::identity();
 
-        string s = e_rotate->GetText();
-        stringstream ss (s);
+        double v[4] = { 0 };
+        scan_numbers( e_rotate->GetText(), v, 4 );
 
         string sid = e_rotate->Attribute("sid");
         switch ( sid.back() ) {
           case 'X':
-          ss >> r(1,1); ss >> r(1,2);
-          ss >> r(2,1); ss >> r(2,2);
+          r(1,1) = v[0]; r(1,2) = v[1];
+          r(2,1) = v[2]; r(2,2) = v[3];
           break;
           case 'Y':
-          ss >> r(0,0); ss >> r(2,0);
-          ss >> r(0,2); ss >> r(2,2);
+          r(0,0) = v[0]; r(2,0) = v[1];
+          r(0,2) = v[2]; r(2,2) = v[3];
           break;
           case 'Z':
-          ss >> r(0,0); ss >> r(0,1);
-          ss >> r(1,0); ss >> r(1,1);
+          r(0,0) = v[0]; r(0,1) = v[1];
+          r(1,0) = v[2]; r(1,1) = v[3];
           break;
           default:
           break;
@@ -253,10 +645,10 @@ namespace CGL {
       XMLElement* e_translate = xml->FirstChildElement("translate");
       if ( e_translate ) {
 
-        string s = e_translate->GetText();
-        stringstream ss (s);
+        double v[3] = { 0 };
+        scan_numbers( e_translate->GetText(), v, 3 );
 
-        ss >> T(0,3); ss >> T(1,3); ss >> T(2,3);
+        T(0,3) = v[0]; T(1,3) = v[1]; T(2,3) = v[2];
 
       }
 
@@ -265,10 +657,12 @@ namespace CGL {
       XMLElement* e_scale = xml->FirstChildElement("scale");
       while ( e_scale ) {
 
-        string s = e_translate->GetText();
-        stringstream ss (s);
+        double v[3] = { 0 };
+        scan_numbers( e_scale->GetText(), v, 3 );
+
+        S(0,0) = v[0]; S(1,1) = v[1]; S(2,2) = v[2];
 
-        ss >> S(0,0); ss >> S(1,1); ss >> S(1,1);
+        e_scale = e_scale->NextSiblingElement("scale");
       }
 
       // skew -
@@ -407,8 +801,7 @@ namespace CGL {
         light.light_type = AMBIENT;
         XMLElement* e_color = e_ambient->FirstChildElement( "color" );
         if ( e_color ) {
-          string color_string = e_color->GetText();
-          light.color = rgb_from_string( color_string );
+          light.color = rgb_from_string( e_color->GetText() );
           light.attenuation = 1;
         }
       }
@@ -422,8 +815,7 @@ namespace CGL {
         // color
         XMLElement* e_color = e_point->FirstChildElement( "color" );
         if ( e_color ) {
-          string color_string = e_color->GetText();
-          light.color = rgb_from_string( color_string );
+          light.color = rgb_from_string( e_color->GetText() );
         }
 
         // attenuation
@@ -442,8 +834,7 @@ namespace CGL {
         // color
         XMLElement* e_color = e_directional->FirstChildElement( "color" );
         if ( e_color ) {
-          string color_string = e_color->GetText();
-          light.color = rgb_from_string( color_string );
+          light.color = rgb_from_string( e_color->GetText() );
         }
 
         // Note (sky):
@@ -487,20 +878,11 @@ namespace CGL {
         XMLElement* e_float_array = e_source->FirstChildElement( "float_array" );
         if ( e_float_array ) {
 
-          float f; vector<float> floats;
-
-          // load float array string
-          string s = e_float_array->GetText();
-          stringstream ss (s);
-
-          // load float array
+          // load float array straight into the source
+          vector<float>& floats = sources[source_id];
           size_t num_floats = e_float_array->IntAttribute( "count" );
-          for (size_t i = 0; i < num_floats; ++i) {
-            ss >> f; floats.push_back(f);
-          }
-
-          // add to sources
-          sources[source_id] = floats;
+          floats.resize(num_floats);
+          floats.resize(scan_array(e_float_array->GetText(), floats.data(), num_floats, loadStats));
         }
 
         // parse next source
@@ -525,7 +907,8 @@ namespace CGL {
           string source = e_input->Attribute( "source" ) + 1;
           if ( sources.find(source) != sources.end() ) {
             vector<float>& floats = sources[source];
-            size_t num_floats = floats.size();
+            size_t num_floats = floats.size() - floats.size() % 3;
+            vertices.reserve(num_floats / 3);
             for (size_t i = 0; i < num_floats; i += 3) {
               Vector3D v = Vector3D(floats[i], floats[i+1], floats[i+2]);
               vertices.push_back(v);
@@ -579,8 +962,7 @@ namespace CGL {
             vertex_offset = offset;
 
             if ( source == vertices_id ) {
-              polymesh.vertices.resize(vertices.size());
-              copy(vertices.begin(), vertices.end(), polymesh.vertices.begin());
+              polymesh.vertices.swap(vertices);
             } else {
               stat("Error: undefined source for VERTEX semantic: " << source);
               exit( -1 );
@@ -596,7 +978,8 @@ namespace CGL {
 
             if ( sources.find(source) != sources.end() ) {
               vector<float>& floats = sources[source];
-              size_t num_floats = floats.size();
+              size_t num_floats = floats.size() - floats.size() % 3;
+              polymesh.normals.reserve(num_floats / 3);
               for (size_t i = 0; i < num_floats; i += 3) {
                 Vector3D n = Vector3D(floats[i], floats[i+1], floats[i+2]);
                 polymesh.normals.push_back(n);
@@ -616,7 +999,8 @@ namespace CGL {
 
             if ( sources.find(source) != sources.end() ) {
               vector<float>& floats = sources[source];
-              size_t num_floats = floats.size();
+              size_t num_floats = floats.size() - floats.size() % 2;
+              polymesh.texcoords.reserve(num_floats / 2);
               for (size_t i = 0; i < num_floats; i += 2) {
                 Vector2D n = Vector2D(floats[i], floats[i+1]);
                 polymesh.texcoords.push_back(n);
@@ -642,14 +1026,11 @@ namespace CGL {
         XMLElement* e_vcount = e_polylist->FirstChildElement( "vcount" );
         if ( e_vcount ) {
 
-          size_t size;
-          string s = e_vcount->GetText();
-          stringstream ss (s);
-
+          sizes.resize(num_polygons);
+          num_polygons = scan_array(e_vcount->GetText(), sizes.data(), num_polygons, loadStats);
+          sizes.resize(num_polygons);
           for (size_t i = 0; i < num_polygons; ++i) {
-            ss >> size;
-            sizes.push_back(size);
-            num_indices += size * stride;
+            num_indices += sizes[i] * stride;
           }
 
         } else {
@@ -662,13 +1043,10 @@ namespace CGL {
         XMLElement* e_p = e_polylist->FirstChildElement( "p" );
         if ( e_p ) {
 
-          size_t index;
-          string s = e_p->GetText();
-          stringstream ss (s);
-
-          for (size_t i = 0; i < num_indices; ++i) {
-            ss >> index;
-            indices.push_back(index);
+          indices.resize(num_indices);
+          if ( scan_array(e_p->GetText(), indices.data(), num_indices, loadStats) < num_indices ) {
+            stat("Error: index array too short in geometry: " << polymesh.id);
+            exit( -1 );
           }
 
         } else {
@@ -678,6 +1056,13 @@ namespace CGL {
 
         // create polygons
         polymesh.polygons.resize(num_polygons);
+        for (size_t i = 0; i < num_polygons; ++i) {
+          polymesh.polygons[i].vertex_indices.reserve(sizes[i]);
+          if (has_normal_array) { // both filled below when there are normals
+            polymesh.polygons[i].normal_indices.reserve(sizes[i]);
+            polymesh.polygons[i].texcoord_indices.reserve(sizes[i]);
+          }
+        }
 
         // vertex array indices
         if (has_vertex_array) {
@@ -778,10 +1163,10 @@ namespace CGL {
           XMLElement* e_shin_val = e_shin ? e_shin->FirstChildElement( "float" ) : NULL;
           XMLElement* e_refi_val = e_refi ? e_refi->FirstChildElement( "float" ) : NULL;
 
-          string emit_str = e_emit_val ? e_emit_val->GetText() : "0 0 0 0";
-          string ambi_str = e_ambi_val ? e_ambi_val->GetText() : "0 0 0 0";
-          string diff_str = e_diff_val ? e_diff_val->GetText() : "0 0 0 0";
-          string spec_str = e_spec_val ? e_spec_val->GetText() : "0 0 0 0";
+          const char* emit_str = e_emit_val ? e_emit_val->GetText() : "0 0 0 0";
+          const char* ambi_str = e_ambi_val ? e_ambi_val->GetText() : "0 0 0 0";
+          const char* diff_str = e_diff_val ? e_diff_val->GetText() : "0 0 0 0";
+          const char* spec_str = e_spec_val ? e_spec_val->GetText() : "0 0 0 0";
 
           material.emit = rgba_from_string( emit_str );
           material.ambi = rgba_from_string( ambi_str );
@@ -18,12 +18,29 @@ using namespace tinyxml2;
 
 namespace CGL {
 
+  // Sizes and timings of the most recent ColladaParser::load(), for
+  // reporting throughput.
+  struct ColladaLoadStats {
+    size_t fileBytes;       // size of the document
+    size_t numberBytes;     // text of the number arrays (<float_array>, <vcount> and <p>)
+    double xmlSeconds;      // reading the document into the DOM
+    double numberSeconds;   // scanning the number arrays
+    double totalSeconds;
+
+    // Throughput of the number scanning, in megabytes per second.
+    double numberMBps() const {
+      return numberSeconds > 0 ? (double) numberBytes / (1024. * 1024.) / numberSeconds : 0;
+    }
+  };
+
   class ColladaParser {
   public:
 
     static int load( const char* filename, Scene* scene );
     static int save( const char* filename, const Scene* scene );
 
+    static const ColladaLoadStats& stats() { return loadStats; }
+
   private:
 
     // XML entry points for COLLADA libraries (set on load) //
@@ -34,6 +51,8 @@ namespace CGL {
     static XMLElement* e_materials;    // COLLADA library: materials
     static XMLElement* e_effects;      // COLLADA library: effects
 
+    static ColladaLoadStats loadStats;
+
     static void parseScene    ( XMLElement* xml, Scene& scene       );
     static void parseNode     ( XMLElement* xml, Node& node         );
     static void parseCamera   ( XMLElement* xml, Camera& camera     );
@@ -0,0 +1,396 @@
+/*
+ * elementArray.h
+ *
+ * Contiguous storage for halfedge mesh elements.
+ */
+
+/**
+ * An ElementArray is a drop-in replacement for the std::list containers that
+ * HalfedgeMesh uses to store its vertices, edges, faces and halfedges.  All
+ * elements of one type live in a single contiguous buffer, and an iterator is
+ * a 32-bit slot index together with a pointer to the array that owns it.
+ * Walking the mesh (h->next(), h->twin(), ...) therefore touches contiguous
+ * memory instead of chasing separately heap-allocated list nodes.
+ *
+ * Inside the elements, references to other elements are stored as bare 32-bit
+ * slot indices, not as iterators.  The array they point into is found through
+ * a pointer to the owning mesh (the "context"), which the array keeps in each
+ * of its elements: following a link costs the load of that pointer, which
+ * does not change as the mesh is edited, so the compiler can keep it in a
+ * register along a traversal.  The non-const accessors of the elements hand
+ * out an ElementLink, which converts to an iterator and can be assigned one.
+ *
+ * Deleting an element marks its slot as dead and pushes it onto a free list;
+ * the next allocation of that type reuses the slot.  Iteration skips dead
+ * slots.  Because an iterator stores an index rather than an address, it
+ * stays valid when the underlying buffer grows, exactly like a list iterator
+ * stays valid when the list grows.  Raw element addresses (elementAddress(),
+ * HalfedgeElement*) do NOT survive growth, so code that must hold on to an
+ * element across allocations should keep the iterator instead.
+ *
+ * Only the subset of the std::list interface used by HalfedgeMesh is
+ * provided.  In particular, insert() ignores its position argument: new
+ * elements are placed in a recycled slot if one is available and appended
+ * otherwise, so the iteration order of freshly allocated elements is only
+ * "after everything else" as long as nothing has been deleted.  The element
+ * type must have a const void* member _context, which the array keeps set to
+ * its own context (see setContext()).
+ */
+
+#ifndef CGL_ELEMENTARRAY_H
+#define CGL_ELEMENTARRAY_H
+
+#include <vector>
+#include <iterator>
+#include <new>
+#include <cstddef>
+#include <stdint.h>
+#include <type_traits>
+
+namespace CGL
+{
+   template<class T> class ElementArray;
+
+   template<class T, bool IsConst>
+   class ElementIterator
+   {
+      public:
+         typedef std::bidirectional_iterator_tag iterator_category;
+         typedef T value_type;
+         typedef std::ptrdiff_t difference_type;
+         typedef typename std::conditional<IsConst, const T*, T*>::type pointer;
+         typedef typename std::conditional<IsConst, const T&, T&>::type reference;
+         typedef typename std::conditional<IsConst, const ElementArray<T>*, ElementArray<T>*>::type owner_pointer;
+
+         static const uint32_t npos = 0xffffffffu; ///< slot index of the end() iterator
+
+         ElementIterator( void ) : _owner( NULL ), _slot( npos ) {}
+         ElementIterator( owner_pointer owner, uint32_t slot ) : _owner( owner ), _slot( slot ) {}
+
+         /**
+          * Allows a const iterator to be built from a non-const one (but not
+          * the other way around), mirroring list<T>::const_iterator.
+          */
+         template<bool C = IsConst>
+         ElementIterator( const ElementIterator<T,false>& i, typename std::enable_if<C>::type* = 0 )
+         : _owner( i._owner ), _slot( i._slot ) {}
+
+         reference operator*( void ) const { return (*_owner)[_slot]; }
+         pointer operator->( void ) const { return &(*_owner)[_slot]; }
+
+         ElementIterator& operator++( void ) { _slot = _owner->nextLive( _slot ); return *this; }
+         ElementIterator& operator--( void ) { _slot = _owner->prevLive( _slot ); return *this; }
+         ElementIterator operator++( int ) { ElementIterator i = *this; ++(*this); return i; }
+         ElementIterator operator--( int ) { ElementIterator i = *this; --(*this); return i; }
+
+         uint32_t index( void ) const { return _slot; } ///< slot of this element in its array
+         const ElementArray<T>* owner( void ) const { return _owner; } ///< array this iterator points into
+
+      protected:
+         template<class, bool> friend class ElementIterator;
+         friend class ElementArray<T>;
+
+         owner_pointer _owner; ///< array holding the element
+         uint32_t _slot;       ///< position of the element in that array
+   };
+
+   template<class T, bool A, bool B>
+   inline bool operator==( const ElementIterator<T,A>& i, const ElementIterator<T,B>& j )
+   {
+      return i.index() == j.index() && i.owner() == j.owner();
+   }
+
+   template<class T, bool A, bool B>
+   inline bool operator!=( const ElementIterator<T,A>& i, const ElementIterator<T,B>& j )
+   {
+      return !( i == j );
+   }
+
+   // Elements of the same array are ordered by slot, which is all that
+   // ordered containers (std::map, std::set) keyed on iterators need.
+   template<class T, bool A, bool B>
+   inline bool operator<( const ElementIterator<T,A>& i, const ElementIterator<T,B>& j )
+   {
+      if( i.owner() != j.owner() ) return i.owner() < j.owner();
+      return i.index() < j.index();
+   }
+
+   /**
+    * An ElementLink is what the non-const accessors of a mesh element return
+    * in place of a reference to an iterator: it refers to the slot index
+    * stored in the element, reads like an iterator, and assigning it an
+    * iterator rewrites the index.  A link that may point into either of two
+    * arrays (the face of a halfedge, which is an interior face or a boundary
+    * loop) marks the second one with the top bit of the index.
+    */
+   template<class T>
+   class ElementLink
+   {
+      public:
+         typedef ElementIterator<T,false> iterator;
+
+         static const uint32_t alternate = 0x80000000u; ///< set in indices into the second array
+
+         ElementLink( uint32_t& slot, ElementArray<T>* owner, ElementArray<T>* other = NULL )
+         : _slot( &slot ), _owner( owner ), _other( other ) {}
+
+         iterator get( void ) const { return decode( *_slot, _owner, _other ); }
+         operator iterator( void ) const { return get(); }
+         operator ElementIterator<T,true>( void ) const { return get(); }
+
+         T* operator->( void ) const { return get().operator->(); }
+         T& operator*( void ) const { return *get(); }
+
+         ElementLink& operator=( const iterator& i ) { *_slot = encode( i, _other ); return *this; }
+         ElementLink& operator=( const ElementLink& l ) { return *this = l.get(); }
+
+         /**
+          * Converts between iterators and the slot indices stored in the
+          * elements (for const access, and for copying elements in bulk).
+          */
+         static uint32_t encode( const ElementIterator<T,true>& i, const ElementArray<T>* other )
+         {
+            if( i.index() == iterator::npos || i.owner() != other ) return i.index();
+            return i.index() | alternate;
+         }
+
+         template<class Array>
+         static ElementIterator<T,std::is_const<Array>::value> decode( uint32_t slot, Array* owner, Array* other )
+         {
+            if( other && slot != iterator::npos && ( slot & alternate ) )
+            {
+               return ElementIterator<T,std::is_const<Array>::value>( other, slot & ~alternate );
+            }
+            return ElementIterator<T,std::is_const<Array>::value>( owner, slot );
+         }
+
+      private:
+         uint32_t* _slot;          ///< index stored in the element
+         ElementArray<T>* _owner;  ///< array the index points into
+         ElementArray<T>* _other;  ///< array indices with the alternate bit point into, if any
+   };
+
+   template<class T, bool A>
+   inline bool operator==( const ElementLink<T>& l, const ElementIterator<T,A>& i ) { return l.get() == i; }
+   template<class T, bool A>
+   inline bool operator==( const ElementIterator<T,A>& i, const ElementLink<T>& l ) { return i == l.get(); }
+   template<class T>
+   inline bool operator==( const ElementLink<T>& l, const ElementLink<T>& m ) { return l.get() == m.get(); }
+   template<class T, bool A>
+   inline bool operator!=( const ElementLink<T>& l, const ElementIterator<T,A>& i ) { return l.get() != i; }
+   template<class T, bool A>
+   inline bool operator!=( const ElementIterator<T,A>& i, const ElementLink<T>& l ) { return i != l.get(); }
+   template<class T>
+   inline bool operator!=( const ElementLink<T>& l, const ElementLink<T>& m ) { return l.get() != m.get(); }
+
+   template<class T>
+   class ElementArray
+   {
+      public:
+         typedef T value_type;
+         typedef ElementIterator<T,false> iterator;
+         typedef ElementIterator<T,true> const_iterator;
+
+         ElementArray( void ) : _slots( NULL ), _size( 0 ), _capacity( 0 ), _nLive( 0 ), _context( NULL ) {}
+
+         // Copies hold the same elements in the same slots, so the indices
+         // stored in them stay meaningful; the context is not copied, the
+         // elements take that of the array they are copied into.
+         ElementArray( const ElementArray& a ) : _slots( NULL ), _size( 0 ), _capacity( 0 ), _nLive( 0 ), _context( NULL ) { *this = a; }
+
+         ElementArray& operator=( const ElementArray& a )
+         {
+            if( this == &a ) return *this;
+            clear();
+            reserve( a._size );
+            for( size_t s = 0; s < a._size; s++ )
+            {
+               new( &_slots[s] ) T( a._slots[s] );
+               _slots[s]._context = _context;
+            }
+            _size = a._size;
+            _live = a._live;
+            _free = a._free;
+            _nLive = a._nLive;
+            return *this;
+         }
+
+         ~ElementArray( void )
+         {
+            clear();
+            ::operator delete( _slots );
+         }
+
+         /**
+          * Sets the pointer stored in each element of the array (including
+          * the ones inserted later), through which the elements find the
+          * arrays their indices point into.
+          */
+         void setContext( const void* context )
+         {
+            _context = context;
+            for( size_t s = 0; s < _size; s++ ) _slots[s]._context = context;
+         }
+
+         iterator       begin( void )       { return       iterator( this, firstLive() ); }
+         const_iterator begin( void ) const { return const_iterator( this, firstLive() ); }
+         iterator       end  ( void )       { return       iterator( this, iterator::npos ); }
+         const_iterator end  ( void ) const { return const_iterator( this, iterator::npos ); }
+
+         T&       operator[]( uint32_t s )       { return _slots[s]; }
+         const T& operator[]( uint32_t s ) const { return _slots[s]; }
+
+         size_t size( void ) const { return _nLive; }
+         bool empty( void ) const { return _nLive == 0; }
+
+         /**
+          * Number of slots (live or dead); an upper bound on index()+1.
+          */
+         size_t slots( void ) const { return _size; }
+
+         void reserve( size_t n )
+         {
+            if( n > _capacity ) grow( n );
+            _live.reserve( n );
+         }
+
+         /**
+          * Destroys all elements, but keeps the storage (and the context).
+          */
+         void clear( void )
+         {
+            for( size_t s = 0; s < _size; s++ ) _slots[s].~T();
+            _size = 0;
+            _live.clear();
+            _free.clear();
+            _nLive = 0;
+         }
+
+         /**
+          * Stores a copy of value in a free slot (or a new one at the back)
+          * and returns an iterator to it.  The position is ignored.
+          */
+         iterator insert( const_iterator /*position*/, const T& value )
+         {
+            uint32_t s;
+            if( !_free.empty() )
+            {
+               s = _free.back();
+               _free.pop_back();
+               _slots[s] = value;
+               _live[s] = 1;
+            }
+            else
+            {
+               if( _size == _capacity ) grow( _capacity < 16 ? 16 : 2 * _capacity );
+               s = (uint32_t) _size;
+               new( &_slots[s] ) T( value );
+               _size++;
+               _live.push_back( 1 );
+            }
+            _slots[s]._context = _context;
+            _nLive++;
+            return iterator( this, s );
+         }
+
+         /**
+          * Releases the slot of the given element; returns an iterator to the
+          * next live element.
+          */
+         iterator erase( iterator i )
+         {
+            iterator next = i; ++next;
+            uint32_t s = i._slot;
+            _slots[s] = T();
+            _live[s] = 0;
+            _free.push_back( s );
+            _nLive--;
+            return next;
+         }
+
+         /**
+          * Takes an element out of the array without freeing its slot: it is
+          * skipped by iteration, but iterators to it stay valid until it is
+          * either put back with attach() or released with discard().
+          */
+         void detach( iterator i )
+         {
+            _live[i._slot] = 0;
+            _nLive--;
+         }
+
+         void attach( iterator i )
+         {
+            _live[i._slot] = 1;
+            _nLive++;
+         }
+
+         void discard( iterator i )
+         {
+            _slots[i._slot] = T();
+            _free.push_back( i._slot );
+         }
+
+         void resize( size_t n )
+         {
+            while( _nLive < n ) insert( end(), T() );
+            while( _nLive > n ) erase( --end() );
+         }
+
+      protected:
+         template<class, bool> friend class ElementIterator;
+
+         // Moves the elements into a new buffer with room for n of them.
+         // Their slots do not change, so the indices stored in them stay valid.
+         void grow( size_t n )
+         {
+            T* slots = static_cast<T*>( ::operator new( n * sizeof( T ) ) );
+            for( size_t s = 0; s < _size; s++ )
+            {
+               new( &slots[s] ) T( _slots[s] );
+               _slots[s].~T();
+            }
+            ::operator delete( _slots );
+            _slots = slots;
+            _capacity = n;
+         }
+
+         uint32_t firstLive( void ) const
+         {
+            return nextLive( iterator::npos );
+         }
+
+         // npos + 1 wraps to 0, so nextLive( npos ) scans from the start.
+         uint32_t nextLive( uint32_t s ) const
+         {
+            uint32_t n = (uint32_t) _size;
+            for( s++; s < n; s++ )
+            {
+               if( _live[s] ) return s;
+            }
+            return iterator::npos;
+         }
+
+         uint32_t prevLive( uint32_t s ) const
+         {
+            if( s == iterator::npos ) s = (uint32_t) _size;
+            while( s > 0 )
+            {
+               s--;
+               if( _live[s] ) return s;
+            }
+            return iterator::npos;
+         }
+
+         T* _slots;                           ///< element storage, including dead slots
+         size_t _size;                        ///< number of slots in use
+         size_t _capacity;                    ///< number of slots allocated
+         std::vector<unsigned char> _live;    ///< 1 if the corresponding slot holds a live element
+         std::vector<uint32_t> _free;         ///< dead slots available for reuse
+         size_t _nLive;                       ///< number of live elements
+         const void* _context;                ///< stored in each element, see setContext()
+   };
+
+} // namespace CGL
+
+#endif // CGL_ELEMENTARRAY_H
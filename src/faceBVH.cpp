@@ -0,0 +1,482 @@
+#include "faceBVH.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace CGL {
+
+  // Leaves hold at most this many faces.
+  static const Size maxLeafFaces = 4;
+
+  // Faces added by splits may deepen the hierarchy by this many levels, or
+  // double its number of nodes, before it is rebuilt.
+  static const Size maxAddedDepth = 8;
+
+  // Number of bins along the split axis when choosing a split.
+  static const int nBins = 16;
+
+  static const Index none = (Index) -1;
+
+  static inline void growBox(Vector3D& low, Vector3D& high, const Vector3D& p) {
+    for (int k = 0; k < 3; k++) {
+      low[k] = min(low[k], p[k]);
+      high[k] = max(high[k], p[k]);
+    }
+  }
+
+  static inline void emptyBox(Vector3D& low, Vector3D& high) {
+    double inf = numeric_limits<double>::infinity();
+    low = Vector3D(inf, inf, inf);
+    high = Vector3D(-inf, -inf, -inf);
+  }
+
+  static inline double halfArea(const Vector3D& low, const Vector3D& high) {
+    Vector3D e = high - low;
+    if (e.x < 0) return 0;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+  }
+
+  // Returns the parameter at which the ray enters the box, if it does so
+  // before tMax.
+  static inline bool hitBox(const Vector3D& low, const Vector3D& high,
+                            const Vector3D& o, const Vector3D& invD,
+                            double tMax, double& tEntry) {
+    double t0 = 0, t1 = tMax;
+    for (int k = 0; k < 3; k++) {
+      double a = (low[k] - o[k]) * invD[k];
+      double b = (high[k] - o[k]) * invD[k];
+      if (a > b) swap(a, b);
+      t0 = max(t0, a);
+      t1 = min(t1, b);
+      if (t0 > t1) return false;
+    }
+    tEntry = t0;
+    return true;
+  }
+
+  // Intersects the ray with the triangle formed by the first three vertices
+  // of the face (from either side).
+  static inline bool hitFace(FaceCIter f, const Vector3D& o, const Vector3D& d, double& t) {
+    HalfedgeCIter h = f->halfedge();
+    const Vector3D& a = h->vertex()->position;
+    const Vector3D& b = h->next()->vertex()->position;
+    const Vector3D& c = h->next()->next()->vertex()->position;
+
+    Vector3D e1 = b - a, e2 = c - a;
+    Vector3D p = cross(d, e2);
+    double det = dot(e1, p);
+    if (det == 0) return false;
+
+    double invDet = 1. / det;
+    Vector3D s = o - a;
+    double u = dot(s, p) * invDet;
+    if (u < 0 || u > 1) return false;
+    Vector3D q = cross(s, e1);
+    double v = dot(d, q) * invDet;
+    if (v < 0 || u + v > 1) return false;
+
+    t = dot(e2, q) * invDet;
+    return t >= 0;
+  }
+
+  FaceBVH::FaceBVH() : valid(false), nFaces(0), maxDepth(0), maxNodes(0) {}
+
+  FaceBVH::FaceBVH(const FaceBVH& bvh) : valid(false), nFaces(0), maxDepth(0), maxNodes(0) {}
+
+  FaceBVH& FaceBVH::operator=(const FaceBVH& bvh) {
+    if (this != &bvh) invalidate();
+    return *this;
+  }
+
+  void FaceBVH::invalidate() {
+    valid = false;
+    nodes.clear();
+    order.clear();
+    faceLeaf.clear();
+    idFace.clear();
+    dirtyFaces.clear();
+  }
+
+  void FaceBVH::updateVertex(const Vertex* v) {
+    if (!valid) return;
+
+    HalfedgeCIter h = v->halfedge();
+    do {
+      if (!h->face()->isBoundary()) dirtyFaces.push_back(h->face());
+      h = h->twin()->next();
+    } while (h != v->halfedge());
+  }
+
+  void FaceBVH::rebuild(HalfedgeMesh& mesh) {
+    mesh.enumerate();
+    nFaces = mesh.nFaces();
+    nodes.clear();
+    dirtyFaces.clear();
+    valid = true;
+
+    vector<FaceIter> faces;
+    faces.reserve(nFaces);
+    for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) faces.push_back(f);
+
+    // Bound every face, and find its centroid.
+    vector<Vector3D> low(nFaces), high(nFaces), centroid(nFaces);
+    #pragma omp parallel for
+    for (long i = 0; i < (long) nFaces; i++) {
+      emptyBox(low[i], high[i]);
+      HalfedgeCIter h = faces[i]->halfedge();
+      do {
+        growBox(low[i], high[i], h->vertex()->position);
+        h = h->next();
+      } while (h != faces[i]->halfedge());
+      centroid[i] = (low[i] + high[i]) / 2;
+    }
+
+    vector<Index> perm(nFaces);
+    for (Index i = 0; i < nFaces; i++) perm[i] = i;
+
+    if (nFaces == 0) {
+      order.clear();
+      faceLeaf.clear();
+      idFace.clear();
+      return;
+    }
+
+    Node root;
+    root.parent = none;
+    root.first = 0;
+    root.count = nFaces;
+    nodes.push_back(root);
+
+    // Split nodes top down, choosing each split with the surface area
+    // heuristic over bins of centroids along the longest axis.
+    vector<pair<Index, Size> > stack(1, make_pair((Index) 0, (Size) 0));
+    Size depth = 0;
+    while (!stack.empty()) {
+      Index n = stack.back().first;
+      Size d = stack.back().second;
+      stack.pop_back();
+      depth = max(depth, d);
+      Index begin = nodes[n].first, end = begin + nodes[n].count;
+
+      Vector3D cLow, cHigh;
+      emptyBox(nodes[n].low, nodes[n].high);
+      emptyBox(cLow, cHigh);
+      for (Index i = begin; i < end; i++) {
+        growBox(nodes[n].low, nodes[n].high, low[perm[i]]);
+        growBox(nodes[n].low, nodes[n].high, high[perm[i]]);
+        growBox(cLow, cHigh, centroid[perm[i]]);
+      }
+      if (end - begin <= maxLeafFaces) continue;
+
+      Vector3D extent = cHigh - cLow;
+      int axis = 0;
+      if (extent.y > extent[axis]) axis = 1;
+      if (extent.z > extent[axis]) axis = 2;
+
+      Index mid = begin;
+      if (extent[axis] > 0) {
+        Size binCount[nBins] = { 0 };
+        Vector3D binLow[nBins], binHigh[nBins];
+        for (int b = 0; b < nBins; b++) emptyBox(binLow[b], binHigh[b]);
+
+        double scale = nBins / extent[axis];
+        for (Index i = begin; i < end; i++) {
+          Index f = perm[i];
+          int b = min((int) ((centroid[f][axis] - cLow[axis]) * scale), nBins - 1);
+          binCount[b]++;
+          growBox(binLow[b], binHigh[b], low[f]);
+          growBox(binLow[b], binHigh[b], high[f]);
+        }
+
+        // Cost of splitting after each bin: sweep from the right, then
+        // from the left.
+        double rightCost[nBins];
+        Vector3D l, h;
+        emptyBox(l, h);
+        Size count = 0;
+        for (int b = nBins - 1; b > 0; b--) {
+          growBox(l, h, binLow[b]);
+          growBox(l, h, binHigh[b]);
+          count += binCount[b];
+          rightCost[b - 1] = (double) count * halfArea(l, h);
+        }
+
+        double bestCost = numeric_limits<double>::infinity();
+        int bestBin = -1;
+        emptyBox(l, h);
+        count = 0;
+        for (int b = 0; b + 1 < nBins; b++) {
+          growBox(l, h, binLow[b]);
+          growBox(l, h, binHigh[b]);
+          count += binCount[b];
+          double cost = (double) count * halfArea(l, h) + rightCost[b];
+          if (count > 0 && count < end - begin && cost < bestCost) {
+            bestCost = cost;
+            bestBin = b;
+          }
+        }
+
+        if (bestBin >= 0) {
+          mid = partition(perm.begin() + begin, perm.begin() + end, [&](Index f) {
+            return min((int) ((centroid[f][axis] - cLow[axis]) * scale), nBins - 1) <= bestBin;
+          }) - perm.begin();
+        }
+      }
+
+      // Fall back on a median split when the centroids can't be separated.
+      if (mid == begin || mid == end) {
+        mid = (begin + end) / 2;
+        nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end, [&](Index a, Index b) {
+          return centroid[a][axis] < centroid[b][axis];
+        });
+      }
+
+      Node left, right;
+      left.parent = right.parent = n;
+      left.first = begin;
+      left.count = mid - begin;
+      right.first = mid;
+      right.count = end - mid;
+
+      Index c = nodes.size();
+      nodes[n].first = c;
+      nodes[n].count = 0;
+      nodes.push_back(left);
+      nodes.push_back(right);
+      stack.push_back(make_pair(c, d + 1));
+      stack.push_back(make_pair(c + 1, d + 1));
+    }
+
+    order.resize(nFaces);
+    for (Index i = 0; i < nFaces; i++) order[i] = faces[perm[i]];
+    mapFaces();
+    maxDepth = depth + maxAddedDepth;
+    maxNodes = 2 * nodes.size();
+  }
+
+  Index FaceBVH::findLeaf(FaceCIter f) const {
+    Index id = f->id();
+    if (id >= faceLeaf.size() || faceLeaf[id] == none || idFace[id] != f) return none;
+    return faceLeaf[id];
+  }
+
+  void FaceBVH::setLeaf(FaceIter f, Index leaf) {
+    Index id = f->id();
+    if (id >= faceLeaf.size()) {
+      faceLeaf.resize(id + 1, none);
+      idFace.resize(id + 1);
+    }
+    faceLeaf[id] = leaf;
+    idFace[id] = f;
+  }
+
+  void FaceBVH::mapFaces() {
+    faceLeaf.clear();
+    idFace.clear();
+    for (Index n = 0; n < nodes.size(); n++) {
+      for (Index i = nodes[n].first; i < nodes[n].first + nodes[n].count; i++) setLeaf(order[i], n);
+    }
+  }
+
+  bool FaceBVH::addNewFaces(HalfedgeMesh& mesh) {
+
+    // The faces created by splits are around the vertices passed to
+    // updateVertex(), so they are the dirty faces that are not in the
+    // hierarchy yet.  If there seem to be more of those than new faces, the
+    // mesh has been renumbered since the leaves were last found.
+    Size nAdded = mesh.nFaces() - nFaces;
+    vector<FaceCIter> added;
+    for (int pass = 0; ; pass++) {
+      added.clear();
+      for (Index i = 0; i < dirtyFaces.size(); i++) {
+        if (findLeaf(dirtyFaces[i]) == none) added.push_back(dirtyFaces[i]);
+      }
+      sort(added.begin(), added.end(), [](FaceCIter a, FaceCIter b) {
+        return elementAddress(a) < elementAddress(b);
+      });
+      added.erase(unique(added.begin(), added.end()), added.end());
+      if (added.size() == nAdded) break;
+      if (pass > 0) return false;
+      mapFaces();
+    }
+
+    for (Index i = 0; i < added.size(); i++) {
+      FaceCIter f = added[i];
+
+      // Find a neighbor already in the hierarchy, and through it, the
+      // new face itself.
+      Index leaf = none;
+      FaceIter face;
+      HalfedgeCIter h = f->halfedge();
+      do {
+        FaceCIter g = h->twin()->face();
+        if (!g->isBoundary() && (leaf = findLeaf(g)) != none) {
+          HalfedgeIter k = idFace[g->id()]->halfedge();
+          while (elementAddress(k) != elementAddress(h->twin())) k = k->next();
+          face = k->twin()->face();
+          break;
+        }
+        h = h->next();
+      } while (h != f->halfedge());
+      if (leaf == none) return false;
+
+      // Keep the id the face has unless another face in the hierarchy
+      // has it too, in which case the face was created after the mesh was
+      // last enumerated.  (Make sure that face still has that id first.)
+      Index id = face->id();
+      if (id < faceLeaf.size() && faceLeaf[id] != none && idFace[id]->id() != id) mapFaces();
+      if (id < faceLeaf.size() && faceLeaf[id] != none) mesh.enumerate(face, faceLeaf.size());
+
+      if (!addFace(face, leaf)) return false;
+    }
+
+    nFaces = mesh.nFaces();
+    return nodes.size() <= maxNodes;
+  }
+
+  bool FaceBVH::addFace(FaceIter f, Index leaf) {
+
+    // Append the face to the leaf if it has room, first moving the faces of
+    // the leaf to the end of the order unless they are there already.
+    if (nodes[leaf].count < maxLeafFaces) {
+      Node& node = nodes[leaf];
+      if (node.first + node.count != order.size()) {
+        Index first = order.size();
+        for (Index i = node.first; i < node.first + node.count; i++) order.push_back(order[i]);
+        node.first = first;
+      }
+      order.push_back(f);
+      node.count++;
+      setLeaf(f, leaf);
+      return true;
+    }
+
+    // Otherwise, the face goes into a leaf of its own, next to the full
+    // leaf, which becomes the parent of both.
+    Node left = nodes[leaf], right;
+    left.parent = right.parent = leaf;
+    right.first = order.size();
+    right.count = 1;
+    order.push_back(f);
+
+    Index c = nodes.size();
+    nodes[leaf].first = c;
+    nodes[leaf].count = 0;
+    nodes.push_back(left);
+    nodes.push_back(right);
+
+    for (Index i = left.first; i < left.first + left.count; i++) setLeaf(order[i], c);
+    setLeaf(f, c + 1);
+
+    Size depth = 0;
+    for (Index n = c + 1; nodes[n].parent != none; n = nodes[n].parent) depth++;
+    return depth <= maxDepth;
+  }
+
+  void FaceBVH::refitLeaf(Index n) {
+    Node& node = nodes[n];
+    emptyBox(node.low, node.high);
+    for (Index i = node.first; i < node.first + node.count; i++) {
+      HalfedgeCIter h = order[i]->halfedge();
+      do {
+        growBox(node.low, node.high, h->vertex()->position);
+        h = h->next();
+      } while (h != order[i]->halfedge());
+    }
+  }
+
+  void FaceBVH::refitAncestors(Index n) {
+    while (nodes[n].parent != none) {
+      n = nodes[n].parent;
+      const Node& left = nodes[nodes[n].first];
+      const Node& right = nodes[nodes[n].first + 1];
+      Vector3D low = left.low, high = left.high;
+      growBox(low, high, right.low);
+      growBox(low, high, right.high);
+      nodes[n].low = low;
+      nodes[n].high = high;
+    }
+  }
+
+  void FaceBVH::sync(HalfedgeMesh& mesh) {
+    if (valid && mesh.nFaces() > nFaces && !addNewFaces(mesh)) valid = false;
+    if (!valid || mesh.nFaces() != nFaces) {
+      rebuild(mesh);
+      return;
+    }
+    if (dirtyFaces.empty()) return;
+
+    // If a face isn't found, the mesh has been renumbered since the leaves
+    // were last found; look for them again.
+    vector<Index> leaves;
+    for (Index i = 0; i < dirtyFaces.size(); i++) {
+      Index leaf = findLeaf(dirtyFaces[i]);
+      if (leaf == none) {
+        mapFaces();
+        leaf = findLeaf(dirtyFaces[i]);
+        if (leaf == none) {
+          rebuild(mesh);
+          return;
+        }
+      }
+      leaves.push_back(leaf);
+    }
+    dirtyFaces.clear();
+    sort(leaves.begin(), leaves.end());
+    leaves.erase(unique(leaves.begin(), leaves.end()), leaves.end());
+
+    for (Index i = 0; i < leaves.size(); i++) refitLeaf(leaves[i]);
+    for (Index i = 0; i < leaves.size(); i++) refitAncestors(leaves[i]);
+  }
+
+  bool FaceBVH::intersect(HalfedgeMesh& mesh, const Vector3D& o, const Vector3D& d,
+                          double tMax, FaceIter& face, double& t) {
+    sync(mesh);
+    if (nodes.empty()) return false;
+
+    Vector3D invD(1. / d.x, 1. / d.y, 1. / d.z);
+    double tEntry;
+    if (!hitBox(nodes[0].low, nodes[0].high, o, invD, tMax, tEntry)) return false;
+
+    // Visit the nearer child first, and skip nodes that start beyond the
+    // nearest hit so far.
+    bool found = false;
+    stack.clear();
+    stack.push_back(make_pair(tEntry, (Index) 0));
+    while (!stack.empty()) {
+      Index n = stack.back().second;
+      if (stack.back().first > tMax) { stack.pop_back(); continue; }
+      stack.pop_back();
+
+      const Node& node = nodes[n];
+      if (node.count) {
+        for (Index i = node.first; i < node.first + node.count; i++) {
+          double tHit;
+          if (hitFace(order[i], o, d, tHit) && tHit < tMax) {
+            tMax = tHit;
+            face = order[i];
+            found = true;
+          }
+        }
+        continue;
+      }
+
+      double t0, t1;
+      bool hit0 = hitBox(nodes[node.first].low, nodes[node.first].high, o, invD, tMax, t0);
+      bool hit1 = hitBox(nodes[node.first + 1].low, nodes[node.first + 1].high, o, invD, tMax, t1);
+      if (hit0 && hit1 && t1 < t0) {
+        stack.push_back(make_pair(t0, node.first));
+        stack.push_back(make_pair(t1, node.first + 1));
+      } else {
+        if (hit1) stack.push_back(make_pair(t1, node.first + 1));
+        if (hit0) stack.push_back(make_pair(t0, node.first));
+      }
+    }
+
+    if (found) t = tMax;
+    return found;
+  }
+
+}
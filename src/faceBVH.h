@@ -0,0 +1,92 @@
+#ifndef CGL_FACEBVH_H
+#define CGL_FACEBVH_H
+
+#include "halfEdgeMesh.h"
+
+namespace CGL {
+
+  /**
+   * A FaceBVH is a bounding volume hierarchy over the faces of a
+   * HalfedgeMesh, used to find the face under the mouse cursor with a ray
+   * query instead of by testing every face.
+   *
+   * Like MeshBuffer, it is brought up to date lazily, the next time it is
+   * queried.  After moving a vertex, or after a flip or split around a
+   * vertex, call updateVertex(): the boxes of the faces around it are
+   * refitted, and any faces the split created are added to the leaves of
+   * their neighbors (or to new leaves next to them, once those are full).
+   * When such additions have made the hierarchy too deep or too large, it is
+   * rebuilt.  After any other change to the connectivity (or replacing the
+   * mesh), call invalidate() to rebuild the hierarchy from scratch.
+   *
+   * Faces are looked up by id(), which rebuilding assigns with
+   * HalfedgeMesh::enumerate().  Faces created later are given the next free
+   * ids, without renumbering the rest of the mesh.
+   *
+   * As elsewhere in the picking code, only the first three vertices of each
+   * face are tested for intersection, although the boxes bound whole faces.
+   */
+  class FaceBVH {
+  public:
+
+    FaceBVH();
+
+    // Copies hold iterators into a different mesh, so they start out empty
+    // and are rebuilt the first time they are queried.
+    FaceBVH(const FaceBVH& bvh);
+    FaceBVH& operator=(const FaceBVH& bvh);
+
+    /**
+     * Forces a complete rebuild, e.g., after the connectivity has changed.
+     */
+    void invalidate();
+
+    /**
+     * Records that the given vertex has moved, or that the faces around it
+     * have just been created or changed by a flip or split.
+     */
+    void updateVertex(const Vertex* v);
+
+    /**
+     * Finds the nearest face hit by the ray o + t * d, for t >= 0, closer
+     * than t = tMax.  Returns false if there is none; otherwise, stores the
+     * face and the ray parameter of the hit.
+     */
+    bool intersect(HalfedgeMesh& mesh, const Vector3D& o, const Vector3D& d,
+                   double tMax, FaceIter& face, double& t);
+
+  private:
+
+    struct Node {
+      Vector3D low, high;  ///< bounding box
+      Index parent;        ///< parent node (none for the root)
+      Index first;         ///< first face in order (leaf) or first child (interior)
+      Size count;          ///< number of faces (leaf), or 0 (interior)
+    };
+
+    void sync(HalfedgeMesh& mesh);
+    void rebuild(HalfedgeMesh& mesh);
+    bool addNewFaces(HalfedgeMesh& mesh);
+    bool addFace(FaceIter f, Index leaf);
+    Index findLeaf(FaceCIter f) const;
+    void setLeaf(FaceIter f, Index leaf);
+    void mapFaces();
+    void refitLeaf(Index n);
+    void refitAncestors(Index n);
+
+    std::vector<Node> nodes;           ///< root first; the two children of a node are adjacent
+    std::vector<FaceIter> order;       ///< faces in leaf order
+    std::vector<Index> faceLeaf;       ///< leaf of each face (by id), or none
+    std::vector<FaceIter> idFace;      ///< face with each id, as of the last call to setLeaf()
+    std::vector<FaceCIter> dirtyFaces; ///< faces to refit
+    std::vector<std::pair<double, Index> > stack; ///< nodes left to visit by intersect(), kept so that rays don't allocate
+
+    bool valid;    ///< whether the hierarchy matches the connectivity of the mesh
+    Size nFaces;   ///< number of faces in the hierarchy
+    Size maxDepth; ///< depth of leaf past which the hierarchy is rebuilt
+    Size maxNodes; ///< number of nodes past which the hierarchy is rebuilt
+  };
+
+}
+
+#endif // CGL_FACEBVH_H
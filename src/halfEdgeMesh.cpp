@@ -1,7 +1,61 @@
 #include "halfEdgeMesh.h"
 
+#include <algorithm>
+
+#include "CGL/timer.h"
+
 namespace CGL {
 
+#ifndef HALFEDGE_INDEXED_STORAGE
+  // Maps the elements of one or more lists to their positions in iteration
+  // order, so that a pointer to an element can be turned into its position
+  // without writing anything to the element.  This is a hash table with
+  // linear probing, sized for the given number of elements up front; it
+  // is read-only once filled, so any number of threads may look things up.
+  template<class T>
+  class PositionTable
+  {
+    public:
+      PositionTable( Size n ) : size( 0 )
+      {
+        Size capacity = 16;
+        while( capacity < 2*n ) capacity *= 2;
+        entries.resize( capacity, make_pair( (const T*) NULL, (Index) 0 ) );
+        mask = capacity - 1;
+      }
+
+      template<class Iter>
+      void add( Iter begin, Iter end )
+      {
+        for( Iter i = begin; i != end; i++ )
+        {
+          const T* element = &*i;
+          Index k = slot( element );
+          while( entries[k].first != NULL ) k = ( k + 1 ) & mask;
+          entries[k] = make_pair( element, size++ );
+        }
+      }
+
+      Index operator()( const T* element ) const
+      {
+        Index k = slot( element );
+        while( entries[k].first != element ) k = ( k + 1 ) & mask;
+        return entries[k].second;
+      }
+
+    protected:
+      // Elements are at least 8-byte aligned, so the low bits carry nothing.
+      Index slot( const T* element ) const
+      {
+        return (Index) ( ( (uint64_t) (uintptr_t) element >> 3 ) * 0x9E3779B97F4A7C15ull >> 32 ) & mask;
+      }
+
+      vector< pair<const T*, Index> > entries;
+      Index mask;
+      Index size; ///< position of the next element added
+  };
+#endif
+
   bool Halfedge::isBoundary( void ) const
   // returns true if and only if this halfedge is on the boundary
   {
@@ -13,7 +67,7 @@ namespace CGL {
     return halfedge()->isBoundary() || halfedge()->twin()->isBoundary();
   }
 
-  Vector3D Face::normal( void ) const
+  Vector3D Face::computeNormal( void ) const
   {
     Vector3D N( 0., 0., 0. );
 
@@ -40,48 +94,36 @@ namespace CGL {
     // is determined by the order of vertices in the list.  Polygons must have at least
     // three vertices.  Note that there are no special conditions on the vertex indices,
     // i.e., they do not have to start at 0 or 1, nor does the collection of indices have
-    // to be contiguous.  Overall, this initializer is designed to be robust but perhaps
-    // not incredibly fast (though of course this does not affect the performance of the
-    // resulting data structure).  One could also implement faster initializers that
-    // handle important special cases (e.g., all triangles, or data that is known to be
-    // manifold).
+    // to be contiguous.
     //
     // Since there are no strong conditions on the indices of polygons, we assume that
     // the list of vertex positions is given in lexicographic order (i.e., that the
     // lowest index appearing in any polygon corresponds to the first entry of the list
     // of positions and so on).
+    //
+    // Large scans can have millions of polygons, so rather than looking up vertices and
+    // halfedges in ordered maps (one heap node and O(log n) pointer chasing per entry),
+    // we first renumber the input vertices densely, then pair up twin halfedges with a
+    // single sort over flat arrays, and size all element storage before allocating.
+    // The resulting mesh is element-for-element identical to what the map-based
+    // construction used to produce.
     {
       // define some types, to improve readability
       typedef vector<Index> IndexList;
       typedef IndexList::const_iterator IndexListCIter;
       typedef vector<IndexList> PolygonList;
       typedef PolygonList::const_iterator PolygonListCIter;
-      typedef pair<Index,Index> IndexPair; // ordered pair of vertex indices, corresponding to an edge of an oriented polygon
 
-      // Clear any existing elements.
-      halfedges.clear();
-      vertices.clear();
-      edges.clear();
-      faces.clear();
-      boundaries.clear();
+      // marks "no such element" in the index arrays below
+      const Index none = (Index) -1;
+
+      Timer timer;
+      timer.start();
 
-      // Since the vertices in our halfedge mesh are stored in a linked list,
-      // we will temporarily need to keep track of the correspondence between
-      // indices of vertices in our input and pointers to vertices in the new
-      // mesh (which otherwise can't be accessed by index).  Note that since
-      // we're using a general-purpose map (rather than, say, a vector), we can
-      // be a bit more flexible about the indexing scheme: input vertex indices
-      // aren't required to be 0-based or 1-based; in fact, the set of indices
-      // doesn't even have to be contiguous.  Taking advantage of this fact makes
-      // our conversion a bit more robust to different types of input, including
-      // data that comes from a subset of a full mesh.
-      map<Index,VertexIter> indexToVertex; // maps a vertex index to the corresponding vertex
-
-      // Also store the vertex degree, i.e., the number of polygons that use each
-      // vertex; this information will be used to check that the mesh is manifold.
-      map<VertexIter,Size> vertexDegree;
-
-      // First, we do some basic sanity checks on the input.
+      // First, we do some basic sanity checks on the input, and count
+      // the total number of (interior) halfedges we are going to need.
+      Size nInteriorHalfedges = 0;
+      Index maxIndex = 0;
       for( PolygonListCIter p = polygons.begin(); p != polygons.end(); p++ )
       {
         if( p->size() < 3 )
@@ -95,117 +137,315 @@ namespace CGL {
           exit( 1 );
         }
 
-        // We want to count the number of distinct vertex indices in this
-        // polygon, to make sure it's the same as the number of vertices
-        // in the polygon---if they disagree, then the polygon is not valid
-        // (or at least, for simplicity we don't handle polygons of this type!).
-        set<Index> polygonIndices;
+        nInteriorHalfedges += p->size();
+        for( IndexListCIter i = p->begin(); i != p->end(); i++ )
+        {
+          maxIndex = max( maxIndex, *i );
+        }
+      }
+
+      // Next, we assign each distinct input index a dense "rank" in [0,nVertices),
+      // such that ranks increase with the input index.  The rank of a vertex is then
+      // also the index of its position in vertexPositions.  When the input indices
+      // are reasonably compact (the usual case) a direct lookup table does the job;
+      // otherwise we fall back to sorting the distinct indices.
+      IndexList sortedIndices; // only used by the sparse fallback
+      IndexList indexToRank;   // only used by the lookup table
+      bool denseIndices = ( maxIndex < 2*nInteriorHalfedges + 1024 );
+      Size nVertices = 0;
+      if( denseIndices )
+      {
+        indexToRank.assign( maxIndex+1, none );
+        for( PolygonListCIter p = polygons.begin(); p != polygons.end(); p++ )
+        for( IndexListCIter i = p->begin(); i != p->end(); i++ )
+        {
+          indexToRank[*i] = 0;
+        }
+        for( Index i = 0; i <= maxIndex; i++ )
+        {
+          if( indexToRank[i] != none ) indexToRank[i] = nVertices++;
+        }
+      }
+      else
+      {
+        sortedIndices.reserve( nInteriorHalfedges );
+        for( PolygonListCIter p = polygons.begin(); p != polygons.end(); p++ )
+        {
+          sortedIndices.insert( sortedIndices.end(), p->begin(), p->end() );
+        }
+        sort( sortedIndices.begin(), sortedIndices.end() );
+        sortedIndices.erase( unique( sortedIndices.begin(), sortedIndices.end() ), sortedIndices.end() );
+        nVertices = sortedIndices.size();
+      }
 
-        // loop over polygon vertices
+      // Record the tail vertex (as a rank) of every interior halfedge; halfedge k of
+      // the mesh is corner k of the input, counting corners polygon by polygon.
+      IndexList tail( nInteriorHalfedges );
+      {
+        Index k = 0;
+        for( PolygonListCIter p = polygons.begin(); p != polygons.end(); p++ )
         for( IndexListCIter i = p->begin(); i != p->end(); i++ )
         {
-          polygonIndices.insert( *i );
+          tail[k++] = denseIndices ? indexToRank[*i] :
+                      (Index)( lower_bound( sortedIndices.begin(), sortedIndices.end(), *i ) - sortedIndices.begin() );
+        }
+      }
 
-          // allocate one vertex for each new index we encounter
-          if( indexToVertex.find( *i ) == indexToVertex.end() )
+      // Check that all vertices of each polygon are distinct, and count the vertex
+      // degree, i.e., the number of polygons that use each vertex; this information
+      // will be used to check that the mesh is manifold.
+      vector<Size> vertexDegree( nVertices, 0 );
+      {
+        IndexList polygonIndices;
+        Index k = 0;
+        for( PolygonListCIter p = polygons.begin(); p != polygons.end(); p++ )
+        {
+          Size degree = p->size(); // number of vertices in this polygon
+          polygonIndices.assign( tail.begin() + k, tail.begin() + k + degree );
+          sort( polygonIndices.begin(), polygonIndices.end() );
+          if( adjacent_find( polygonIndices.begin(), polygonIndices.end() ) != polygonIndices.end() )
           {
-            VertexIter v = newVertex();
-            v->halfedge() = halfedges.end(); // this vertex doesn't yet point to any halfedge
-            indexToVertex[ *i ] = v;
-            vertexDegree[ v ] = 1; // we've now seen this vertex only once
+            cerr << "Error converting polygons to halfedge mesh: one of the input polygons does not have distinct vertices!" << endl;
+            cerr << "(vertex indices:";
+            for( IndexListCIter i = p->begin(); i != p->end(); i++ )
+            {
+              cerr << " " << *i;
+            }
+            cerr << ")" << endl;
+            exit( 1 );
           }
-          else
+
+          for( Index i = 0; i < degree; i++ )
           {
-            // keep track of the number of times we've seen this vertex
-            vertexDegree[ indexToVertex[ *i ] ]++;
+            vertexDegree[ tail[k+i] ]++;
           }
+          k += degree;
+        }
+      }
 
-        } // end loop over polygon vertices
-
-        // check that all vertices of the current polygon are distinct
-        Size degree = p->size(); // number of vertices in this polygon
-        if( polygonIndices.size() < degree )
+      // Now find the twin of every interior halfedge.  Each halfedge a->b gets the
+      // key (min(a,b),max(a,b)), so that after sorting, a halfedge and its twin are
+      // adjacent.  Every run of equal keys must either be a single halfedge (which
+      // sits on the boundary) or two halfedges of opposite orientation.
+      struct HalfedgeKey
+      {
+        Index lo, hi, k;
+        bool operator<( const HalfedgeKey& o ) const
+        {
+          if( lo != o.lo ) return lo < o.lo;
+          if( hi != o.hi ) return hi < o.hi;
+          return k < o.k;
+        }
+      };
+      IndexList twin( nInteriorHalfedges, none );
+      {
+        vector<HalfedgeKey> keys( nInteriorHalfedges );
+        Index k = 0;
+        for( PolygonListCIter p = polygons.begin(); p != polygons.end(); p++ )
         {
-          cerr << "Error converting polygons to halfedge mesh: one of the input polygons does not have distinct vertices!" << endl;
-          cerr << "(vertex indices:";
-          for( IndexListCIter i = p->begin(); i != p->end(); i++ )
+          Size degree = p->size();
+          for( Index i = 0; i < degree; i++, k++ )
           {
-            cerr << " " << *i;
+            Index a = tail[k];
+            Index b = tail[ k - i + (i+1)%degree ]; // next vertex, in cyclic order
+            keys[k].lo = min( a, b );
+            keys[k].hi = max( a, b );
+            keys[k].k = k;
           }
-          cerr << ")" << endl;
-          exit( 1 );
-        } // end check that polygon vertices are distinct
-
-      } // end basic sanity checks on input
-
-      // The number of vertices in the mesh is the
-      // number of unique indices seen in the input.
-      Size nVertices = indexToVertex.size();
-
-      // The number of faces is just the number of polygons in the input.
-      Size nFaces = polygons.size();
-      faces.resize( nFaces ); // allocate storage for faces in our new mesh
-
-      // We will store a map from ordered pairs of vertex indices to
-      // the corresponding halfedge object in our new (halfedge) mesh;
-      // this map gets constructed during the next loop over polygons.
-      map<IndexPair,HalfedgeIter> pairToHalfedge;
-
-      // Next, we actually build the halfedge connectivity by again looping over polygons
-      PolygonListCIter p;
-      FaceIter f;
-      for( p = polygons.begin(), f = faces.begin();
-      p != polygons.end();
-      p++, f++ )
-      {
-        vector<HalfedgeIter> faceHalfedges; // cyclically ordered list of the half edges of this face
-        Size degree = p->size(); // number of vertices in this polygon
+        }
+        sort( keys.begin(), keys.end() );
 
-        // loop over the halfedges of this face (equivalently, the ordered pairs of consecutive vertices)
-        for( Index i = 0; i < degree; i++ )
+        for( Index i = 0; i < nInteriorHalfedges; )
         {
-          Index a = (*p)[i]; // current index
-          Index b = (*p)[(i+1)%degree]; // next index, in cyclic order
-          IndexPair ab( a, b );
-          HalfedgeIter hab;
+          Index j = i+1;
+          while( j < nInteriorHalfedges && keys[j].lo == keys[i].lo && keys[j].hi == keys[i].hi ) j++;
 
-          // check if this halfedge already exists; if so, we have a problem!
-          if( pairToHalfedge.find( ab ) != pairToHalfedge.end() )
+          // The halfedges in a run share an edge; two of them have the same orientation if
+          // they share a tail vertex.  In that case, either (i) more than two faces contain
+          // this edge, or (ii) exactly two faces contain it, but with the same orientation.
+          if( j-i > 2 || ( j-i == 2 && tail[keys[i].k] == tail[keys[i+1].k] ) )
           {
+            // report the duplicated orientation in terms of the input indices
+            Size nFromLo = 0;
+            for( Index m = i; m < j; m++ ) if( tail[keys[m].k] == keys[i].lo ) nFromLo++;
+            Index a = ( nFromLo >= 2 ) ? keys[i].lo : keys[i].hi;
+            Index b = ( nFromLo >= 2 ) ? keys[i].hi : keys[i].lo;
+            if( denseIndices )
+            {
+              a = (Index)( find( indexToRank.begin(), indexToRank.end(), a ) - indexToRank.begin() );
+              b = (Index)( find( indexToRank.begin(), indexToRank.end(), b ) - indexToRank.begin() );
+            }
+            else
+            {
+              a = sortedIndices[a];
+              b = sortedIndices[b];
+            }
             cerr << "Error converting polygons to halfedge mesh: found multiple oriented edges with indices (" << a << ", " << b << ")." << endl;
             cerr << "This means that either (i) more than two faces contain this edge (hence the surface is nonmanifold), or" << endl;
             cerr << "(ii) there are exactly two faces containing this edge, but they have the same orientation (hence the surface is" << endl;
             cerr << "not consistently oriented." << endl;
             exit( 1 );
           }
-          else // otherwise, the halfedge hasn't been allocated yet
+
+          if( j-i == 2 )
           {
-            // so, we point this vertex pair to a new halfedge
-            hab = newHalfedge();
-            pairToHalfedge[ab] = hab;
+            twin[ keys[i].k ] = keys[i+1].k;
+            twin[ keys[i+1].k ] = keys[i].k;
+          }
+
+          i = j;
+        }
+      }
+
+      // The positions are listed by rank, so there must be exactly one for each distinct index.
+      if( vertexPositions.size() != nVertices )
+      {
+        cerr << "Error converting polygons to halfedge mesh: number of vertex positions is different from the number of distinct vertices!" << endl;
+        cerr << "(number of positions in input: " << vertexPositions.size() << ")" << endl;
+        cerr << "(  number of vertices in mesh: " << nVertices << ")" << endl;
+        exit( 1 );
+      }
 
-            // link the new halfedge to its face
-            hab->face() = f;
-            hab->face()->halfedge() = hab;
+      // Record where each polygon starts in the list of halfedges.
+      IndexList faceStart( polygons.size() + 1 );
+      faceStart[0] = 0;
+      for( Index n = 0; n < polygons.size(); n++ )
+      {
+        faceStart[n+1] = faceStart[n] + polygons[n].size();
+      }
 
-            // also link it to its starting vertex
-            hab->vertex() = indexToVertex[a];
-            hab->vertex()->halfedge() = hab;
+      // Now that we know how everything is connected, allocate and link the
+      // actual mesh elements.  This also sets the id() of each vertex to its rank.
+      buildFromConnectivity( faceStart, tail, twin, vertexPositions );
 
-            // keep a list of halfedges in this face, so that we can later
-            // link them together in a loop (via their "next" pointers)
-            faceHalfedges.push_back( hab );
+      // Finally, we check that all vertices are manifold.
+      for( VertexIter v = verticesBegin(); v != verticesEnd(); v++ )
+      {
+        // First check that this vertex is not a "floating" vertex;
+        // if it is then we do not have a valid 2-manifold surface.
+        if( v->halfedge() == halfedges.end() )
+        {
+          cerr << "Error converting polygons to halfedge mesh: some vertices are not referenced by any polygon." << endl;
+          exit( 1 );
+        }
+
+        // Next, check that the number of halfedges emanating from this vertex in our half
+        // edge data structure equals the number of polygons containing this vertex, which
+        // we counted during our first pass over the mesh.  If not, then our vertex is not
+        // a "fan" of polygons, but instead has some other (nonmanifold) structure.
+        Size count = 0;
+        HalfedgeIter h = v->halfedge();
+        do
+        {
+          if( !h->face()->isBoundary() )
+          {
+            count++;
           }
+          h = h->twin()->next();
+        }
+        while( h != v->halfedge() );
+
+        if( count != vertexDegree[ v->id() ] )
+        {
+          cerr << "Error converting polygons to halfedge mesh: at least one of the vertices is nonmanifold." << endl;
+          exit( 1 );
+        }
+      } // end loop over vertices
+
+      timer.stop();
+      _buildStats.nFaces = polygons.size();
+      _buildStats.nHalfedges = halfedges.size();
+      _buildStats.seconds = timer.duration();
+
+    } // end HalfedgeMesh::build()
+
+    void HalfedgeMesh :: buildFromConnectivity( const vector<Index>& faceStart,
+      const vector<Index>& tail, const vector<Index>& twin, const vector<Vector3D>& vertexPositions )
+      // This method does the actual work of allocating and linking mesh elements, given
+      // connectivity that has already been worked out (and checked) by the caller: face n
+      // consists of halfedges faceStart[n], ..., faceStart[n+1]-1, in cyclic order; halfedge
+      // k starts at vertex tail[k]; and twin[k] is the index of the oppositely oriented
+      // halfedge, or -1 if halfedge k sits on the boundary.  Vertex r gets position
+      // vertexPositions[r] and id() r.  Boundary loops are created automatically.
+    {
+      // marks "no such element" in the index arrays
+      const Index none = (Index) -1;
+
+      Timer timer;
+      timer.start();
+
+      // Clear any existing elements.
+      halfedges.clear();
+      vertices.clear();
+      edges.clear();
+      faces.clear();
+      boundaries.clear();
+
+      // None of the new normals has been computed yet.
+      staleFaces.clear();
+      staleVertices.clear();
+      allNormalsStale = true;
+
+      Size nVertices = vertexPositions.size();
+      Size nFaces = faceStart.size() - 1;
+      Size nInteriorHalfedges = tail.size();
+
+      // Every interior halfedge without a twin gets a boundary twin (and its own edge).
+      Size nInteriorEdges = 0;
+      for( Index k = 0; k < nInteriorHalfedges; k++ )
+      {
+        if( twin[k] != none && twin[k] < k ) nInteriorEdges++;
+      }
+      Size nBoundaryHalfedges = nInteriorHalfedges - 2*nInteriorEdges;
+      reserve( nVertices, nInteriorEdges + nBoundaryHalfedges, nFaces, nInteriorHalfedges + nBoundaryHalfedges );
+
+      // Allocate vertices in the order they are first referenced by the input.
+      vector<VertexIter> rankToVertex( nVertices, vertices.end() );
+      for( Index k = 0; k < nInteriorHalfedges; k++ )
+      {
+        if( rankToVertex[ tail[k] ] == vertices.end() )
+        {
+          VertexIter v = newVertex();
+          v->halfedge() = halfedges.end(); // this vertex doesn't yet point to any halfedge
+          v->_id = tail[k];
+          rankToVertex[ tail[k] ] = v;
+        }
+      }
+
+      // The number of faces is given by the face offsets.
+      faces.resize( nFaces ); // allocate storage for faces in our new mesh
+
+      // Next, we actually build the halfedge connectivity by looping over faces
+      vector<HalfedgeIter> interiorHalfedges( nInteriorHalfedges );
+      FaceIter f;
+      Index k = 0;
+      Index n;
+      for( n = 0, f = faces.begin(); n < nFaces; n++, f++ )
+      {
+        Size degree = faceStart[n+1] - faceStart[n]; // number of vertices in this face
+        Index first = k; // index of the first halfedge of this face
+
+        // loop over the halfedges of this face (equivalently, the ordered pairs of consecutive vertices)
+        for( Index i = 0; i < degree; i++, k++ )
+        {
+          HalfedgeIter hab = newHalfedge();
+          interiorHalfedges[k] = hab;
+
+          // link the new halfedge to its face
+          hab->face() = f;
+          hab->face()->halfedge() = hab;
 
-          // Also, check if the twin of this halfedge has already been constructed (during
-          // construction of a different face).  If so, link the twins together and allocate
-          // their shared halfedge.  By the end of this pass over polygons, the only halfedges
+          // also link it to its starting vertex
+          hab->vertex() = rankToVertex[ tail[k] ];
+          hab->vertex()->halfedge() = hab;
+
+          // If the twin of this halfedge has already been constructed (during
+          // construction of a different face), link the twins together and allocate
+          // their shared edge.  By the end of this pass over polygons, the only halfedges
           // that will not have a twin will hence be those that sit along the domain boundary.
-          IndexPair ba( b, a );
-          map<IndexPair,HalfedgeIter>::iterator iba = pairToHalfedge.find( ba );
-          if( iba != pairToHalfedge.end() )
+          if( twin[k] != none && twin[k] < k )
           {
-            HalfedgeIter hba = iba->second;
+            HalfedgeIter hba = interiorHalfedges[ twin[k] ];
 
             // link the twins
             hab->twin() = hba;
@@ -233,7 +473,7 @@ namespace CGL {
         for( Index i = 0; i < degree; i++ )
         {
           Index j = (i+1) % degree; // index of the next halfedge, in cyclic order
-          faceHalfedges[i]->next() = faceHalfedges[j];
+          interiorHalfedges[first+i]->next() = interiorHalfedges[first+j];
         }
 
       } // done building basic halfedge connectivity
@@ -258,8 +498,10 @@ namespace CGL {
       } // done advancing halfedge pointers for boundary vertices
 
       // Next we construct new faces for each boundary component.
-      for( HalfedgeIter h = halfedgesBegin(); h != halfedgesEnd(); h++ ) // loop over all halfedges
+      for( Index j = 0; j < nInteriorHalfedges; j++ ) // loop over all (interior) halfedges
       {
+        HalfedgeIter h = interiorHalfedges[j];
+
         // Any halfedge that does not yet have a twin is on the boundary of the domain.
         // If we follow the boundary around long enough we will of course eventually make a
         // closed loop; we can represent this boundary loop by a new face. To make clear the
@@ -316,6 +558,7 @@ namespace CGL {
             Index q = (p-1+degree) % degree;
             boundaryHalfedges[p]->next() = boundaryHalfedges[q];
           }
+          b->halfedge() = boundaryHalfedges[0];
 
         } // end construction of one of the boundary loops
 
@@ -335,63 +578,150 @@ namespace CGL {
         v->halfedge() = v->halfedge()->twin()->next();
       }
 
-      // Finally, we check that all vertices are manifold.
-      for( VertexIter v = vertices.begin(); v != vertices.end(); v++ )
+      // Now that we have the connectivity, we copy the list of vertex
+      // positions into member variables of the individual vertices.
+      for( Index r = 0; r < nVertices; r++ )
       {
-        // First check that this vertex is not a "floating" vertex;
-        // if it is then we do not have a valid 2-manifold surface.
-        if( v->halfedge() == halfedges.end() )
-        {
-          cerr << "Error converting polygons to halfedge mesh: some vertices are not referenced by any polygon." << endl;
-          exit( 1 );
-        }
+        rankToVertex[r]->position = vertexPositions[r];
+      }
 
-        // Next, check that the number of halfedges emanating from this vertex in our half
-        // edge data structure equals the number of polygons containing this vertex, which
-        // we counted during our first pass over the mesh.  If not, then our vertex is not
-        // a "fan" of polygons, but instead has some other (nonmanifold) structure.
-        Size count = 0;
-        HalfedgeIter h = v->halfedge();
+      timer.stop();
+      _buildStats.nFaces = nFaces;
+      _buildStats.nHalfedges = halfedges.size();
+      _buildStats.seconds = timer.duration();
+
+    } // end HalfedgeMesh::buildFromConnectivity()
+
+    void HalfedgeMesh :: enumerate( void ) const
+    {
+      Index i;
+      i = 0; for( HalfedgeCIter h = halfedgesBegin(); h != halfedgesEnd(); h++ ) h->_id = i++;
+      i = 0; for(   VertexCIter v =  verticesBegin(); v !=  verticesEnd(); v++ ) v->_id = i++;
+      i = 0; for(     EdgeCIter e =     edgesBegin(); e !=     edgesEnd(); e++ ) e->_id = i++;
+      i = 0; for(     FaceCIter f =     facesBegin(); f !=     facesEnd(); f++ ) f->_id = i++;
+             for(     FaceCIter b = boundariesBegin(); b != boundariesEnd(); b++ ) b->_id = i++;
+    }
+
+    void HalfedgeMesh :: enumerate( FaceCIter f, Index id ) const
+    {
+      f->_id = id;
+    }
+
+    void HalfedgeMesh :: invalidateNormals( void ) const
+    {
+      for(   VertexCIter v =  verticesBegin(); v !=  verticesEnd(); v++ ) v->invalidateNormal();
+      for(     FaceCIter f =     facesBegin(); f !=     facesEnd(); f++ ) f->invalidateNormal();
+      for(     FaceCIter b = boundariesBegin(); b != boundariesEnd(); b++ ) b->invalidateNormal();
+      dropStaleNormals();
+    }
+
+    void HalfedgeMesh :: invalidateNormals( VertexCIter v ) const
+    {
+      HalfedgeCIter h = v->halfedge();
+      do
+      {
+        // Every vertex of a face around this one uses that face's normal.
+        // This includes boundary loops, whose normals Vertex::computeNormal()
+        // adds in as well, so the whole loop is walked.
+        // (The loop is walked from h, which is on it, rather than from
+        // f->halfedge(), so that it does not wait on f.)
+        invalidateNormal( h->face() );
+        HalfedgeCIter g = h;
         do
         {
-          if( !h->face()->isBoundary() )
-          {
-            count++;
-          }
-          h = h->twin()->next();
+          invalidateNormal( g->vertex() );
+          g = g->next();
         }
-        while( h != v->halfedge() );
+        while( g != h );
 
-        if( count != vertexDegree[v] )
-        {
-          cerr << "Error converting polygons to halfedge mesh: at least one of the vertices is nonmanifold." << endl;
-          exit( 1 );
-        }
-      } // end loop over vertices
+        h = h->twin()->next();
+      }
+      while( h != v->halfedge() );
+    }
 
-      // Now that we have the connectivity, we copy the list of vertex
-      // positions into member variables of the individual vertices.
-      if( vertexPositions.size() != vertices.size() )
+    void HalfedgeMesh :: invalidateNormal( FaceCIter f ) const
+    {
+      f->invalidateNormal();
+      if( !f->_normalQueued && !allNormalsStale )
       {
-        cerr << "Error converting polygons to halfedge mesh: number of vertex positions is different from the number of distinct vertices!" << endl;
-        cerr << "(number of positions in input: " << vertexPositions.size() << ")" << endl;
-        cerr << "(  number of vertices in mesh: " << vertices.size() << ")" << endl;
-        exit( 1 );
+        f->_normalQueued = true;
+        staleFaces.push_back( f );
       }
-      // Since an STL map internally sorts its keys, we can iterate over the map from vertex indices to
-      // vertex iterators to visit our (input) vertices in lexicographic order
-      int i = 0;
-      for( map<Index,VertexIter>::const_iterator e = indexToVertex.begin(); e != indexToVertex.end(); e++ )
+    }
+
+    void HalfedgeMesh :: invalidateNormal( VertexCIter v ) const
+    {
+      v->invalidateNormal();
+      if( !v->_normalQueued && !allNormalsStale )
+      {
+        v->_normalQueued = true;
+        staleVertices.push_back( v );
+      }
+    }
+
+    void HalfedgeMesh :: dropStaleNormals( void ) const
+    {
+      for( size_t i = 0; i <    staleFaces.size(); i++ )    staleFaces[i]->_normalQueued = false;
+      for( size_t i = 0; i < staleVertices.size(); i++ ) staleVertices[i]->_normalQueued = false;
+      staleFaces.clear();
+      staleVertices.clear();
+      allNormalsStale = true;
+    }
+
+    void HalfedgeMesh :: exchange( VertexIter v, Vertex& saved )
+    {
+      bool queued = v->_normalQueued;
+      std::swap( *v, saved );
+      v->_normalQueued = queued;
+      saved._normalQueued = false;
+
+      // The normal that was swapped in may belong to another state of the mesh.
+      invalidateNormal( v );
+    }
+
+    void HalfedgeMesh :: exchange( FaceIter f, Face& saved )
+    {
+      bool queued = f->_normalQueued;
+      std::swap( *f, saved );
+      f->_normalQueued = queued;
+      saved._normalQueued = false;
+
+      // The normal that was swapped in may belong to another state of the mesh.
+      invalidateNormal( f );
+    }
+
+    void HalfedgeMesh :: updateNormals( void ) const
+    {
+      // Without the stale lists, gather the stale elements from the whole mesh
+      // (clearing any queued flags that were copied along with the elements).
+      // Boundary loops are included: vertex normals read theirs.
+      if( allNormalsStale )
       {
-        // grab a pointer to the vertex associated with the current key (i.e., the current index)
-        VertexIter v = e->second;
+        for(     FaceCIter f =     facesBegin(); f !=     facesEnd(); f++ ) { f->_normalQueued = false; if( !f->_normalValid ) staleFaces.push_back( f ); }
+        for(     FaceCIter b = boundariesBegin(); b != boundariesEnd(); b++ ) { b->_normalQueued = false; if( !b->_normalValid ) staleFaces.push_back( b ); }
+        for(   VertexCIter v =  verticesBegin(); v !=  verticesEnd(); v++ ) { v->_normalQueued = false; if( !v->_normalValid ) staleVertices.push_back( v ); }
+        allNormalsStale = false;
+      }
 
-        // set the position of this vertex to the corresponding position in the input
-        v->position = vertexPositions[ i ];
-        i++;
+      // Each face only reads vertex positions, and each vertex only reads face
+      // normals that the first loop has already brought up to date.
+      #pragma omp parallel for
+      for( long i = 0; i < (long) staleFaces.size(); i++ )
+      {
+        staleFaces[i]->normal();
       }
 
-    } // end HalfedgeMesh::build()
+      #pragma omp parallel for
+      for( long i = 0; i < (long) staleVertices.size(); i++ )
+      {
+        staleVertices[i]->normal();
+      }
+
+      for( size_t i = 0; i <    staleFaces.size(); i++ )    staleFaces[i]->_normalQueued = false;
+      for( size_t i = 0; i < staleVertices.size(); i++ ) staleVertices[i]->_normalQueued = false;
+      staleFaces.clear();
+      staleVertices.clear();
+    }
 
     const HalfedgeMesh& HalfedgeMesh :: operator=( const HalfedgeMesh& mesh )
     // The assignment operator does a "deep" copy of the halfedge mesh data structure; in
@@ -401,50 +731,83 @@ namespace CGL {
     // on the right-hand side of an assignment may be temporary (hence any pointers to elements
     // in this mesh will become invalid as soon as it is released.)
     {
+      if( this == &mesh ) return *this;
+
+#ifdef HALFEDGE_INDEXED_STORAGE
+      // The elements refer to each other by slot, so copying the arrays slot
+      // for slot (dead slots included) copies the connectivity as it is.
+      halfedges = mesh.halfedges;
+      vertices = mesh.vertices;
+      edges = mesh.edges;
+      faces = mesh.faces;
+      boundaries = mesh.boundaries;
+#else
       // Clear any existing elements.
       halfedges.clear();
       vertices.clear();
       edges.clear();
       faces.clear();
       boundaries.clear();
-
-      // These maps will be used to identify elements of the old mesh
-      // with elements of the new mesh.  (Note that we can use a single
-      // map for both interior and boundary faces, because the map
-      // doesn't care which list of faces these iterators come from.)
-      map< HalfedgeCIter, HalfedgeIter > halfedgeOldToNew;
-      map<   VertexCIter,   VertexIter >   vertexOldToNew;
-      map<     EdgeCIter,     EdgeIter >     edgeOldToNew;
-      map<     FaceCIter,     FaceIter >     faceOldToNew;
-
-      // Copy geometry from the original mesh and create a map from
-      // pointers in the original mesh to those in the new mesh.
-      for( HalfedgeCIter h =      mesh.halfedgesBegin(); h !=  mesh.halfedgesEnd(); h++ ) halfedgeOldToNew[ h ] =  halfedges.insert(  halfedges.end(), *h );
-      for(   VertexCIter v =       mesh.verticesBegin(); v !=   mesh.verticesEnd(); v++ )   vertexOldToNew[ v ] =   vertices.insert(   vertices.end(), *v );
-      for(     EdgeCIter e =          mesh.edgesBegin(); e !=      mesh.edgesEnd(); e++ )     edgeOldToNew[ e ] =      edges.insert(      edges.end(), *e );
-      for(     FaceCIter f =          mesh.facesBegin(); f !=      mesh.facesEnd(); f++ )     faceOldToNew[ f ] =      faces.insert(      faces.end(), *f );
-      for(     FaceCIter b =     mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++ )     faceOldToNew[ b ] = boundaries.insert( boundaries.end(), *b );
-
-      // "Search and replace" old pointers with new ones.
-      for( HalfedgeIter he = halfedgesBegin(); he != halfedgesEnd(); he++ )
+      reserve( mesh.nVertices(), mesh.nEdges(), mesh.nFaces(), mesh.nHalfedges() );
+
+      // Look up the elements of the original mesh by address, so that each old
+      // pointer can be identified with a new one.  (Boundary loops are numbered
+      // after the interior faces, so a single array serves both.)  The original
+      // is only read, never written: other threads may be reading it, too.
+      PositionTable<Halfedge> halfedgePosition( mesh.nHalfedges() );                  halfedgePosition.add( mesh.halfedgesBegin(), mesh.halfedgesEnd() );
+      PositionTable<  Vertex>   vertexPosition( mesh.nVertices() );                     vertexPosition.add( mesh.verticesBegin(), mesh.verticesEnd() );
+      PositionTable<    Edge>     edgePosition( mesh.nEdges() );                          edgePosition.add( mesh.edgesBegin(), mesh.edgesEnd() );
+      PositionTable<    Face>     facePosition( mesh.nFaces() + mesh.nBoundaries() );    facePosition.add( mesh.facesBegin(), mesh.facesEnd() );
+                                                                                          facePosition.add( mesh.boundariesBegin(), mesh.boundariesEnd() );
+
+      // Copy geometry from the original mesh, recording the new elements by position.
+      vector< HalfedgeIter > halfedgeById; halfedgeById.reserve( mesh.nHalfedges() );
+      vector<   VertexIter >   vertexById;   vertexById.reserve( mesh.nVertices() );
+      vector<     EdgeIter >     edgeById;     edgeById.reserve( mesh.nEdges() );
+      vector<     FaceIter >     faceById;     faceById.reserve( mesh.nFaces() + mesh.nBoundaries() );
+
+      for( HalfedgeCIter h =      mesh.halfedgesBegin(); h !=  mesh.halfedgesEnd(); h++ ) halfedgeById.push_back(  halfedges.insert(  halfedges.end(), *h ) );
+      for(   VertexCIter v =       mesh.verticesBegin(); v !=   mesh.verticesEnd(); v++ )   vertexById.push_back(   vertices.insert(   vertices.end(), *v ) );
+      for(     EdgeCIter e =          mesh.edgesBegin(); e !=      mesh.edgesEnd(); e++ )     edgeById.push_back(      edges.insert(      edges.end(), *e ) );
+      for(     FaceCIter f =          mesh.facesBegin(); f !=      mesh.facesEnd(); f++ )     faceById.push_back(      faces.insert(      faces.end(), *f ) );
+      for(     FaceCIter b =     mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++ )     faceById.push_back( boundaries.insert( boundaries.end(), *b ) );
+
+      // "Search and replace" old pointers with new ones.  The copied pointers still
+      // refer to elements of the original mesh, whose positions give their replacements;
+      // every element is written by exactly one iteration, so this runs in parallel.
+      #pragma omp parallel for
+      for( long i = 0; i < (long) halfedgeById.size(); i++ )
       {
-        he->next()   = halfedgeOldToNew[ he->next()   ];
-        he->twin()   = halfedgeOldToNew[ he->twin()   ];
-        he->vertex() =   vertexOldToNew[ he->vertex() ];
-        he->edge()   =     edgeOldToNew[ he->edge()   ];
-        he->face()   =     faceOldToNew[ he->face()   ];
+        HalfedgeIter he = halfedgeById[i];
+        he->next()   = halfedgeById[ halfedgePosition( &*he->next()   ) ];
+        he->twin()   = halfedgeById[ halfedgePosition( &*he->twin()   ) ];
+        he->vertex() =   vertexById[   vertexPosition( &*he->vertex() ) ];
+        he->edge()   =     edgeById[     edgePosition( &*he->edge()   ) ];
+        he->face()   =     faceById[     facePosition( &*he->face()   ) ];
       }
-      for( VertexIter v =   verticesBegin(); v !=   verticesEnd(); v++ ) v->halfedge() = halfedgeOldToNew[ v->halfedge() ];
-      for(   EdgeIter e =      edgesBegin(); e !=      edgesEnd(); e++ ) e->halfedge() = halfedgeOldToNew[ e->halfedge() ];
-      for(   FaceIter f =      facesBegin(); f !=      facesEnd(); f++ ) f->halfedge() = halfedgeOldToNew[ f->halfedge() ];
-      for(   FaceIter b = boundariesBegin(); b != boundariesEnd(); b++ ) b->halfedge() = halfedgeOldToNew[ b->halfedge() ];
+      #pragma omp parallel for
+      for( long i = 0; i < (long) vertexById.size(); i++ ) vertexById[i]->halfedge() = halfedgeById[ halfedgePosition( &*vertexById[i]->halfedge() ) ];
+      #pragma omp parallel for
+      for( long i = 0; i < (long)   edgeById.size(); i++ )   edgeById[i]->halfedge() = halfedgeById[ halfedgePosition( &*  edgeById[i]->halfedge() ) ];
+      #pragma omp parallel for
+      for( long i = 0; i < (long)   faceById.size(); i++ )   faceById[i]->halfedge() = halfedgeById[ halfedgePosition( &*  faceById[i]->halfedge() ) ];
+#endif
+
+      _buildStats = mesh._buildStats;
+
+      // The stale lists of the original refer to its own elements.
+      staleFaces.clear();
+      staleVertices.clear();
+      allNormalsStale = true;
 
       // Return a reference to the new mesh.
       return *this;
     }
 
     HalfedgeMesh :: HalfedgeMesh( const HalfedgeMesh& mesh )
+    : allNormalsStale( true )
     {
+      setContext();
       *this = mesh;
     }
 
@@ -92,6 +92,18 @@
  * interface.  (There are deeper reasons for this kind of encapsulation
  * when working with polygon meshes, but that's a story for another time!)
  *
+ * In fact, this implementation offers exactly such a choice.  When compiled
+ * with HALFEDGE_INDEXED_STORAGE defined (CMake option BUILD_INDEXED_MESH),
+ * each element type is stored in a contiguous ElementArray (see
+ * elementArray.h) rather than a linked list.  The elements then refer to
+ * each other by bare 32-bit slot indices, resolved through the arrays of the
+ * mesh that owns them, so a halfedge takes 48 bytes instead of 56.  Iterators
+ * are an array pointer plus a slot index, and the non-const accessors return
+ * an ElementLink rather than a reference to an iterator, but it converts to
+ * and from iterators, so traversal code does not change at all.  The one
+ * caveat is that raw element addresses (e.g., from elementAddress()) may move
+ * when new elements are allocated, so hold on to iterators instead.
+ *
  * Finally, some surfaces have "boundary loops," e.g., a pair of pants has
  * three boundaries: one at the waist, and two at the ankles.  These boundaries
  * are represented by special faces in our halfedge mesh---in fact, rather than
@@ -149,6 +161,7 @@
 #include "CGL/CGL.h" // Standard 462 Vectors, etc.
 
 #include "mesh.h"
+#include "elementArray.h"
 
 using namespace std;
 using namespace CGL;
@@ -169,16 +182,28 @@ namespace CGL
    class Edge;
    class Face;
    class Halfedge;
+   class HalfedgeMesh;
+
+   /*
+    * The container used to store each type of mesh element: a linked list by
+    * default, or a contiguous, index-addressed array if the mesh was built
+    * with HALFEDGE_INDEXED_STORAGE.
+    */
+#ifdef HALFEDGE_INDEXED_STORAGE
+   template<class T> using ElementList = ElementArray<T>;
+#else
+   template<class T> using ElementList = list<T>;
+#endif
 
    /*
     * Rather than using raw pointers to mesh elements, we store references
     * as STL::iterators---for convenience, we give shorter names to these
     * iterators (e.g., EdgeIter instead of list<Edge>::iterator).
     */
-   typedef   list<Vertex>::iterator   VertexIter;
-   typedef     list<Edge>::iterator     EdgeIter;
-   typedef     list<Face>::iterator     FaceIter;
-   typedef list<Halfedge>::iterator HalfedgeIter;
+   typedef   ElementList<Vertex>::iterator   VertexIter;
+   typedef     ElementList<Edge>::iterator     EdgeIter;
+   typedef     ElementList<Face>::iterator     FaceIter;
+   typedef ElementList<Halfedge>::iterator HalfedgeIter;
 
    /*
     * We also need "const" iterator types, for situations where a method takes
@@ -186,15 +211,35 @@ namespace CGL
     * used so frequently, we will use "CIter" as a shorthand abbreviation for
     * "constant iterator."
     */
-   typedef   list<Vertex>::const_iterator   VertexCIter;
-   typedef     list<Edge>::const_iterator     EdgeCIter;
-   typedef     list<Face>::const_iterator     FaceCIter;
-   typedef list<Halfedge>::const_iterator HalfedgeCIter;
+   typedef   ElementList<Vertex>::const_iterator   VertexCIter;
+   typedef     ElementList<Edge>::const_iterator     EdgeCIter;
+   typedef     ElementList<Face>::const_iterator     FaceCIter;
+   typedef ElementList<Halfedge>::const_iterator HalfedgeCIter;
 
+   /*
+    * What the non-const accessors of the elements (Halfedge::next(),
+    * Vertex::halfedge(), ...) return: a reference to the stored iterator, or,
+    * with indexed storage, a link to the stored slot index that can be used
+    * and assigned in the same way (see elementArray.h).
+    */
+#ifdef HALFEDGE_INDEXED_STORAGE
+   typedef ElementLink<Halfedge> HalfedgeRef;
+   typedef   ElementLink<Vertex>   VertexRef;
+   typedef     ElementLink<Edge>     EdgeRef;
+   typedef     ElementLink<Face>     FaceRef;
+#else
+   typedef HalfedgeIter& HalfedgeRef;
+   typedef   VertexIter&   VertexRef;
+   typedef     EdgeIter&     EdgeRef;
+   typedef     FaceIter&     FaceRef;
+#endif
+
+#ifndef HALFEDGE_INDEXED_STORAGE
   /*
    * Some algorithms need to know how to compare two iterators (which comes first?)
    * Here we just say that one iterator comes before another if the address of the
    * object it points to is smaller.  (You should not have to worry about this!)
+   * (Indexed iterators define their own ordering, by slot, in elementArray.h.)
    */
    inline bool operator<( const HalfedgeIter& i, const HalfedgeIter& j ) { return &*i < &*j; }
    inline bool operator<( const   VertexIter& i, const   VertexIter& j ) { return &*i < &*j; }
@@ -206,6 +251,7 @@ namespace CGL
    inline bool operator<( const   VertexCIter& i, const   VertexCIter& j ) { return &*i < &*j; }
    inline bool operator<( const     EdgeCIter& i, const     EdgeCIter& j ) { return &*i < &*j; }
    inline bool operator<( const     FaceCIter& i, const     FaceCIter& j ) { return &*i < &*j; }
+#endif
 
    /**
     * The elementAddress() function is defined only for convenience (and
@@ -227,13 +273,34 @@ namespace CGL
    inline     Edge const* elementAddress(     EdgeCIter e ) { return &( *e ); }
    inline     Face const* elementAddress(     FaceCIter f ) { return &( *f ); }
 
+#ifdef HALFEDGE_INDEXED_STORAGE
+   /**
+    * And for the links returned by the element accessors.
+    */
+   inline Halfedge* elementAddress( HalfedgeRef h ) { return &( *h ); }
+   inline   Vertex* elementAddress(   VertexRef v ) { return &( *v ); }
+   inline     Edge* elementAddress(     EdgeRef e ) { return &( *e ); }
+   inline     Face* elementAddress(     FaceRef f ) { return &( *f ); }
+#endif
+
    class EdgeRecord
    {
       public:
          EdgeRecord( void ) {}
          EdgeRecord( EdgeIter& _edge );
 
+         /**
+          * The edge this record was made for; HalfedgeMesh::edgeOf() returns an
+          * iterator to it.  With indexed storage, this is the slot of the edge,
+          * which stays meaningful when the mesh (and the record with it) is copied.
+          */
+#ifdef HALFEDGE_INDEXED_STORAGE
+         uint32_t edge;
+         static uint32_t link( EdgeIter e ) { return e.index(); }
+#else
          EdgeIter edge;
+         static EdgeIter link( EdgeIter e ) { return e; }
+#endif
          Vector3D optimalPoint;
          double score;
    };
@@ -244,9 +311,13 @@ namespace CGL
          return (r1.score < r2.score);
       }
 
+#ifdef HALFEDGE_INDEXED_STORAGE
+      return r1.edge < r2.edge;
+#else
       EdgeIter e1 = r1.edge;
       EdgeIter e2 = r2.edge;
       return &*e1 < &*e2;
+#endif
    }
 
 
@@ -286,10 +357,45 @@ namespace CGL
           */
          Face*     getFace    ( void );
 
+         /**
+          * A dense, 0-based index of this element among all elements of the same type,
+          * as assigned by the most recent call to HalfedgeMesh::enumerate().  These
+          * indices are NOT kept up to date as the mesh is edited; call enumerate()
+          * again after changing the connectivity.
+          */
+         Index id( void ) const { return _id; }
+
+         /**
+          * Constructor.
+          */
+         HalfedgeElement( void ) : _id( 0 ) {}
+
          /**
           * Destructor.
           */
          virtual ~HalfedgeElement( void ) {}
+
+      protected:
+         friend class HalfedgeMesh;
+
+         mutable Index _id; ///< index assigned by HalfedgeMesh::enumerate()
+
+#ifdef HALFEDGE_INDEXED_STORAGE
+         template<class> friend class ElementArray;
+
+         static const uint32_t none = 0xffffffffu; ///< stored index of a link to nothing
+
+         const void* _context = NULL; ///< mesh whose arrays hold this element, kept up to date by them
+
+         /**
+          * Returns the mesh whose arrays hold the given element (see
+          * elementArray.h); the stored indices of the element point into them.
+          */
+         static HalfedgeMesh* owner( const HalfedgeElement* element )
+         {
+            return static_cast<HalfedgeMesh*>( const_cast<void*>( element->_context ) );
+         }
+#endif
    };
 
    /**
@@ -301,17 +407,31 @@ namespace CGL
    {
       public:
 
-         HalfedgeIter&   twin( void ) { return _twin;   } ///< access the twin half edge
-         HalfedgeIter&   next( void ) { return _next;   } ///< access the next half edge
-         VertexIter&   vertex( void ) { return _vertex; } ///< access the vertex in the half edge
-         EdgeIter&       edge( void ) { return _edge;   } ///< access the edge the half edge is on
-         FaceIter&       face( void ) { return _face;   } ///< access the face the half edge is on
+#ifdef HALFEDGE_INDEXED_STORAGE
+         HalfedgeRef     twin( void ); ///< access the twin half edge
+         HalfedgeRef     next( void ); ///< access the next half edge
+         VertexRef     vertex( void ); ///< access the vertex in the half edge
+         EdgeRef         edge( void ); ///< access the edge the half edge is on
+         FaceRef         face( void ); ///< access the face the half edge is on
+
+         HalfedgeCIter   twin( void ) const; ///< access the twin half edge (const iterator)
+         HalfedgeCIter   next( void ) const; ///< access the next half edge (comst iterator)
+         VertexCIter   vertex( void ) const; ///< access the vertex in the half edge (const iterator)
+         EdgeCIter       edge( void ) const; ///< access the edge the half edge is on (const iterator)
+         FaceCIter       face( void ) const; ///< access the face the half edge is on (const iterator)
+#else
+         HalfedgeRef     twin( void ) { return _twin;   } ///< access the twin half edge
+         HalfedgeRef     next( void ) { return _next;   } ///< access the next half edge
+         VertexRef     vertex( void ) { return _vertex; } ///< access the vertex in the half edge
+         EdgeRef         edge( void ) { return _edge;   } ///< access the edge the half edge is on
+         FaceRef         face( void ) { return _face;   } ///< access the face the half edge is on
 
          HalfedgeCIter   twin( void ) const { return _twin;   } ///< access the twin half edge (const iterator)
          HalfedgeCIter   next( void ) const { return _next;   } ///< access the next half edge (comst iterator)
          VertexCIter   vertex( void ) const { return _vertex; } ///< access the vertex in the half edge (const iterator)
          EdgeCIter       edge( void ) const { return _edge;   } ///< access the edge the half edge is on (const iterator)
          FaceCIter       face( void ) const { return _face;   } ///< access the face the half edge is on (const iterator)
+#endif
 
          /**
           * Check if the edge is a boundary edge.
@@ -329,20 +449,35 @@ namespace CGL
                             EdgeIter edge,
                             FaceIter face )
          {
-            _next   = next;
-            _twin   = twin;
-            _vertex = vertex;
-            _edge   = edge;
-            _face   = face;
+            _next   = link( next );
+            _twin   = link( twin );
+            _vertex = link( vertex );
+            _edge   = link( edge );
+            _face   = link( face );
          }
 
       protected:
 
+#ifdef HALFEDGE_INDEXED_STORAGE
+         uint32_t _twin   = none; ///< halfedge on the "other side" of the edge
+         uint32_t _next   = none; ///< next halfedge around the current face
+         uint32_t _vertex = none; ///< vertex at the "base" or "root" of this halfedge
+         uint32_t _edge   = none; ///< associated edge
+         uint32_t _face   = none; ///< face containing this halfedge (or boundary loop, with ElementLink::alternate set)
+
+         static uint32_t link( HalfedgeIter h ) { return h.index(); }
+         static uint32_t link(   VertexIter v ) { return v.index(); }
+         static uint32_t link(     EdgeIter e ) { return e.index(); }
+         uint32_t link( FaceIter f ) const;
+#else
          HalfedgeIter _twin; ///< halfedge on the "other side" of the edge
          HalfedgeIter _next; ///< next halfedge around the current face
          VertexIter _vertex; ///< vertex at the "base" or "root" of this halfedge
          EdgeIter _edge; ///< associated edge
          FaceIter _face; ///< face containing this halfedge
+
+         template<class Iter> static const Iter& link( const Iter& i ) { return i; }
+#endif
    };
 
    /**
@@ -356,17 +491,22 @@ namespace CGL
           * initializes the face, possibly setting its boundary flag
           * (by default, a Face does not encode a boundary loop)
           */
-         Face( bool isBoundary = false ) : _isBoundary( isBoundary ) {}
+         Face( bool isBoundary = false ) : _isBoundary( isBoundary ), _normalValid( false ), _normalQueued( false ) {}
 
+#ifdef HALFEDGE_INDEXED_STORAGE
+         HalfedgeRef   halfedge( void );
+         HalfedgeCIter halfedge( void ) const;
+#else
          /**
           * Returns a reference to some halfedge of this face
           */
-         HalfedgeIter& halfedge( void )       { return _halfedge; }
+         HalfedgeRef   halfedge( void )       { return _halfedge; }
 
          /**
           * Returns some halfedge of this face
           */
          HalfedgeCIter halfedge( void ) const { return _halfedge; }
+#endif
 
          /**
           * returns the number of edges (or equivalently, vertices) of this face
@@ -376,13 +516,13 @@ namespace CGL
             Size d = 0; // degree
 
             // walk around the face
-            HalfedgeIter h = _halfedge;
+            HalfedgeCIter h = halfedge();
             do
             {
                d++; // increment the degree
                h = h->next();
             }
-            while( h != _halfedge ); // done walking around the face
+            while( h != halfedge() ); // done walking around the face
 
             return d;
          }
@@ -397,16 +537,47 @@ namespace CGL
          }
 
          /**
-          * Get a unit face normal (computed via the area vector).
+          * Get a unit face normal (computed via the area vector).  The value is
+          * cached, and only recomputed after HalfedgeMesh::invalidateNormals() has
+          * marked it as out of date.
           * \returns a unit face normal (computed via the area vector).
           */
-         Vector3D normal( void ) const;
+         Vector3D normal( void ) const
+         {
+            if( !_normalValid )
+            {
+               _normal = computeNormal();
+               _normalValid = true;
+            }
+            return _normal;
+         }
+
+         /**
+          * Computes the unit face normal from the current vertex positions,
+          * bypassing (and not updating) the cached value.
+          */
+         Vector3D computeNormal( void ) const;
 
          Matrix4x4 quadric;
 
       protected:
+         friend class HalfedgeMesh;
+
+         /**
+          * Marks the cached normal as out of date (see HalfedgeMesh::invalidateNormals(),
+          * which also lists it for updateNormals()).
+          */
+         void invalidateNormal( void ) const { _normalValid = false; }
+
+#ifdef HALFEDGE_INDEXED_STORAGE
+         uint32_t _halfedge = none; ///< one of the halfedges of this face
+#else
          HalfedgeIter _halfedge; ///< one of the halfedges of this face
+#endif
          bool _isBoundary;       ///< boundary flag
+         mutable Vector3D _normal;  ///< cached value of normal()
+         mutable bool _normalValid; ///< whether _normal is up to date
+         mutable bool _normalQueued; ///< whether this face is on the stale list of its mesh (see HalfedgeMesh::updateNormals())
    };
 
    /**
@@ -416,15 +587,20 @@ namespace CGL
    {
       public:
 
+#ifdef HALFEDGE_INDEXED_STORAGE
+         HalfedgeRef   halfedge( void );
+         HalfedgeCIter halfedge( void ) const;
+#else
          /**
           * returns some halfedge rooted at this vertex (reference)
           */
-         HalfedgeIter& halfedge( void )       { return _halfedge; }
+         HalfedgeRef   halfedge( void )       { return _halfedge; }
 
          /**
           * returns some halfedge rooted at this vertex
           */
          HalfedgeCIter halfedge( void ) const { return _halfedge; }
+#endif
 
          Vector3D position; ///< location in 3-space
 
@@ -438,7 +614,28 @@ namespace CGL
 
          Vector3D centroid; ///< average of neighbor positions, storing the value computed by Vertex::computeCentroid()
 
-         Vector3D normal( void ) const;
+         Vertex( void ) : _normalValid( false ), _normalQueued( false ) {}
+
+         /**
+          * Get a unit vertex normal.  Like Face::normal(), the value is cached,
+          * and only recomputed after it has been marked as out of date.
+          */
+         Vector3D normal( void ) const
+         {
+            if( !_normalValid )
+            {
+               _normal = computeNormal();
+               _normalValid = true;
+            }
+            return _normal;
+         }
+
+         /**
+          * Computes the unit vertex normal from the normals of the surrounding
+          * faces, bypassing (and not updating) the cached value.
+          */
+         Vector3D computeNormal( void ) const;
+
 
          /**
           * Check if if this vertex is on the boundary of the surface
@@ -448,7 +645,7 @@ namespace CGL
          bool isBoundary( void ) const
          {
             // iterate over the halfedges incident on this vertex
-            HalfedgeIter h = _halfedge;
+            HalfedgeCIter h = halfedge();
             do
             {
                // check if the current halfedge is on the boundary
@@ -460,7 +657,7 @@ namespace CGL
                // move to the next halfedge around the vertex
                h = h->twin()->next();
             }
-            while( h != _halfedge ); // done iterating over halfedges
+            while( h != halfedge() ); // done iterating over halfedges
 
             return false;
          }
@@ -473,7 +670,7 @@ namespace CGL
             Size d = 0; // degree
 
             // iterate over halfedges incident on this vertex
-            HalfedgeIter h = _halfedge;
+            HalfedgeCIter h = halfedge();
             do
             {
                // don't count boundary loops
@@ -485,7 +682,7 @@ namespace CGL
                // move to the next halfedge around the vertex
                h = h->twin()->next();
             }
-            while( h != _halfedge ); // done iterating over halfedges
+            while( h != halfedge() ); // done iterating over halfedges
 
             return d;
          }
@@ -493,22 +690,49 @@ namespace CGL
         Matrix4x4 quadric;
 
       protected:
+         friend class HalfedgeMesh;
+
+         /**
+          * Marks the cached normal as out of date (see HalfedgeMesh::invalidateNormals()).
+          */
+         void invalidateNormal( void ) const { _normalValid = false; }
+
+#ifdef HALFEDGE_INDEXED_STORAGE
+         uint32_t _halfedge = none; ///< one of the halfedges "rooted" or "based" at this vertex
+#else
          HalfedgeIter _halfedge; ///< one of the halfedges "rooted" or "based" at this vertex
+#endif
+         mutable bool _normalValid; ///< whether _normal is up to date
+         mutable bool _normalQueued; ///< whether this vertex is on the stale list of its mesh (see HalfedgeMesh::updateNormals())
+         mutable Vector3D _normal;  ///< cached value of normal()
    };
 
    class Edge : public HalfedgeElement
    {
+      protected:
+         // Declared ahead of the public members, so that it shares a word with isNew.
+#ifdef HALFEDGE_INDEXED_STORAGE
+         uint32_t _halfedge = none; ///< one of the two halfedges associated with this edge
+#else
+         HalfedgeIter _halfedge; ///< one of the two halfedges associated with this edge
+#endif
+
       public:
 
+#ifdef HALFEDGE_INDEXED_STORAGE
+         HalfedgeRef    halfedge( void );
+         HalfedgeCIter  halfedge( void ) const;
+#else
          /**
           * returns one of the two halfedges of this vertex (reference)
           */
-         HalfedgeIter&  halfedge( void )       { return _halfedge; }
+         HalfedgeRef    halfedge( void )       { return _halfedge; }
 
          /**
           * returns one of the two halfedges of this vertex
           */
          HalfedgeCIter  halfedge( void ) const { return _halfedge; }
+#endif
 
          bool isBoundary( void ) const;
 
@@ -520,13 +744,10 @@ namespace CGL
             return ( p1 - p0 ).norm();
          }
 
-         Vector3D newPosition; ///< For Loop subdivision, this will be the position for the edge midpoint
          bool isNew; ///< For Loop subdivision, this flag should be true if and only if this edge is a new edge created by subdivision (i.e., if it cuts across a triangle in the original mesh)
+         Vector3D newPosition; ///< For Loop subdivision, this will be the position for the edge midpoint
 
          EdgeRecord record;
-
-      protected:
-         HalfedgeIter _halfedge; ///< one of the two halfedges associated with this edge
    };
 
    class HalfedgeMesh
@@ -536,7 +757,7 @@ namespace CGL
          /**
           * Constructor.
           */
-         HalfedgeMesh( void ) {}
+         HalfedgeMesh( void ) : allNormalsStale( true ) { setContext(); }
 
          /**
           * The assignment operator does a "deep" copy of the halfedge mesh data structure; in
@@ -561,6 +782,100 @@ namespace CGL
           */
          void build( const vector< vector<Index> >& polygons, const vector<Vector3D>& vertexPositions );
 
+         /**
+          * Lower-level version of build() for callers that already know exactly how the
+          * halfedges of the new mesh are connected (e.g., subdivision schemes); no sanity
+          * checks are performed.  Face n consists of the halfedges faceStart[n], ...,
+          * faceStart[n+1]-1 in cyclic order, halfedge k leaves vertex tail[k], and twin[k]
+          * is the index of the opposite halfedge, or (Index)-1 if halfedge k lies on the
+          * boundary.  Every vertex 0, ..., vertexPositions.size()-1 must be used by some
+          * face.  Boundary loops are created automatically, and each vertex's id() is set
+          * to its index.
+          */
+         void buildFromConnectivity( const vector<Index>& faceStart, const vector<Index>& tail,
+                                     const vector<Index>& twin, const vector<Vector3D>& vertexPositions );
+
+         /**
+          * Timing information about the most recent call to build().
+          */
+         struct BuildStats
+         {
+            BuildStats( void ) : nFaces( 0 ), nHalfedges( 0 ), seconds( 0. ) {}
+
+            Size nFaces;     ///< number of polygons in the input
+            Size nHalfedges; ///< number of halfedges created, including boundary halfedges
+            double seconds;  ///< wall-clock time spent in build()
+
+            double facesPerSecond( void ) const { return seconds > 0. ? (double) nFaces / seconds : 0.; }
+         };
+         const BuildStats& buildStats( void ) const { return _buildStats; }
+
+         /**
+          * Pre-allocates storage for the given number of elements of each type, so that
+          * subsequent calls to newVertex(), newEdge(), etc. do not need to grow the
+          * underlying arrays.  (This is a no-op for the default, list-based storage.)
+          */
+         void reserve( Size nVertices, Size nEdges, Size nFaces, Size nHalfedges )
+         {
+#ifdef HALFEDGE_INDEXED_STORAGE
+            vertices.reserve( nVertices );
+            edges.reserve( nEdges );
+            faces.reserve( nFaces );
+            halfedges.reserve( nHalfedges );
+#endif
+         }
+
+         /**
+          * Assigns each element a dense index (see HalfedgeElement::id()), numbering
+          * the vertices, edges, faces and halfedges 0, 1, 2, ... in iteration order.
+          * Boundary loops are numbered after the faces, starting at nFaces().  This
+          * method only writes the ids, so it may be called on a const mesh.
+          */
+         void enumerate( void ) const;
+
+         /**
+          * Gives a single face the given id, e.g., to number a face created since
+          * the last call to enumerate() without renumbering the rest of the mesh.
+          */
+         void enumerate( FaceCIter f, Index id ) const;
+
+         /**
+          * Marks the cached normals of all faces, boundary loops and vertices
+          * as out of date, e.g., after moving many vertices at once.
+          */
+         void invalidateNormals( void ) const;
+
+         /**
+          * Marks every cached normal that depends on the position of the given
+          * vertex as out of date: those of the faces and boundary loops around
+          * it, and of the vertices of those faces and loops.  Call this after
+          * moving the vertex, or after changing the connectivity around it.
+          * (For a vertex on the boundary, this costs as much as the length of
+          * its boundary loop.)
+          */
+         void invalidateNormals( VertexCIter v ) const;
+
+         /**
+          * Recomputes the cached normals that were marked out of date, in
+          * parallel: first the face normals, then the vertex normals built
+          * from them.  Afterwards normal() is a plain read for every element
+          * of the mesh, so it is safe to call from several threads.
+          *
+          * The elements marked by invalidateNormals( v ) are kept on a list,
+          * so after a local edit this only costs as much as the edit touched.
+          * After invalidateNormals(), build() or a copy, or once an element
+          * on the list has been deleted, it scans the whole mesh instead.
+          */
+         void updateNormals( void ) const;
+
+         /**
+          * Exchanges a vertex (face) of this mesh with a saved copy of it, as
+          * MeshJournal does to undo and redo edits.  Whether the element is on
+          * the list of stale normals stays with the element in the mesh.
+          */
+         void exchange( VertexIter v, Vertex& saved );
+         void exchange(   FaceIter f,   Face& saved );
+
          // These methods return the total number of elements of each type.
          Size nHalfedges  ( void ) const { return  halfedges.size(); } ///< get the number of halfedges
          Size nVertices   ( void ) const { return   vertices.size(); } ///< get the number of vertices
@@ -597,6 +912,15 @@ namespace CGL
          FaceIter     boundariesBegin ( void ) { return boundaries.begin(); } FaceCIter     boundariesBegin ( void ) const { return boundaries.begin(); }
          FaceIter     boundariesEnd   ( void ) { return boundaries.end();   } FaceCIter     boundariesEnd   ( void ) const { return boundaries.end();   }
 
+         /**
+          * Returns the edge of this mesh that the given record was made for.
+          */
+#ifdef HALFEDGE_INDEXED_STORAGE
+         EdgeIter     edgeOf( const EdgeRecord& r ) { return EdgeIter( &edges, r.edge ); }
+#else
+         EdgeIter     edgeOf( const EdgeRecord& r ) { return r.edge; }
+#endif
+
          /*
           * These methods allocate new mesh elements, returning a pointer (i.e., iterator) to the new element.
           * (These methods cannot have const versions, because they modify the mesh!)
@@ -617,10 +941,31 @@ namespace CGL
           * able to iterate to the next element?  Etc.
           */
          void deleteHalfedge ( HalfedgeIter h ) {  halfedges.erase( h ); }
-         void deleteVertex   (   VertexIter v ) {   vertices.erase( v ); }
+         void deleteVertex   (   VertexIter v ) { forgetNormal( v );   vertices.erase( v ); }
          void deleteEdge     (     EdgeIter e ) {      edges.erase( e ); }
-         void deleteFace     (     FaceIter f ) {      faces.erase( f ); }
-         void deleteBoundary (     FaceIter b ) { boundaries.erase( b ); }
+         void deleteFace     (     FaceIter f ) { forgetNormal( f );      faces.erase( f ); }
+         void deleteBoundary (     FaceIter b ) { forgetNormal( b ); boundaries.erase( b ); }
+
+         /*
+          * These methods take an element out of the mesh without destroying it, so that creating it can
+          * be undone and redone (see MeshJournal).  A detached element no longer shows up when iterating
+          * over the mesh, and is not counted by nHalfedges(), etc., but iterators to it stay valid until
+          * it is put back with attach() or destroyed with discard().  (A face is detached from the list
+          * of faces or of boundaries, according to isBoundary().)  Detached elements are neither copied
+          * nor cleared along with the mesh, so they must all be discarded before it is rebuilt or assigned to.
+          */
+         void detach  ( HalfedgeIter h ) { detachElement (  halfedges,  detachedHalfedges, h ); }
+         void detach  (   VertexIter v ) { forgetNormal( v ); detachElement (   vertices,   detachedVertices, v ); }
+         void detach  (     EdgeIter e ) { detachElement (      edges,      detachedEdges, e ); }
+         void detach  (     FaceIter f ) { forgetNormal( f ); detachElement ( f->isBoundary() ? boundaries : faces, detachedFaces, f ); }
+         void attach  ( HalfedgeIter h ) { attachElement (  halfedges,  detachedHalfedges, h ); }
+         void attach  (   VertexIter v ) { attachElement (   vertices,   detachedVertices, v ); }
+         void attach  (     EdgeIter e ) { attachElement (      edges,      detachedEdges, e ); }
+         void attach  (     FaceIter f ) { attachElement ( f->isBoundary() ? boundaries : faces, detachedFaces, f ); }
+         void discard ( HalfedgeIter h ) { discardElement(  halfedges,  detachedHalfedges, h ); }
+         void discard (   VertexIter v ) { discardElement(   vertices,   detachedVertices, v ); }
+         void discard (     EdgeIter e ) { discardElement(      edges,      detachedEdges, e ); }
+         void discard (     FaceIter f ) { discardElement( f->isBoundary() ? boundaries : faces, detachedFaces, f ); }
 
          /* For a triangle mesh, you will implement the following
           * basic edge operations.  (Can you generalize to other
@@ -628,6 +973,7 @@ namespace CGL
           */
            EdgeIter       flipEdge( EdgeIter e ); ///< flip an edge, returning a pointer to the flipped edge
          VertexIter      splitEdge( EdgeIter e ); ///< split an edge, returning a pointer to the inserted midpoint vertex; the halfedge of this vertex should refer to one of the edges in the original mesh
+         VertexIter   collapseEdge( EdgeIter e ); ///< collapse an edge to a single vertex, returning a pointer to that vertex, or verticesEnd() if the collapse would make the surface nonmanifold (in which case the mesh is unchanged)
 
 
          void check_for(HalfedgeIter h) {
@@ -681,16 +1027,106 @@ if (f->halfedge() == h)
             }
          }
       protected:
+         friend class Halfedge;
+         friend class Vertex;
+         friend class Edge;
+         friend class Face;
+
+         /**
+          * With indexed storage, records this mesh in each element of its
+          * arrays, which is how the elements find the arrays their indices point
+          * into (see elementArray.h).
+          */
+         void setContext( void )
+         {
+#ifdef HALFEDGE_INDEXED_STORAGE
+            halfedges.setContext( this );
+            vertices.setContext( this );
+            edges.setContext( this );
+            faces.setContext( this );
+            boundaries.setContext( this );
+#endif
+         }
 
          /**
           * Here's where the mesh elements are actually stored---this is the one
           * and only place we have actual data (rather than pointers/iterators).
           */
-         list<Halfedge> halfedges;
-         list<Vertex> vertices;
-         list<Edge> edges;
-         list<Face> faces;
-         list<Face> boundaries;
+         ElementList<Halfedge> halfedges;
+         ElementList<Vertex> vertices;
+         ElementList<Edge> edges;
+         ElementList<Face> faces;
+         ElementList<Face> boundaries;
+
+         BuildStats _buildStats; ///< statistics for the last call to build()
+
+         /**
+          * The faces and vertices whose normals invalidateNormals( v ) marked as out
+          * of date since the last updateNormals(), each listed once (see _normalQueued),
+          * unless allNormalsStale is set: then the lists are empty, and updateNormals()
+          * looks at every element instead.
+          */
+         mutable vector<FaceCIter> staleFaces;
+         mutable vector<VertexCIter> staleVertices;
+         mutable bool allNormalsStale;
+
+         // Marks the normal of a single element as out of date, and lists it.
+         void invalidateNormal(   FaceCIter f ) const;
+         void invalidateNormal( VertexCIter v ) const;
+
+         // Gives up the stale lists (see allNormalsStale).
+         void dropStaleNormals( void ) const;
+
+         /**
+          * Must be called before an element is destroyed or detached, so that the
+          * stale lists never refer to it.  Elements are not taken off the lists
+          * one by one, which would mean searching them; the lists are given up
+          * instead, which is rare (and costs one scan of the mesh) in practice.
+          */
+         template<class Iter>
+         void forgetNormal( Iter i ) const
+         {
+            if( i->_normalQueued ) dropStaleNormals();
+         }
+
+         /**
+          * Detached elements (see detach()).  With indexed storage they simply stay in
+          * their (dead) slots, so these lists are only used by list-based storage.
+          */
+         ElementList<Halfedge> detachedHalfedges;
+         ElementList<Vertex> detachedVertices;
+         ElementList<Edge> detachedEdges;
+         ElementList<Face> detachedFaces;
+
+         template<class T>
+         static void detachElement( ElementList<T>& elements, ElementList<T>& detached, typename ElementList<T>::iterator i )
+         {
+#ifdef HALFEDGE_INDEXED_STORAGE
+            elements.detach( i );
+#else
+            detached.splice( detached.end(), elements, i );
+#endif
+         }
+
+         template<class T>
+         static void attachElement( ElementList<T>& elements, ElementList<T>& detached, typename ElementList<T>::iterator i )
+         {
+#ifdef HALFEDGE_INDEXED_STORAGE
+            elements.attach( i );
+#else
+            elements.splice( elements.end(), detached, i );
+#endif
+         }
+
+         template<class T>
+         static void discardElement( ElementList<T>& elements, ElementList<T>& detached, typename ElementList<T>::iterator i )
+         {
+#ifdef HALFEDGE_INDEXED_STORAGE
+            elements.discard( i );
+#else
+            detached.erase( i );
+#endif
+         }
 
    }; // class HalfedgeMesh
 
@@ -699,6 +1135,37 @@ if (f->halfedge() == h)
    inline Edge*     HalfedgeElement::getEdge    ( void ) { return dynamic_cast    <Edge*>( this ); }
    inline Face*     HalfedgeElement::getFace    ( void ) { return dynamic_cast    <Face*>( this ); }
 
+#ifdef HALFEDGE_INDEXED_STORAGE
+   /*
+    * With indexed storage, the accessors resolve the stored slot indices
+    * through the arrays of the mesh that owns the element.
+    */
+   inline HalfedgeRef   Halfedge::twin  ( void ) { return HalfedgeRef( _twin,   &owner( this )->halfedges ); }
+   inline HalfedgeRef   Halfedge::next  ( void ) { return HalfedgeRef( _next,   &owner( this )->halfedges ); }
+   inline VertexRef     Halfedge::vertex( void ) { return   VertexRef( _vertex, &owner( this )->vertices  ); }
+   inline EdgeRef       Halfedge::edge  ( void ) { return     EdgeRef( _edge,   &owner( this )->edges     ); }
+   inline FaceRef       Halfedge::face  ( void ) { HalfedgeMesh* m = owner( this ); return FaceRef( _face, &m->faces, &m->boundaries ); }
+
+   inline HalfedgeCIter Halfedge::twin  ( void ) const { return HalfedgeCIter( &owner( this )->halfedges, _twin   ); }
+   inline HalfedgeCIter Halfedge::next  ( void ) const { return HalfedgeCIter( &owner( this )->halfedges, _next   ); }
+   inline VertexCIter   Halfedge::vertex( void ) const { return   VertexCIter( &owner( this )->vertices,  _vertex ); }
+   inline EdgeCIter     Halfedge::edge  ( void ) const { return     EdgeCIter( &owner( this )->edges,     _edge   ); }
+   inline FaceCIter     Halfedge::face  ( void ) const
+   {
+      const HalfedgeMesh* m = owner( this );
+      return FaceRef::decode( _face, &m->faces, &m->boundaries );
+   }
+
+   inline uint32_t Halfedge::link( FaceIter f ) const { return FaceRef::encode( f, &owner( this )->boundaries ); }
+
+   inline HalfedgeRef   Vertex::halfedge( void )       { return HalfedgeRef( _halfedge, &owner( this )->halfedges ); }
+   inline HalfedgeCIter Vertex::halfedge( void ) const { return HalfedgeCIter( &owner( this )->halfedges, _halfedge ); }
+   inline HalfedgeRef     Edge::halfedge( void )       { return HalfedgeRef( _halfedge, &owner( this )->halfedges ); }
+   inline HalfedgeCIter   Edge::halfedge( void ) const { return HalfedgeCIter( &owner( this )->halfedges, _halfedge ); }
+   inline HalfedgeRef     Face::halfedge( void )       { return HalfedgeRef( _halfedge, &owner( this )->halfedges ); }
+   inline HalfedgeCIter   Face::halfedge( void ) const { return HalfedgeCIter( &owner( this )->halfedges, _halfedge ); }
+#endif
+
 } // End of CMU 462 namespace.
 
 #endif // CGL_HALFEDGEMESH_H
@@ -0,0 +1,243 @@
+#include "loopStencil.h"
+#include "student_code.h"
+
+using namespace std;
+
+namespace CGL {
+
+  // A sparse matrix in compressed sparse row format (see LoopStencil).
+  struct SparseRows {
+    vector<Index> rowStart;
+    vector<Index> column;
+    vector<double> weight;
+  };
+
+  // Records the stencil of a single level of Loop subdivision of the given mesh, in the
+  // numbering used by MeshResampler::upsampleParallel(): columns are the coarse vertex ids
+  // assigned by enumerate(), row i < nV is the new position of coarse vertex i, and row
+  // nV + j is the new vertex on coarse edge j. The weights follow averagePosition() and
+  // newVerticesPosition() exactly.
+  static void levelStencil(HalfedgeMesh& mesh, SparseRows& S) {
+    mesh.enumerate();
+    Size nV = mesh.nVertices();
+    Size nE = mesh.nEdges();
+
+    vector<VertexIter> vertices; vertices.reserve(nV);
+    vector<EdgeIter> edges; edges.reserve(nE);
+    for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) vertices.push_back(v);
+    for (EdgeIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) edges.push_back(e);
+
+    // Each old vertex depends on itself and its neighbors; each edge vertex on four vertices.
+    S.rowStart.resize(nV + nE + 1);
+    S.rowStart[0] = 0;
+    for (Index i = 0; i < nV; i++) {
+        // Like averagePosition(), count every outgoing halfedge (including those on the
+        // boundary, unlike Vertex::degree()).
+        Size n = 0;
+        HalfedgeIter h = vertices[i] -> halfedge();
+        do {
+            n++;
+            h = h -> twin() -> next();
+        } while (h != vertices[i] -> halfedge());
+        S.rowStart[i + 1] = S.rowStart[i] + n + 1;
+    }
+    for (Index j = 0; j < nE; j++) {
+        S.rowStart[nV + j + 1] = S.rowStart[nV + j] + 4;
+    }
+    S.column.resize(S.rowStart.back());
+    S.weight.resize(S.rowStart.back());
+
+    #pragma omp parallel for
+    for (long i = 0; i < (long) nV; i++) {
+        VertexIter v = vertices[i];
+        Index k = S.rowStart[i];
+        Size n = S.rowStart[i + 1] - k - 1;
+        float u = MeshResampler::vertexNeighborWeight(n);
+
+        S.column[k] = v -> id();
+        S.weight[k] = 1 - u * (float) n;
+        k++;
+
+        HalfedgeIter h = v -> halfedge();
+        do {
+            S.column[k] = h -> twin() -> vertex() -> id();
+            S.weight[k] = u;
+            k++;
+            h = h -> twin() -> next();
+        } while (h != v -> halfedge());
+    }
+
+    #pragma omp parallel for
+    for (long j = 0; j < (long) nE; j++) {
+        HalfedgeIter h = edges[j] -> halfedge();
+        Index k = S.rowStart[nV + j];
+        S.column[k + 0] = h -> vertex() -> id();
+        S.column[k + 1] = h -> twin() -> vertex() -> id();
+        S.column[k + 2] = h -> next() -> next() -> vertex() -> id();
+        S.column[k + 3] = h -> twin() -> next() -> next() -> vertex() -> id();
+        S.weight[k + 0] = MeshResampler::edgeNearWeight();
+        S.weight[k + 1] = MeshResampler::edgeNearWeight();
+        S.weight[k + 2] = MeshResampler::edgeFarWeight();
+        S.weight[k + 3] = MeshResampler::edgeFarWeight();
+    }
+  }
+
+  // Computes C = A * B, where column c of A refers to row map[c] of B, and B has nCols
+  // columns. Rows are independent, so each thread accumulates its rows in its own dense
+  // scratch arrays; a first pass counts the entries of each row, a second fills them in.
+  static void multiply(const SparseRows& A, const vector<Index>& map, const SparseRows& B, Size nCols, SparseRows& C) {
+    const Index none = (Index) -1;
+    Size nRows = A.rowStart.size() - 1;
+
+    C.rowStart.assign(nRows + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            for (Index i = 0; i < nRows; i++) C.rowStart[i + 1] += C.rowStart[i];
+            C.column.resize(C.rowStart.back());
+            C.weight.resize(C.rowStart.back());
+        }
+
+        #pragma omp parallel
+        {
+            vector<Index> slot(nCols, none); // position of each column in the current row
+            vector<Index> used;
+
+            #pragma omp for
+            for (long i = 0; i < (long) nRows; i++) {
+                Index start = (pass == 1) ? C.rowStart[i] : 0;
+                used.clear();
+                for (Index a = A.rowStart[i]; a < A.rowStart[i + 1]; a++) {
+                    Index r = map[A.column[a]];
+                    for (Index b = B.rowStart[r]; b < B.rowStart[r + 1]; b++) {
+                        Index c = B.column[b];
+                        if (slot[c] == none) {
+                            slot[c] = used.size();
+                            used.push_back(c);
+                            if (pass == 1) {
+                                C.column[start + slot[c]] = c;
+                                C.weight[start + slot[c]] = 0.;
+                            }
+                        }
+                        if (pass == 1) C.weight[start + slot[c]] += A.weight[a] * B.weight[b];
+                    }
+                }
+                if (pass == 0) C.rowStart[i + 1] = used.size();
+                for (Index u = 0; u < used.size(); u++) slot[used[u]] = none;
+            }
+        }
+    }
+  }
+
+  void LoopStencil::build(HalfedgeMesh& mesh, int levels) {
+    MeshResampler resampler;
+    nCoarse = mesh.nVertices();
+
+    // The row bookkeeping below relies on the numbering of upsampleParallel(), which
+    // only refines triangle meshes directly.
+    for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+        if (f -> degree() != 3) {
+            cerr << "LoopStencil::build: the mesh must consist of triangles only" << endl;
+            levels = 0;
+            break;
+        }
+    }
+
+    // The stencil so far, from the coarse vertices (in iteration order) to the vertices of
+    // the current mesh, with rows listed by vertex id() as set by upsampleParallel().
+    // Initially this is the identity, which we do not store explicitly.
+    SparseRows total;
+    bool identity = true;
+
+    for (int level = 0; level < levels; level++) {
+        // Remember which row of the total stencil each vertex corresponds to, before
+        // levelStencil() renumbers the vertices.
+        vector<Index> row;
+        row.reserve(mesh.nVertices());
+        for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+            row.push_back(identity ? row.size() : v -> id());
+        }
+
+        SparseRows S;
+        levelStencil(mesh, S);
+        if (identity) {
+            total.rowStart.swap(S.rowStart);
+            total.column.swap(S.column);
+            total.weight.swap(S.weight);
+            identity = false;
+        } else {
+            SparseRows product;
+            multiply(S, row, total, nCoarse, product);
+            total.rowStart.swap(product.rowStart);
+            total.column.swap(product.column);
+            total.weight.swap(product.weight);
+        }
+
+        resampler.upsampleParallel(mesh);
+    }
+
+    // Finally, list the rows in the iteration order of the fine mesh.
+    Size nFine = mesh.nVertices();
+    vector<Index> row;
+    row.reserve(nFine);
+    for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+        row.push_back(identity ? row.size() : v -> id());
+    }
+
+    rowStart.resize(nFine + 1);
+    rowStart[0] = 0;
+    for (Index i = 0; i < nFine; i++) {
+        rowStart[i + 1] = rowStart[i] + (identity ? 1 : total.rowStart[row[i] + 1] - total.rowStart[row[i]]);
+    }
+    column.resize(rowStart.back());
+    weight.resize(rowStart.back());
+
+    #pragma omp parallel for
+    for (long i = 0; i < (long) nFine; i++) {
+        if (identity) {
+            column[i] = i;
+            weight[i] = 1.;
+            continue;
+        }
+        copy(total.column.begin() + total.rowStart[row[i]], total.column.begin() + total.rowStart[row[i] + 1], column.begin() + rowStart[i]);
+        copy(total.weight.begin() + total.rowStart[row[i]], total.weight.begin() + total.rowStart[row[i] + 1], weight.begin() + rowStart[i]);
+    }
+  }
+
+  void LoopStencil::evaluate(const vector<Vector3D>& coarse, vector<Vector3D>& fine) const {
+    if (coarse.size() != nCoarse) {
+        cerr << "LoopStencil::evaluate: expected " << nCoarse << " coarse positions, got " << coarse.size() << endl;
+        fine.clear();
+        return;
+    }
+
+    Size nFine = nFineVertices();
+    fine.resize(nFine);
+
+    #pragma omp parallel for
+    for (long i = 0; i < (long) nFine; i++) {
+        Vector3D p(0., 0., 0.);
+        for (Index k = rowStart[i]; k < rowStart[i + 1]; k++) {
+            p += weight[k] * coarse[column[k]];
+        }
+        fine[i] = p;
+    }
+  }
+
+  void LoopStencil::apply(const vector<Vector3D>& coarse, HalfedgeMesh& fine) const {
+    if (fine.nVertices() != nFineVertices()) {
+        cerr << "LoopStencil::apply: mesh has " << fine.nVertices() << " vertices, stencil has " << nFineVertices() << endl;
+        return;
+    }
+
+    vector<Vector3D> positions;
+    evaluate(coarse, positions);
+    if (positions.size() != nFineVertices()) return;
+
+    Index i = 0;
+    for (VertexIter v = fine.verticesBegin(); v != fine.verticesEnd(); v++) {
+        v -> position = positions[i++];
+    }
+    fine.invalidateNormals();
+  }
+
+}
@@ -0,0 +1,63 @@
+#ifndef CGL_LOOPSTENCIL_H
+#define CGL_LOOPSTENCIL_H
+
+#include "halfEdgeMesh.h"
+
+namespace CGL {
+
+  /**
+   * A LoopStencil records how the vertices of a mesh subdivided N times with
+   * Loop subdivision depend on the vertices of the original (coarse) mesh.
+   * Every fine vertex is a fixed linear combination of a handful of coarse
+   * vertices, so once the connectivity has been refined, new fine positions
+   * can be computed from new coarse positions with a single sparse
+   * matrix-vector product instead of rebuilding the topology, e.g., when
+   * animating the vertices of a fixed coarse cage.
+   *
+   * The weights come from the same rules as MeshResampler::upsample(), and
+   * the fine connectivity from MeshResampler::upsampleParallel().  Coarse and
+   * fine vertices are numbered in mesh iteration order (verticesBegin() to
+   * verticesEnd()).
+   */
+  class LoopStencil {
+  public:
+
+    LoopStencil() : nCoarse(0) {}
+
+    /**
+     * Subdivides the given triangle mesh in place the given number of times
+     * and records the stencil from its original vertices to its final
+     * vertices.
+     */
+    void build(HalfedgeMesh& mesh, int levels);
+
+    /**
+     * Computes fine vertex positions from the given coarse vertex positions.
+     * coarse must have nCoarseVertices() entries; fine is resized to
+     * nFineVertices() entries.
+     */
+    void evaluate(const std::vector<Vector3D>& coarse, std::vector<Vector3D>& fine) const;
+
+    /**
+     * Same as evaluate(), but writes the result straight into the vertices
+     * of the subdivided mesh returned by build().
+     */
+    void apply(const std::vector<Vector3D>& coarse, HalfedgeMesh& fine) const;
+
+    Size nCoarseVertices() const { return nCoarse; }
+    Size nFineVertices() const { return rowStart.empty() ? 0 : rowStart.size() - 1; }
+    Size nWeights() const { return weight.size(); } ///< number of nonzero stencil entries
+
+  private:
+
+    // Stencil matrix in compressed sparse row format: fine vertex i is the sum
+    // of weight[k] * coarse[column[k]] for k in [rowStart[i], rowStart[i+1]).
+    Size nCoarse;
+    std::vector<Index> rowStart;
+    std::vector<Index> column;
+    std::vector<double> weight;
+  };
+
+}
+
+#endif // CGL_LOOPSTENCIL_H
@@ -5,47 +5,64 @@
 #include "bezierPatch.h"
 #include "bezierCurve.h"
 #include "mergeVertices.h"
+#include "meshCache.h"
 #include "shaderUtils.h"
 
+#include "CGL/timer.h"
+
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
 
 using namespace std;
 using namespace CGL;
 
 #define msg(s) cerr << "[Collada Viewer] " << s << endl;
 
-int loadFile(MeshEdit* collada_viewer, const char* path) {
-
-  Scene* scene = new Scene();
+// Loads a .dae or .bez file into the given scene.  Bezier patches are
+// tessellated to within the given distance of the surface, or with a fixed
+// grid if it is zero.  A .dae file is loaded from its cache when that is up
+// to date (setting fromCache), and otherwise parsed and then cached.
+int loadScene(Scene* scene, const char* path, double tolerance = 0., bool* fromCache = NULL) {
 
   std::string path_str = path;
+  if (path_str.length() < 4) return -1;
+
   if (path_str.substr(path_str.length()-4, 4) == ".dae")
   {
-    if (ColladaParser::load(path, scene) < 0) {
-      delete scene;
-      return -1;
+    bool cached = loadMeshCache(path, scene);
+    if (fromCache) *fromCache = cached;
+
+    if (!cached) {
+      if (ColladaParser::load(path, scene) < 0) {
+        return -1;
+      }
+      if (!writeMeshCache(path, *scene)) {
+        msg("Could not write the mesh cache " << meshCachePath(path));
+      }
     }
   }
   else if (path_str.substr(path_str.length()-4, 4) == ".bez")
   {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+
+    vector<BezierPatch> patches;
+    bool loaded = BezierPatch::loadPatches(file, patches);
+    fclose(file);
+    if (!loaded) return -1;
+
     Camera* cam = new Camera();
     cam->type = CAMERA;
     Node node;
     node.instance = cam;
+    node.transform = Matrix4x4::identity();
     scene->nodes.push_back(node);
     Polymesh* mesh = new Polymesh();
 
-    FILE* file = fopen(path, "r");
-    int n = 0;
-    fscanf(file, "%d", &n);
-    for (int i = 0; i < n; i++)
-    {
-      BezierPatch patch;
-      patch.loadControlPoints(file);
-      patch.add2mesh(mesh);
-      mergeVertices(mesh);
-    }
-    fclose(file);
+    // All the patches are tessellated at once, and welded together once.
+    BezierPatch::add2mesh(patches, mesh, tolerance);
 
     mesh->type = POLYMESH;
     node.instance = mesh;
@@ -56,6 +73,18 @@ int loadFile(MeshEdit* collada_viewer, const char* path) {
     return -1;
   }
 
+  return 0;
+}
+
+int loadFile(MeshEdit* collada_viewer, const char* path) {
+
+  Scene* scene = new Scene();
+
+  if (loadScene(scene, path) < 0) {
+    delete scene;
+    return -1;
+  }
+
   collada_viewer->load( scene );
 
   GLuint tex = makeTex("envmap/envmap.png");
@@ -67,8 +96,293 @@ int loadFile(MeshEdit* collada_viewer, const char* path) {
   return 0;
 }
 
+//////////////////////////////////
+// Headless batch-mode code     //
+//////////////////////////////////
+
+// A mesh of the scene being processed in batch mode. Operations on the
+// connectivity need the halfedge mesh, while merging vertices and saving work
+// on the polygon list; each is rebuilt from the other only when needed.
+struct BatchMesh {
+  Polymesh* polymesh;
+  HalfedgeMesh mesh;
+  bool polymeshCurrent; // polymesh reflects the latest operation
+  bool meshCurrent;     // mesh reflects the latest operation
+};
+
+// Copies the connectivity and vertex positions of a halfedge mesh back into
+// a polygon list, numbering vertices and faces in iteration order.
+void writePolymesh(const HalfedgeMesh& mesh, Polymesh& polymesh) {
+
+  mesh.enumerate();
+
+  polymesh.vertices.resize(mesh.nVertices());
+  for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+    polymesh.vertices[v->id()] = v->position;
+  }
+
+  polymesh.normals.clear();
+  polymesh.texcoords.clear();
+  polymesh.halfedge_twins.clear();
+  polymesh.polygons.resize(mesh.nFaces());
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+    Polygon& polygon = polymesh.polygons[f->id()];
+    polygon.vertex_indices.clear();
+    polygon.normal_indices.clear();
+    polygon.texcoord_indices.clear();
+
+    HalfedgeCIter h = f->halfedge();
+    do {
+      polygon.vertex_indices.push_back(h->vertex()->id());
+      h = h->next();
+    } while (h != f->halfedge());
+  }
+}
+
+void batchUsage() {
+  cerr << "Usage: ./meshedit --batch [-o <output.dae>] [-t <tolerance>] <input.dae|input.bez> [operation ...]" << endl
+       << "Applies each operation, in order, to every mesh in the input, and prints how long each stage took." << endl
+       << "Bezier patches are tessellated adaptively to within the given distance, if any (otherwise 16 x 16 each)." << endl
+       << "Operations:" << endl
+       << "  upsample[=N]    Loop-subdivide N times (default 1)" << endl
+       << "  downsample=F    simplify to at most F faces" << endl
+       << "  flip=I          flip edge I" << endl
+       << "  split=I         split edge I" << endl
+       << "  merge           weld coincident vertices" << endl
+       << "Edges are numbered in iteration order, as by HalfedgeMesh::enumerate()." << endl;
+}
+
+void printStage(const string& stage, size_t m, double seconds, const BatchMesh& batch) {
+  cout << "[Batch] " << left << setw(18) << stage << " mesh " << m << ": "
+       << fixed << setprecision(6) << seconds << "s, ";
+  if (batch.meshCurrent) {
+    cout << batch.mesh.nVertices() << " vertices, " << batch.mesh.nEdges() << " edges, "
+         << batch.mesh.nFaces() << " faces" << endl;
+  } else {
+    cout << batch.polymesh->vertices.size() << " vertices, "
+         << batch.polymesh->polygons.size() << " faces" << endl;
+  }
+}
+
+// Brings the halfedge mesh up to date, timing the conversion as its own stage.
+void requireHalfedgeMesh(BatchMesh& batch, size_t m) {
+  if (batch.meshCurrent) return;
+
+  Timer timer;
+  timer.start();
+  buildHalfedgeMesh(*batch.polymesh, batch.mesh);
+  timer.stop();
+
+  batch.meshCurrent = true;
+  printStage("build", m, timer.duration(), batch);
+}
+
+// Brings the polygon list up to date, timing the conversion as its own stage.
+void requirePolymesh(BatchMesh& batch, size_t m) {
+  if (batch.polymeshCurrent) return;
+
+  Timer timer;
+  timer.start();
+  writePolymesh(batch.mesh, *batch.polymesh);
+  timer.stop();
+
+  batch.polymeshCurrent = true;
+  printStage("extract", m, timer.duration(), batch);
+}
+
+// Returns the edge with the given index in iteration order, or edgesEnd().
+EdgeIter edgeAt(HalfedgeMesh& mesh, size_t index) {
+  if (index >= mesh.nEdges()) return mesh.edgesEnd();
+
+  EdgeIter e = mesh.edgesBegin();
+  for (size_t i = 0; i < index; i++) e++;
+  return e;
+}
+
+int runBatch(int argc, char** argv) {
+
+  const char* output = NULL;
+  double tolerance = 0.;
+  int a = 0;
+  while (a + 1 < argc && (string(argv[a]) == "-o" || string(argv[a]) == "-t")) {
+    if (string(argv[a]) == "-o") {
+      output = argv[a + 1];
+    } else {
+      char* end;
+      tolerance = strtod(argv[a + 1], &end);
+      if (*end || tolerance < 0.) {
+        msg("Invalid tolerance: " << argv[a + 1]);
+        return 1;
+      }
+    }
+    a += 2;
+  }
+  if (a >= argc) {
+    batchUsage();
+    return 1;
+  }
+  const char* input = argv[a++];
+
+  // Check the whole script before doing any work.
+  vector<string> names;
+  vector<long> args;
+  for (; a < argc; a++) {
+    string op = argv[a];
+    string name = op.substr(0, op.find('='));
+    bool hasArg = op.find('=') != string::npos;
+    long arg = 1;
+    if (hasArg) {
+      char* end;
+      string value = op.substr(op.find('=') + 1);
+      arg = strtol(value.c_str(), &end, 10);
+      if (value.empty() || *end || arg < 0) {
+        msg("Invalid argument in operation: " << op);
+        return 1;
+      }
+    }
+
+    bool valid = name == "upsample" ||
+                 (name == "downsample" && hasArg) ||
+                 (name == "flip"       && hasArg) ||
+                 (name == "split"      && hasArg) ||
+                 (name == "merge"      && !hasArg);
+    if (!valid) {
+      msg("Unknown operation: " << op);
+      batchUsage();
+      return 1;
+    }
+    names.push_back(name);
+    args.push_back(arg);
+  }
+
+  Timer timer, total;
+  total.start();
+
+  Scene* scene = new Scene();
+  bool fromCache = false;
+  timer.start();
+  int loaded = loadScene(scene, input, tolerance, &fromCache);
+  timer.stop();
+  if (loaded < 0) {
+    msg("Could not load " << input);
+    return 1;
+  }
+
+  vector<BatchMesh> meshes;
+  for (size_t i = 0; i < scene->nodes.size(); i++) {
+    Instance* instance = scene->nodes[i].instance;
+    if (!instance || instance->type != POLYMESH) continue;
+
+    BatchMesh batch;
+    batch.polymesh = static_cast<Polymesh*>(instance);
+    batch.polymeshCurrent = true;
+    batch.meshCurrent = false;
+    meshes.push_back(batch);
+  }
+  if (meshes.empty()) {
+    msg("No meshes in " << input);
+    return 1;
+  }
+  for (size_t m = 0; m < meshes.size(); m++) {
+    printStage("load", m, m == 0 ? timer.duration() : 0., meshes[m]);
+  }
+
+  // Where the time of a COLLADA load went, and how fast its number arrays
+  // were scanned.
+  string input_str = input;
+  if (fromCache) {
+    cout << "[Batch] " << left << setw(18) << "cache" << " " << meshCachePath(input) << endl;
+  } else if (input_str.length() >= 4 && input_str.substr(input_str.length() - 4) == ".dae") {
+    const ColladaLoadStats& stats = ColladaParser::stats();
+    cout << "[Batch] " << left << setw(18) << "parse" << " " << input << ": "
+         << fixed << setprecision(2) << (double) stats.fileBytes / (1024. * 1024.) << " MB, "
+         << setprecision(6) << stats.xmlSeconds << "s XML, "
+         << stats.numberSeconds << "s numbers ("
+         << setprecision(2) << (double) stats.numberBytes / (1024. * 1024.) << " MB at "
+         << setprecision(1) << stats.numberMBps() << " MB/s)" << endl;
+  }
+
+  MeshResampler resampler;
+  for (size_t i = 0; i < names.size(); i++) {
+    stringstream stage;
+    stage << names[i];
+    if (names[i] != "merge") stage << "=" << args[i];
+
+    for (size_t m = 0; m < meshes.size(); m++) {
+      BatchMesh& batch = meshes[m];
+
+      if (names[i] == "merge") {
+        requirePolymesh(batch, m);
+        timer.start();
+        mergeVertices(batch.polymesh);
+        timer.stop();
+        batch.meshCurrent = false;
+        printStage(stage.str(), m, timer.duration(), batch);
+        continue;
+      }
+
+      requireHalfedgeMesh(batch, m);
+      HalfedgeMesh& mesh = batch.mesh;
+
+      if ((names[i] == "flip" || names[i] == "split") && edgeAt(mesh, args[i]) == mesh.edgesEnd()) {
+        msg("Mesh " << m << " has no edge " << args[i] << " (it has " << mesh.nEdges() << ")");
+        return 1;
+      }
+
+      timer.start();
+      if (names[i] == "upsample") {
+        for (long k = 0; k < args[i]; k++) resampler.upsampleParallel(mesh);
+      } else if (names[i] == "downsample") {
+        resampler.downsample(mesh, args[i]);
+      } else if (names[i] == "flip") {
+        mesh.flipEdge(edgeAt(mesh, args[i]));
+      } else if (names[i] == "split") {
+        mesh.splitEdge(edgeAt(mesh, args[i]));
+      }
+      timer.stop();
+
+      batch.polymeshCurrent = false;
+      printStage(stage.str(), m, timer.duration(), batch);
+    }
+  }
+
+  if (output) {
+    for (size_t m = 0; m < meshes.size(); m++) requirePolymesh(meshes[m], m);
+
+    timer.start();
+    int saved = ColladaParser::save(output, scene);
+    timer.stop();
+    if (saved < 0) {
+      msg("Could not write " << output);
+      return 1;
+    }
+    cout << "[Batch] " << left << setw(18) << "save" << " " << output << ": "
+         << fixed << setprecision(6) << timer.duration() << "s" << endl;
+  }
+
+  total.stop();
+  cout << "[Batch] " << left << setw(18) << "total" << " "
+       << fixed << setprecision(6) << total.duration() << "s" << endl;
+
+  return 0;
+}
+
 int main( int argc, char** argv ) {
 
+  ///////////////////////////////////////
+  // Batch mode (no window is created) //
+  ///////////////////////////////////////
+
+  if (argc >= 2 && string(argv[1]) == "--batch")
+  {
+    return runBatch(argc - 2, argv + 2);
+  }
+
+  if (argc < 2) {
+    msg("Usage: ./meshedit <path to scene file>");
+    msg("       ./meshedit --batch [-o <output.dae>] [-t <tolerance>] <input.dae|input.bez> [operation ...]"); exit(0);
+  }
+
   const char* path = argv[1];
   std::string path_str = path;
 
@@ -91,6 +405,7 @@ int main( int argc, char** argv ) {
     // Create viewer
     Viewer viewer = Viewer();
     viewer.set_renderer(&curve);
+    viewer.set_on_demand(true);
     viewer.init();
     viewer.start();
 
@@ -108,6 +423,9 @@ int main( int argc, char** argv ) {
   // set collada_viewer as renderer
   viewer.set_renderer(collada_viewer);
 
+  // only draw when something changes, rather than spinning while idle
+  viewer.set_on_demand(true);
+
   // init viewer
   viewer.init();
 
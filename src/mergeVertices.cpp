@@ -0,0 +1,237 @@
+#include "mergeVertices.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+using namespace std;
+
+namespace CGL {
+
+  // A sort key, and the vertex it belongs to.
+  struct KeyedIndex {
+    uint64_t key;
+    size_t index;
+
+    bool operator<(const KeyedIndex& k) const { return key < k.key; }
+  };
+
+  // Sorts the items by key (stably), eight bits at a time.  Each pass counts
+  // and scatters a fixed number of chunks in parallel, and passes over a
+  // digit that all the keys share are skipped.
+  static void radixSort(vector<KeyedIndex>& items) {
+    const size_t nChunks = 64, nDigits = 256;
+    size_t n = items.size();
+    if (n < 2) return;
+
+    vector<KeyedIndex> sorted(n);
+    vector<size_t> offsets(nChunks * nDigits);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+      #pragma omp parallel for
+      for (long c = 0; c < (long) nChunks; c++) {
+        size_t* count = &offsets[c * nDigits];
+        fill(count, count + nDigits, 0);
+        for (size_t i = n * c / nChunks; i < n * (c + 1) / nChunks; i++) {
+          count[(items[i].key >> shift) & (nDigits - 1)]++;
+        }
+      }
+
+      size_t digit = (items[0].key >> shift) & (nDigits - 1), same = 0;
+      for (size_t c = 0; c < nChunks; c++) same += offsets[c * nDigits + digit];
+      if (same == n) continue;
+
+      // Each chunk writes its items with a given digit after those of all
+      // the chunks with a smaller digit, and of the earlier chunks with the
+      // same digit.
+      size_t offset = 0;
+      for (size_t d = 0; d < nDigits; d++) {
+        for (size_t c = 0; c < nChunks; c++) {
+          size_t count = offsets[c * nDigits + d];
+          offsets[c * nDigits + d] = offset;
+          offset += count;
+        }
+      }
+
+      #pragma omp parallel for
+      for (long c = 0; c < (long) nChunks; c++) {
+        size_t* next = &offsets[c * nDigits];
+        for (size_t i = n * c / nChunks; i < n * (c + 1) / nChunks; i++) {
+          sorted[next[(items[i].key >> shift) & (nDigits - 1)]++] = items[i];
+        }
+      }
+      items.swap(sorted);
+    }
+  }
+
+  // Grid cells are keyed by their coordinates, 21 bits each, with x in the
+  // lowest bits; so the cells (x - 1, y, z) to (x + 1, y, z) have consecutive
+  // keys.
+  static const int cellBits = 21;
+  static const uint64_t cellMask = (1 << cellBits) - 1;
+
+  static inline uint64_t cellKey(uint64_t x, uint64_t y, uint64_t z) {
+    return x | (y << cellBits) | (z << (2 * cellBits));
+  }
+
+  size_t mergeVertices(Polymesh* mesh, double tolerance) {
+    vector<Vector3D>& vertices = mesh->vertices;
+    PolyList& polygons = mesh->polygons;
+    size_t n = vertices.size();
+    if (n < 2) return 0;
+
+    // Any cached halfedge connectivity is about to go out of date.
+    mesh->halfedge_twins.clear();
+
+    // Find the open edges.  Each edge is listed under its lower-numbered
+    // vertex (a counting sort by that vertex), so that it only has to be
+    // compared with the few other edges listed there.
+    vector<size_t> first(n + 1, 0);
+    for (size_t i = 0; i < polygons.size(); i++) {
+      const vector<size_t>& indices = polygons[i].vertex_indices;
+      for (size_t k = 0; k < indices.size(); k++) {
+        first[min(indices[k], indices[(k + 1) % indices.size()]) + 1]++;
+      }
+    }
+    for (size_t i = 0; i < n; i++) first[i + 1] += first[i];
+
+    vector<size_t> other(first[n]), next(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < polygons.size(); i++) {
+      const vector<size_t>& indices = polygons[i].vertex_indices;
+      for (size_t k = 0; k < indices.size(); k++) {
+        size_t a = indices[k], b = indices[(k + 1) % indices.size()];
+        other[next[min(a, b)]++] = max(a, b);
+      }
+    }
+
+    vector<char> openEdge(other.size(), 0);
+    #pragma omp parallel for
+    for (long a = 0; a < (long) n; a++) {
+      for (size_t e = first[a]; e < first[a + 1]; e++) {
+        size_t count = 0;
+        for (size_t f = first[a]; f < first[a + 1]; f++) count += other[f] == other[e];
+        openEdge[e] = count % 2;
+      }
+    }
+
+    vector<char> open(n, 0);
+    for (size_t a = 0; a < n; a++) {
+      for (size_t e = first[a]; e < first[a + 1]; e++) {
+        if (openEdge[e]) open[a] = open[other[e]] = 1;
+      }
+    }
+
+    Vector3D lb, ub;
+    lb = ub = vertices[0];
+    for (size_t i = 1; i < n; i++) {
+      const Vector3D& v = vertices[i];
+      for (int k = 0; k < 3; k++) {
+        lb[k] = lb[k] < v[k] ? lb[k] : v[k];
+        ub[k] = ub[k] > v[k] ? ub[k] : v[k];
+      }
+    }
+    Vector3D dim = ub - lb;
+    double size = max(max(dim.x, dim.y), dim.z);
+    double distance = tolerance * size;
+
+    // The cells are at least as large as the tolerance, so that every vertex
+    // within tolerance of a vertex is in one of the 27 cells around it.  There
+    // are at most 2^21 - 3 of them along each axis, offset by one so that the
+    // coordinates of all those neighbors still fit in 21 bits.
+    double cellSize = max(distance, size / (double) (cellMask - 2));
+    if (cellSize <= 0.) cellSize = 1.;
+
+    vector<KeyedIndex> cells;
+    for (size_t i = 0; i < n; i++) {
+      if (!open[i]) continue;
+      KeyedIndex cell = { 0, i };
+      cells.push_back(cell);
+    }
+
+    #pragma omp parallel for
+    for (long s = 0; s < (long) cells.size(); s++) {
+      Vector3D p = (vertices[cells[s].index] - lb) / cellSize;
+      uint64_t c[3];
+      for (int k = 0; k < 3; k++) {
+        c[k] = min((uint64_t) p[k], cellMask - 3) + 1;
+      }
+      cells[s].key = cellKey(c[0], c[1], c[2]);
+    }
+    radixSort(cells);
+
+    // Weld each vertex to the lowest-numbered vertex within tolerance.
+    vector<size_t> target(n);
+    #pragma omp parallel for
+    for (long i = 0; i < (long) n; i++) target[i] = i;
+
+    // The cells around consecutive (sorted) vertices start at non-decreasing
+    // keys, so each chunk of vertices finds them by advancing nine cursors,
+    // one per row of three cells.
+    const long nChunks = 64;
+    double distance2 = distance * distance;
+    #pragma omp parallel for
+    for (long c = 0; c < nChunks; c++) {
+      size_t begin = cells.size() * c / nChunks, end = cells.size() * (c + 1) / nChunks;
+      if (begin == end) continue;
+
+      vector<KeyedIndex>::const_iterator cursor[9];
+      for (int r = 0; r < 9; r++) cursor[r] = cells.begin();
+
+      for (size_t s = begin; s < end; s++) {
+        size_t i = cells[s].index;
+        uint64_t key = cells[s].key;
+        uint64_t x = key & cellMask, y = (key >> cellBits) & cellMask, z = key >> (2 * cellBits);
+
+        for (int r = 0; r < 9; r++) {
+          KeyedIndex first = { cellKey(x - 1, y + r % 3 - 1, z + r / 3 - 1), 0 };
+          uint64_t last = cellKey(x + 1, y + r % 3 - 1, z + r / 3 - 1);
+          if (s == begin) cursor[r] = lower_bound(cells.begin(), cells.end(), first);
+          while (cursor[r] != cells.end() && cursor[r]->key < first.key) cursor[r]++;
+
+          for (vector<KeyedIndex>::const_iterator t = cursor[r]; t != cells.end() && t->key <= last; t++) {
+            size_t j = t->index;
+            if (j < target[i] && (vertices[j] - vertices[i]).norm2() <= distance2) target[i] = j;
+          }
+        }
+      }
+    }
+
+    // Follow chains of welds (target[i] <= i, so each vertex can be resolved
+    // after those before it), and renumber the remaining vertices in order.
+    vector<size_t> newIndex(n);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+      target[i] = target[target[i]];
+      if (target[i] == i) {
+        vertices[m] = vertices[i];
+        newIndex[i] = m++;
+      } else {
+        newIndex[i] = newIndex[target[i]];
+      }
+    }
+    vertices.resize(m);
+
+    // Drop the polygons that now use some vertex twice.
+    vector<char> valid(polygons.size(), 1);
+    #pragma omp parallel for
+    for (long i = 0; i < (long) polygons.size(); i++) {
+      vector<size_t>& indices = polygons[i].vertex_indices;
+      for (size_t k = 0; k < indices.size(); k++) {
+        indices[k] = newIndex[indices[k]];
+        for (size_t l = 0; l < k; l++) {
+          if (indices[l] == indices[k]) valid[i] = 0;
+        }
+      }
+    }
+
+    size_t p = 0;
+    for (size_t i = 0; i < polygons.size(); i++) {
+      if (!valid[i]) continue;
+      if (p != i) swap(polygons[p], polygons[i]);
+      p++;
+    }
+    polygons.resize(p);
+
+    return n - m;
+  }
+
+}
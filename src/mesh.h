@@ -27,6 +27,9 @@ namespace CGL {
     std::vector<Vector2D> texcoords;  ///< texture coordinate array
 
     PolyList  polygons;   ///< polygons
+    std::vector<size_t> halfedge_twins; ///< for each corner (counted polygon by polygon), the corner that
+                                        ///< starts its twin halfedge, or -1 on the boundary; empty unless
+                                        ///< loaded from a mesh cache (see meshCache.h)
 
     Material* material;  ///< material of the mesh
 
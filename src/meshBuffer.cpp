@@ -0,0 +1,256 @@
+#include "meshBuffer.h"
+
+#include <algorithm>
+#include <cstddef>
+
+using namespace std;
+
+namespace CGL {
+
+  MeshBuffer::MeshBuffer()
+  : vertexBuffer(0), triangleBuffer(0), lineBuffer(0), valid(false), smooth(false), nFaces(0), nEdges(0), nHalfedges(0) {}
+
+  MeshBuffer::MeshBuffer(const MeshBuffer& buffer)
+  : vertexBuffer(0), triangleBuffer(0), lineBuffer(0), valid(false), smooth(false), nFaces(0), nEdges(0), nHalfedges(0) {}
+
+  MeshBuffer& MeshBuffer::operator=(const MeshBuffer& buffer) {
+    if (this != &buffer) {
+        release();
+        valid = false;
+    }
+    return *this;
+  }
+
+  MeshBuffer::~MeshBuffer() {
+    release();
+  }
+
+  void MeshBuffer::release() {
+    if (vertexBuffer) glDeleteBuffers(1, &vertexBuffer);
+    if (triangleBuffer) glDeleteBuffers(1, &triangleBuffer);
+    if (lineBuffer) glDeleteBuffers(1, &lineBuffer);
+    vertexBuffer = triangleBuffer = lineBuffer = 0;
+  }
+
+  void MeshBuffer::invalidate() {
+    valid = false;
+    dirtyFaces.clear();
+  }
+
+  void MeshBuffer::updateVertex(const Vertex* v) {
+    if (!valid) return;
+
+    // Moving v changes the faces around it, and (through the vertex normals)
+    // every face around each of the vertices of those faces.
+    HalfedgeCIter h = v->halfedge();
+    do {
+        FaceCIter f = h->face();
+        if (!f->isBoundary()) {
+            HalfedgeCIter g = f->halfedge();
+            do {
+                HalfedgeCIter k = g->vertex()->halfedge();
+                do {
+                    if (!k->face()->isBoundary()) dirtyFaces.push_back(k->face()->id());
+                    k = k->twin()->next();
+                } while (k != g->vertex()->halfedge());
+                g = g->next();
+            } while (g != f->halfedge());
+        }
+        h = h->twin()->next();
+    } while (h != v->halfedge());
+  }
+
+  void MeshBuffer::writeFace(Index f) {
+    FaceCIter face = faces[f];
+    Vector3D N = face->normal();
+    Index c = faceCorner[f];
+
+    HalfedgeCIter h = face->halfedge();
+    do {
+        VertexCIter v = h->vertex();
+        Vector3D n = smooth ? v->normal() : N;
+        Corner& corner = corners[c++];
+        corner.position[0] = (GLfloat) v->position.x;
+        corner.position[1] = (GLfloat) v->position.y;
+        corner.position[2] = (GLfloat) v->position.z;
+        corner.normal[0] = (GLfloat) n.x;
+        corner.normal[1] = (GLfloat) n.y;
+        corner.normal[2] = (GLfloat) n.z;
+        h = h->next();
+    } while (h != face->halfedge());
+  }
+
+  void MeshBuffer::rebuild(HalfedgeMesh& mesh) {
+    mesh.enumerate();
+    mesh.updateNormals();
+    nFaces = mesh.nFaces();
+    nEdges = mesh.nEdges();
+    nHalfedges = mesh.nHalfedges();
+
+    // Lay out the corners and fans face by face.
+    faces.clear();
+    faces.reserve(nFaces);
+    faceCorner.assign(1, 0);
+    faceTriangle.assign(1, 0);
+    for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+        Size degree = f->degree();
+        faces.push_back(f);
+        faceCorner.push_back(faceCorner.back() + degree);
+        faceTriangle.push_back(faceTriangle.back() + 3 * (degree - 2));
+    }
+    corners.resize(faceCorner.back());
+    triangles.resize(faceTriangle.back());
+
+    vector<Index> halfedgeCorner(nHalfedges);
+
+    #pragma omp parallel for
+    for (long f = 0; f < (long) nFaces; f++) {
+        writeFace(f);
+
+        Index c = faceCorner[f];
+        Index t = faceTriangle[f];
+        Size degree = faceCorner[f + 1] - c;
+        for (Index k = 1; k + 1 < degree; k++) {
+            triangles[t++] = (GLuint) c;
+            triangles[t++] = (GLuint) (c + k);
+            triangles[t++] = (GLuint) (c + k + 1);
+        }
+
+        HalfedgeCIter h = faces[f]->halfedge();
+        do {
+            halfedgeCorner[h->id()] = c++;
+            h = h->next();
+        } while (h != faces[f]->halfedge());
+    }
+
+    // Each edge is drawn between two corners of one of its (non-boundary) faces.
+    lines.resize(2 * nEdges);
+    for (EdgeCIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+        HalfedgeCIter h = e->halfedge();
+        if (h->isBoundary()) h = h->twin();
+        lines[2 * e->id()] = (GLuint) halfedgeCorner[h->id()];
+        lines[2 * e->id() + 1] = (GLuint) halfedgeCorner[h->next()->id()];
+    }
+
+    if (!vertexBuffer) glGenBuffers(1, &vertexBuffer);
+    if (!triangleBuffer) glGenBuffers(1, &triangleBuffer);
+    if (!lineBuffer) glGenBuffers(1, &lineBuffer);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(Corner), corners.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, triangleBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles.size() * sizeof(GLuint), triangles.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, lines.size() * sizeof(GLuint), lines.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    dirtyFaces.clear();
+    valid = true;
+  }
+
+  void MeshBuffer::sync(HalfedgeMesh& mesh, bool smooth) {
+    // A connectivity change that was not reported through invalidate() will
+    // still (almost always) show up in the element counts.
+    if (valid && (mesh.nFaces() != nFaces || mesh.nEdges() != nEdges || mesh.nHalfedges() != nHalfedges)) {
+        valid = false;
+    }
+
+    if (!valid) {
+        this->smooth = smooth;
+        rebuild(mesh);
+        return;
+    }
+
+    if (smooth != this->smooth) {
+        // Every normal changes, but the layout does not.
+        this->smooth = smooth;
+        mesh.updateNormals();
+        #pragma omp parallel for
+        for (long f = 0; f < (long) nFaces; f++) writeFace(f);
+
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, corners.size() * sizeof(Corner), corners.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        dirtyFaces.clear();
+        return;
+    }
+
+    if (dirtyFaces.empty()) return;
+
+    mesh.updateNormals();
+    sort(dirtyFaces.begin(), dirtyFaces.end());
+    dirtyFaces.erase(unique(dirtyFaces.begin(), dirtyFaces.end()), dirtyFaces.end());
+
+    // Upload each run of consecutive faces with a single call.
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    for (Index i = 0; i < dirtyFaces.size(); ) {
+        Index j = i + 1;
+        while (j < dirtyFaces.size() && dirtyFaces[j] == dirtyFaces[j - 1] + 1) j++;
+
+        for (Index k = i; k < j; k++) writeFace(dirtyFaces[k]);
+        Index begin = faceCorner[dirtyFaces[i]];
+        Index end = faceCorner[dirtyFaces[j - 1] + 1];
+        glBufferSubData(GL_ARRAY_BUFFER, begin * sizeof(Corner), (end - begin) * sizeof(Corner), &corners[begin]);
+
+        i = j;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    dirtyFaces.clear();
+  }
+
+  void MeshBuffer::bind() {
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(Corner), (const GLvoid*) offsetof(Corner, position));
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_FLOAT, sizeof(Corner), (const GLvoid*) offsetof(Corner, normal));
+  }
+
+  void MeshBuffer::unbind() {
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  void MeshBuffer::drawFaces(HalfedgeMesh& mesh, bool smooth) {
+    sync(mesh, smooth);
+
+    bind();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, triangleBuffer);
+    glDrawElements(GL_TRIANGLES, (GLsizei) triangles.size(), GL_UNSIGNED_INT, 0);
+    unbind();
+  }
+
+  void MeshBuffer::drawEdges(HalfedgeMesh& mesh) {
+    sync(mesh, smooth);
+
+    bind();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineBuffer);
+    glDrawElements(GL_LINES, (GLsizei) lines.size(), GL_UNSIGNED_INT, 0);
+    unbind();
+  }
+
+  void MeshBuffer::drawFace(const Face* f) {
+    // Boundary loops are numbered after the faces, and are not drawn.
+    if (!valid || f->id() >= nFaces) return;
+
+    bind();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, triangleBuffer);
+    glDrawElements(GL_TRIANGLES, (GLsizei) (faceTriangle[f->id() + 1] - faceTriangle[f->id()]), GL_UNSIGNED_INT,
+                   (const GLvoid*) (faceTriangle[f->id()] * sizeof(GLuint)));
+    unbind();
+  }
+
+  void MeshBuffer::drawEdge(const Edge* e) {
+    if (!valid || e->id() >= nEdges) return;
+
+    bind();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineBuffer);
+    glDrawElements(GL_LINES, 2, GL_UNSIGNED_INT, (const GLvoid*) (2 * e->id() * sizeof(GLuint)));
+    unbind();
+  }
+
+}
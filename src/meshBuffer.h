@@ -0,0 +1,99 @@
+#ifndef CGL_MESHBUFFER_H
+#define CGL_MESHBUFFER_H
+
+#include "GL/glew.h"
+
+#include "halfEdgeMesh.h"
+
+namespace CGL {
+
+  /**
+   * A MeshBuffer mirrors the faces and edges of a HalfedgeMesh in OpenGL
+   * buffer objects, so that the whole mesh can be drawn with one
+   * glDrawElements() call for the faces and one for the edges, rather than
+   * one glVertex() call per polygon corner.
+   *
+   * Every polygon corner gets its own interleaved (position, normal) vertex,
+   * since the normal of a corner depends on the face under flat shading.
+   * Polygons are drawn as triangle fans, and each edge as a line between two
+   * corners of one of its faces.  Corners are stored face by face, in the
+   * order given by HalfedgeMesh::enumerate(), which makes it cheap to
+   * re-upload just the faces affected by an edit.
+   *
+   * The buffers are brought up to date lazily, the next time something is
+   * drawn.  After moving a vertex, call updateVertex(); after changing the
+   * connectivity of the mesh (or replacing it), call invalidate().  A
+   * MeshBuffer must only be used while an OpenGL context is current.
+   */
+  class MeshBuffer {
+  public:
+
+    MeshBuffer();
+    ~MeshBuffer();
+
+    // Copies share no OpenGL objects; they start out empty and are rebuilt
+    // the first time they are drawn.
+    MeshBuffer(const MeshBuffer& buffer);
+    MeshBuffer& operator=(const MeshBuffer& buffer);
+
+    /**
+     * Forces a complete rebuild, e.g., after the connectivity has changed.
+     */
+    void invalidate();
+
+    /**
+     * Records that the given vertex has moved.  Only the corners whose
+     * position or normal depends on it are uploaded again.
+     */
+    void updateVertex(const Vertex* v);
+
+    /**
+     * Draws all faces, with vertex normals if smooth is true and face
+     * normals otherwise.
+     */
+    void drawFaces(HalfedgeMesh& mesh, bool smooth);
+
+    /**
+     * Draws all edges as lines.
+     */
+    void drawEdges(HalfedgeMesh& mesh);
+
+    // Draw a single face or edge again (e.g., highlighted in another color),
+    // using exactly the same vertices as the last call to drawFaces().
+    void drawFace(const Face* f);
+    void drawEdge(const Edge* e);
+
+  private:
+
+    struct Corner {
+      GLfloat position[3];
+      GLfloat normal[3];
+    };
+
+    void sync(HalfedgeMesh& mesh, bool smooth);
+    void rebuild(HalfedgeMesh& mesh);
+    void writeFace(Index f);
+    void bind();
+    void unbind();
+    void release();
+
+    std::vector<Corner> corners;
+    std::vector<GLuint> triangles;      ///< triangle fans of all faces, indexing corners
+    std::vector<GLuint> lines;          ///< two corners per edge, in edge id order
+    std::vector<Index> faceCorner;      ///< first corner of each face (by id), plus one past the last
+    std::vector<Index> faceTriangle;    ///< first entry of each face (by id) in triangles
+    std::vector<FaceCIter> faces;       ///< faces by id
+    std::vector<Index> dirtyFaces;      ///< ids of faces to upload again
+
+    GLuint vertexBuffer;
+    GLuint triangleBuffer;
+    GLuint lineBuffer;
+
+    bool valid;    ///< whether the buffers match the connectivity of the mesh
+    bool smooth;   ///< normals currently stored in corners
+    Size nFaces, nEdges, nHalfedges; ///< size of the mesh at the last rebuild
+  };
+
+}
+
+#endif // CGL_MESHBUFFER_H
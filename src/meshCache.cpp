@@ -0,0 +1,617 @@
+#include "meshCache.h"
+
+#include "camera.h"
+#include "light.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace CGL {
+
+  // Version 1: nodes with cameras, lights and polygon meshes, and halfedge twins.
+  static const char cacheMagic[8] = { 'C', 'G', 'L', 'M', 'E', 'S', 'H', '\0' };
+  static const uint64_t cacheVersion = 1;
+  static const uint64_t byteOrderMark = 0x0102030405060708ull;
+
+  // Kinds of node instances.
+  enum CachedInstance { CACHED_NONE, CACHED_CAMERA, CACHED_LIGHT, CACHED_POLYMESH };
+
+  static const size_t none = (size_t) -1;
+
+  //////////////////
+  // File access  //
+  //////////////////
+
+  // The size and modification time of a file, or false if it doesn't exist.
+  static bool fileStamp(const char* path, uint64_t& size, uint64_t& time) {
+    struct stat info;
+    if (stat(path, &info) != 0) return false;
+    size = (uint64_t) info.st_size;
+    time = (uint64_t) info.st_mtime;
+    return true;
+  }
+
+  // The contents of a file, mapped into memory (or, where there is no mmap,
+  // read into a buffer).
+  class MappedFile {
+  public:
+    MappedFile(const char* path) : data(NULL), size(0) {
+#ifndef _WIN32
+      int fd = open(path, O_RDONLY);
+      if (fd < 0) return;
+      struct stat info;
+      if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+          data = (const char*) p;
+          size = info.st_size;
+        }
+      }
+      close(fd);
+#else
+      FILE* file = fopen(path, "rb");
+      if (!file) return;
+      fseek(file, 0, SEEK_END);
+      long n = ftell(file);
+      fseek(file, 0, SEEK_SET);
+      if (n > 0) {
+        buffer.resize(n);
+        if (fread(&buffer[0], 1, n, file) == (size_t) n) {
+          data = &buffer[0];
+          size = n;
+        }
+      }
+      fclose(file);
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+      if (data) munmap((void*) data, size);
+#endif
+    }
+
+    const char* data;
+    size_t size;
+
+  private:
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+  };
+
+  // Reads the words, strings and arrays of a cache, each padded to 8 bytes.
+  // Any read past the end (e.g., of a truncated file) leaves the reader
+  // invalid, and returns zeros from then on.
+  class CacheReader {
+  public:
+    CacheReader(const char* data, size_t size) : valid(true), data(data), size(size), offset(0) {}
+
+    const char* take(uint64_t n) {
+      uint64_t padded = (n + 7) & ~(uint64_t) 7;
+      if (!valid || padded < n || padded > size - offset) {
+        valid = false;
+        return NULL;
+      }
+      const char* p = data + offset;
+      offset += padded;
+      return p;
+    }
+
+    uint64_t word() {
+      uint64_t w = 0;
+      const char* p = take(8);
+      if (p) memcpy(&w, p, 8);
+      return w;
+    }
+
+    double real() {
+      double d = 0.;
+      const char* p = take(8);
+      if (p) memcpy(&d, p, 8);
+      return d;
+    }
+
+    // The length of an array whose items are the given number of words long.
+    uint64_t length(uint64_t words) {
+      uint64_t n = word();
+      if (n > size / 8 / words) {
+        valid = false;
+        return 0;
+      }
+      return n;
+    }
+
+    string text() {
+      uint64_t n = word();
+      const char* p = take(n);
+      return p ? string(p, n) : string();
+    }
+
+    // An array of n words (or doubles), or NULL if the file is too short.
+    template<class T>
+    const T* array(uint64_t n) {
+      if (n > size / 8) {
+        valid = false;
+        return NULL;
+      }
+      return (const T*) take(n * 8);
+    }
+
+    bool valid;
+
+  private:
+    const char* data;
+    size_t size, offset;
+  };
+
+  class CacheWriter {
+  public:
+    CacheWriter(FILE* file) : valid(true), file(file) {}
+
+    void put(const void* p, size_t n) {
+      static const char padding[8] = { 0 };
+      if (n > 0 && fwrite(p, 1, n, file) != n) valid = false;
+      if (n % 8 && fwrite(padding, 1, 8 - n % 8, file) != 8 - n % 8) valid = false;
+    }
+
+    void word(uint64_t w) { put(&w, 8); }
+    void real(double d) { put(&d, 8); }
+    void text(const string& s) { word(s.size()); put(s.data(), s.size()); }
+
+    bool valid;
+
+  private:
+    FILE* file;
+  };
+
+  //////////////////////
+  // Halfedge twins   //
+  //////////////////////
+
+  // The corners of the polygons, numbered polygon by polygon: the vertex
+  // each one leaves, and the next and previous corners of its polygon.
+  // Returns false unless every vertex index is in range and no polygon uses
+  // a vertex twice.
+  static bool findCorners(const Polymesh& polymesh, vector<size_t>& tail,
+                          vector<size_t>& next, vector<size_t>& prev) {
+    size_t nVertices = polymesh.vertices.size(), nCorners = 0;
+    for (size_t i = 0; i < polymesh.polygons.size(); i++) nCorners += polymesh.polygons[i].vertex_indices.size();
+    if (nCorners == 0) return false;
+
+    tail.resize(nCorners);
+    next.resize(nCorners);
+    prev.resize(nCorners);
+    size_t first = 0;
+    for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+      const vector<size_t>& indices = polymesh.polygons[i].vertex_indices;
+      size_t degree = indices.size();
+      for (size_t j = 0; j < degree; j++) {
+        if (indices[j] >= nVertices) return false;
+        for (size_t l = 0; l < j; l++) {
+          if (indices[l] == indices[j]) return false;
+        }
+        tail[first + j] = indices[j];
+        next[first + j] = first + (j + 1) % degree;
+        prev[first + j] = first + (j + degree - 1) % degree;
+      }
+      first += degree;
+    }
+    return true;
+  }
+
+  // Returns true if every vertex is used, and the corners at each vertex
+  // form a single fan.  The corners at a vertex are linked by
+  // h -> next(twin(h)); a fan is a single cycle of them, or a single chain
+  // starting at the only corner h with no twin(prev(h)).
+  static bool checkFans(size_t nVertices, const vector<size_t>& tail, const vector<size_t>& next,
+                        const vector<size_t>& prev, const vector<size_t>& twin) {
+    size_t nCorners = tail.size();
+    vector<size_t> degree(nVertices, 0), start(nVertices, none), starts(nVertices, 0);
+    for (size_t k = 0; k < nCorners; k++) {
+      size_t v = tail[k];
+      degree[v]++;
+      if (twin[prev[k]] == none) {
+        starts[v]++;
+        start[v] = k;
+      } else if (start[v] == none || starts[v] == 0) {
+        start[v] = k;
+      }
+    }
+
+    for (size_t v = 0; v < nVertices; v++) {
+      if (degree[v] == 0 || starts[v] > 1) return false;
+
+      size_t count = 0, h = start[v];
+      do {
+        count++;
+        if (twin[h] == none) break;
+        h = next[twin[h]];
+      } while (h != start[v] && count <= degree[v]);
+      if (count != degree[v]) return false;
+    }
+
+    return true;
+  }
+
+  // Finds the twin of every corner of the polygons, as HalfedgeMesh::build()
+  // would, and returns true if build() would accept the polygons: every
+  // vertex is used, no polygon uses one twice, every edge has at most two
+  // consistently oriented polygons, and the polygons around each vertex
+  // form a single fan.
+  static bool findTwins(const Polymesh& polymesh, vector<size_t>& twin) {
+    vector<size_t> tail, next, prev;
+    if (!findCorners(polymesh, tail, next, prev)) return false;
+    size_t nCorners = tail.size();
+
+    // Corners sorted by their edge, so that twins are adjacent.
+    vector< pair< pair<size_t, size_t>, size_t > > keys(nCorners);
+    for (size_t k = 0; k < nCorners; k++) {
+      size_t a = tail[k], b = tail[next[k]];
+      keys[k] = make_pair(make_pair(min(a, b), max(a, b)), k);
+    }
+    sort(keys.begin(), keys.end());
+
+    twin.assign(nCorners, none);
+    for (size_t i = 0; i < nCorners; ) {
+      size_t j = i + 1;
+      while (j < nCorners && keys[j].first == keys[i].first) j++;
+      if (j - i > 2) return false;
+      if (j - i == 2) {
+        size_t a = keys[i].second, b = keys[i + 1].second;
+        if (tail[a] == tail[b]) return false;
+        twin[a] = b;
+        twin[b] = a;
+      }
+      i = j;
+    }
+
+    return checkFans(polymesh.vertices.size(), tail, next, prev, twin);
+  }
+
+  // Returns true if the given twins (e.g., read from a cache) can be passed
+  // to HalfedgeMesh::buildFromConnectivity(), which checks nothing itself:
+  // the polygons pass the checks of findTwins(), and each twin pairs a
+  // corner with another one along the same edge in the opposite direction.
+  // Unlike findTwins(), this takes linear time.
+  static bool checkTwins(const Polymesh& polymesh, const vector<size_t>& twin) {
+    vector<size_t> tail, next, prev;
+    if (!findCorners(polymesh, tail, next, prev)) return false;
+    size_t nCorners = tail.size();
+    if (twin.size() != nCorners) return false;
+
+    for (size_t k = 0; k < nCorners; k++) {
+      size_t t = twin[k];
+      if (t == none) continue;
+      if (t >= nCorners || t == k || twin[t] != k) return false;
+      if (tail[t] != tail[next[k]]) return false;
+    }
+
+    return checkFans(polymesh.vertices.size(), tail, next, prev, twin);
+  }
+
+  void buildHalfedgeMesh(const Polymesh& polymesh, HalfedgeMesh& mesh) {
+    vector<Index> faceStart(polymesh.polygons.size() + 1, 0);
+    for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+      faceStart[i + 1] = faceStart[i] + polymesh.polygons[i].vertex_indices.size();
+    }
+
+    if (polymesh.halfedge_twins.empty() || polymesh.halfedge_twins.size() != faceStart.back()) {
+      vector< vector<size_t> > polygons;
+      polygons.reserve(polymesh.polygons.size());
+      for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+        polygons.push_back(polymesh.polygons[i].vertex_indices);
+      }
+      mesh.build(polygons, polymesh.vertices);
+      return;
+    }
+
+    vector<Index> tail;
+    tail.reserve(faceStart.back());
+    for (size_t i = 0; i < polymesh.polygons.size(); i++) {
+      const vector<size_t>& indices = polymesh.polygons[i].vertex_indices;
+      tail.insert(tail.end(), indices.begin(), indices.end());
+    }
+    mesh.buildFromConnectivity(faceStart, tail, polymesh.halfedge_twins, polymesh.vertices);
+  }
+
+  /////////////
+  // Writing //
+  /////////////
+
+  static void writeIndexLists(CacheWriter& out, const PolyList& polygons, vector<size_t> Polygon::* list) {
+    vector<uint64_t> offsets(polygons.size() + 1, 0);
+    for (size_t i = 0; i < polygons.size(); i++) {
+      offsets[i + 1] = offsets[i] + (polygons[i].*list).size();
+    }
+    out.put(&offsets[0], offsets.size() * 8);
+
+    for (size_t i = 0; i < polygons.size(); i++) {
+      const vector<size_t>& indices = polygons[i].*list;
+      for (size_t k = 0; k < indices.size(); k++) out.word(indices[k]);
+    }
+  }
+
+  static void writeColor(CacheWriter& out, const Color& c) {
+    out.real(c.r); out.real(c.g); out.real(c.b); out.real(c.a);
+  }
+
+  static void writePolymesh(CacheWriter& out, const Polymesh& polymesh) {
+    out.text(polymesh.id);
+    out.text(polymesh.name);
+
+    out.word(polymesh.vertices.size());
+    for (size_t i = 0; i < polymesh.vertices.size(); i++) {
+      const Vector3D& v = polymesh.vertices[i];
+      out.real(v.x); out.real(v.y); out.real(v.z);
+    }
+    out.word(polymesh.normals.size());
+    for (size_t i = 0; i < polymesh.normals.size(); i++) {
+      const Vector3D& n = polymesh.normals[i];
+      out.real(n.x); out.real(n.y); out.real(n.z);
+    }
+    out.word(polymesh.texcoords.size());
+    for (size_t i = 0; i < polymesh.texcoords.size(); i++) {
+      const Vector2D& t = polymesh.texcoords[i];
+      out.real(t.x); out.real(t.y);
+    }
+
+    out.word(polymesh.polygons.size());
+    writeIndexLists(out, polymesh.polygons, &Polygon::vertex_indices);
+    writeIndexLists(out, polymesh.polygons, &Polygon::normal_indices);
+    writeIndexLists(out, polymesh.polygons, &Polygon::texcoord_indices);
+
+    const Material* material = polymesh.material;
+    out.word(material != NULL);
+    if (material) {
+      out.text(material->id);
+      out.text(material->name);
+      writeColor(out, material->emit);
+      writeColor(out, material->ambi);
+      writeColor(out, material->diff);
+      writeColor(out, material->spec);
+      out.real(material->shininess);
+      out.real(material->refractive_index);
+    }
+
+    vector<size_t> twin;
+    if (!findTwins(polymesh, twin)) twin.clear();
+    out.word(twin.size());
+    for (size_t k = 0; k < twin.size(); k++) out.word(twin[k]);
+  }
+
+  string meshCachePath(const char* sourcePath) {
+    return string(sourcePath) + ".cache";
+  }
+
+  bool writeMeshCache(const char* sourcePath, const Scene& scene) {
+    uint64_t sourceSize, sourceTime;
+    if (!fileStamp(sourcePath, sourceSize, sourceTime)) return false;
+
+    // Write to a temporary file first, so that a cache is never read while
+    // it is only partly written.
+    string path = meshCachePath(sourcePath), temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return false;
+
+    CacheWriter out(file);
+    out.put(cacheMagic, 8);
+    out.word(cacheVersion);
+    out.word(byteOrderMark);
+    out.word(sourceSize);
+    out.word(sourceTime);
+
+    out.word(scene.nodes.size());
+    for (size_t i = 0; i < scene.nodes.size(); i++) {
+      const Node& node = scene.nodes[i];
+      out.text(node.id);
+      out.text(node.name);
+      for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) out.real(node.transform(r, c));
+      }
+
+      const Instance* instance = node.instance;
+      if (instance && instance->type == CAMERA) {
+        const Camera& camera = static_cast<const Camera&>(*instance);
+        out.word(CACHED_CAMERA);
+        out.text(camera.id);
+        out.text(camera.name);
+        out.real(camera.hfov); out.real(camera.vfov);
+        out.real(camera.nclip); out.real(camera.fclip);
+      } else if (instance && instance->type == LIGHT) {
+        const Light& light = static_cast<const Light&>(*instance);
+        out.word(CACHED_LIGHT);
+        out.text(light.id);
+        out.text(light.name);
+        out.word(light.light_type);
+        writeColor(out, light.color);
+        out.real(light.attenuation);
+      } else if (instance && instance->type == POLYMESH) {
+        out.word(CACHED_POLYMESH);
+        writePolymesh(out, static_cast<const Polymesh&>(*instance));
+      } else {
+        out.word(CACHED_NONE);
+      }
+    }
+
+    bool written = fclose(file) == 0 && out.valid;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+      remove(temporary.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /////////////
+  // Loading //
+  /////////////
+
+  static bool readIndexLists(CacheReader& in, PolyList& polygons, vector<size_t> Polygon::* list) {
+    const uint64_t* offsets = in.array<uint64_t>(polygons.size() + 1);
+    if (!offsets || offsets[0] != 0) return false;
+    for (size_t i = 0; i < polygons.size(); i++) {
+      if (offsets[i + 1] < offsets[i]) return false;
+    }
+
+    const uint64_t* indices = in.array<uint64_t>(offsets[polygons.size()]);
+    if (!indices) return false;
+    for (size_t i = 0; i < polygons.size(); i++) {
+      (polygons[i].*list).assign(indices + offsets[i], indices + offsets[i + 1]);
+    }
+    return true;
+  }
+
+  static Color readColor(CacheReader& in) {
+    Color c;
+    c.r = (float) in.real(); c.g = (float) in.real(); c.b = (float) in.real(); c.a = (float) in.real();
+    return c;
+  }
+
+  static bool readPolymesh(CacheReader& in, Polymesh& polymesh) {
+    polymesh.type = POLYMESH;
+    polymesh.id = in.text();
+    polymesh.name = in.text();
+
+    uint64_t n = in.length(3);
+    const double* p = in.array<double>(3 * n);
+    if (!p) return false;
+    polymesh.vertices.resize(n);
+    for (size_t i = 0; i < n; i++) polymesh.vertices[i] = Vector3D(p[3 * i], p[3 * i + 1], p[3 * i + 2]);
+
+    n = in.length(3);
+    p = in.array<double>(3 * n);
+    if (!p) return false;
+    polymesh.normals.resize(n);
+    for (size_t i = 0; i < n; i++) polymesh.normals[i] = Vector3D(p[3 * i], p[3 * i + 1], p[3 * i + 2]);
+
+    n = in.length(2);
+    p = in.array<double>(2 * n);
+    if (!p) return false;
+    polymesh.texcoords.resize(n);
+    for (size_t i = 0; i < n; i++) polymesh.texcoords[i] = Vector2D(p[2 * i], p[2 * i + 1]);
+
+    n = in.length(1);
+    if (!in.valid) return false;
+    polymesh.polygons.resize(n);
+    if (!readIndexLists(in, polymesh.polygons, &Polygon::vertex_indices) ||
+        !readIndexLists(in, polymesh.polygons, &Polygon::normal_indices) ||
+        !readIndexLists(in, polymesh.polygons, &Polygon::texcoord_indices)) return false;
+
+    if (in.word()) {
+      Material* material = new Material();
+      polymesh.material = material;
+      material->type = MATERIAL;
+      material->id = in.text();
+      material->name = in.text();
+      material->emit = readColor(in);
+      material->ambi = readColor(in);
+      material->diff = readColor(in);
+      material->spec = readColor(in);
+      material->shininess = (float) in.real();
+      material->refractive_index = (float) in.real();
+    }
+
+    // The twins are only trusted if they describe a mesh that build() would
+    // also accept.
+    n = in.length(1);
+    const uint64_t* twin = in.array<uint64_t>(n);
+    if (!twin) return false;
+    if (n > 0) {
+      polymesh.halfedge_twins.assign(twin, twin + n);
+      if (!checkTwins(polymesh, polymesh.halfedge_twins)) return false;
+    }
+
+    return in.valid;
+  }
+
+  // Deletes the instances of the nodes, and their materials.
+  static void deleteInstances(vector<Node>& nodes) {
+    for (size_t i = 0; i < nodes.size(); i++) {
+      Instance* instance = nodes[i].instance;
+      if (instance && instance->type == POLYMESH) {
+        Polymesh* polymesh = static_cast<Polymesh*>(instance);
+        delete polymesh->material;
+        delete polymesh;
+      } else if (instance && instance->type == CAMERA) {
+        delete static_cast<Camera*>(instance);
+      } else if (instance && instance->type == LIGHT) {
+        delete static_cast<Light*>(instance);
+      }
+    }
+    nodes.clear();
+  }
+
+  bool loadMeshCache(const char* sourcePath, Scene* scene) {
+    uint64_t sourceSize, sourceTime;
+    if (!fileStamp(sourcePath, sourceSize, sourceTime)) return false;
+
+    MappedFile file(meshCachePath(sourcePath).c_str());
+    if (!file.data) return false;
+
+    CacheReader in(file.data, file.size);
+    const char* magic = in.take(8);
+    if (!magic || memcmp(magic, cacheMagic, 8) != 0) return false;
+    if (in.word() != cacheVersion || in.word() != byteOrderMark) return false;
+    if (in.word() != sourceSize || in.word() != sourceTime) return false;
+
+    vector<Node> nodes;
+    uint64_t nNodes = in.length(1);
+    for (uint64_t i = 0; i < nNodes && in.valid; i++) {
+      Node node;
+      node.id = in.text();
+      node.name = in.text();
+      for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) node.transform(r, c) = in.real();
+      }
+      node.instance = NULL;
+
+      uint64_t kind = in.word();
+      if (kind == CACHED_CAMERA) {
+        Camera* camera = new Camera();
+        node.instance = camera;
+        camera->type = CAMERA;
+        camera->id = in.text();
+        camera->name = in.text();
+        camera->hfov = (float) in.real(); camera->vfov = (float) in.real();
+        camera->nclip = (float) in.real(); camera->fclip = (float) in.real();
+      } else if (kind == CACHED_LIGHT) {
+        Light* light = new Light();
+        node.instance = light;
+        light->type = LIGHT;
+        light->id = in.text();
+        light->name = in.text();
+        light->light_type = (LightType) in.word();
+        light->color = readColor(in);
+        light->attenuation = (float) in.real();
+      } else if (kind == CACHED_POLYMESH) {
+        Polymesh* polymesh = new Polymesh();
+        node.instance = polymesh;
+        if (!readPolymesh(in, *polymesh)) in.valid = false;
+      } else if (kind != CACHED_NONE) {
+        in.valid = false;
+      }
+      nodes.push_back(node);
+    }
+
+    if (!in.valid) {
+      deleteInstances(nodes);
+      return false;
+    }
+
+    scene->nodes.insert(scene->nodes.end(), nodes.begin(), nodes.end());
+    return true;
+  }
+
+}
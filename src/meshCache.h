@@ -0,0 +1,56 @@
+#ifndef CGL_MESHCACHE_H
+#define CGL_MESHCACHE_H
+
+#include "scene.h"
+#include "mesh.h"
+#include "halfEdgeMesh.h"
+
+namespace CGL {
+
+  /**
+   * A binary cache of a scene loaded from a COLLADA file, written next to it
+   * (with ".cache" appended to its name), so that the next load doesn't
+   * have to parse any XML.
+   *
+   * The cache holds the nodes of the scene with their cameras, lights and
+   * polygon meshes (with their materials).  Every array is stored as raw
+   * 64-bit words, aligned to 8 bytes, so loading comes down to mapping the
+   * file into memory and copying the arrays out of it.  For a mesh whose
+   * polygons form a manifold, oriented surface, the cache also stores the
+   * twin of every halfedge, which is all that HalfedgeMesh::build() works
+   * out before linking the elements (see buildHalfedgeMesh()).
+   *
+   * A cache records the size and modification time of the file it was made
+   * from, and is ignored once either changes.  It is only meant to be read
+   * on the kind of machine that wrote it.  A cache whose twins don't pass
+   * the same checks as the polygons they were found from is ignored too.
+   */
+
+  /**
+   * Returns the path of the cache of the given file.
+   */
+  std::string meshCachePath( const char* sourcePath );
+
+  /**
+   * Appends the nodes of the cache of the given file to the scene.  Returns
+   * false, leaving the scene as it was, if there is no valid cache that is
+   * up to date with the file.
+   */
+  bool loadMeshCache( const char* sourcePath, Scene* scene );
+
+  /**
+   * Writes the cache of the given file, from which the scene was just
+   * loaded.  Returns false if it could not be written.
+   */
+  bool writeMeshCache( const char* sourcePath, const Scene& scene );
+
+  /**
+   * Builds the halfedge mesh of a polygon mesh, straight from the twins of
+   * its halfedges if they came with it from a cache, and with
+   * HalfedgeMesh::build() otherwise.
+   */
+  void buildHalfedgeMesh( const Polymesh& polymesh, HalfedgeMesh& mesh );
+
+}
+
+#endif // CGL_MESHCACHE_H
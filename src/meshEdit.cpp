@@ -5,6 +5,7 @@
 #define PI 3.14159265
 
 #include <cmath>
+#include <limits>
 
 namespace CGL {
 
@@ -12,11 +13,15 @@ namespace CGL {
   {
     smoothShading = false;
     shadingMode = false;
+    useBuffers = false;
+    gpuPicking = false;
+    pick_w = pick_h = 0;
     shaderProgID = loadShaders("shader/vert", "shader/frag");
     if(!shaderProgID)
       shaderProgID = loadShaders("../shader/vert", "../shader/frag");
     text_mgr.init(use_hdpi);
     text_color = Color(1.0, 1.0, 1.0);
+    numMessages = 0;
 
     // Setup all the basic internal state to default values,
     // as well as some basic OpenGL state (like depth testing
@@ -30,6 +35,8 @@ namespace CGL {
     left_down   = false;
     right_down  = false;
     middle_down = false;
+    draggingVertex = false;
+    editsApplied = 0;
     mouse_rotate = false;
 
     showHUD = true;
@@ -186,7 +193,7 @@ namespace CGL {
     {
       for( vector<MeshNode>::iterator n = meshNodes.begin(); n != meshNodes.end(); n++ )
       {
-        renderMesh( n->mesh );
+        renderMesh( *n );
       }
 
       // Execute all of the OpenGL commands.
@@ -238,6 +245,11 @@ namespace CGL {
           mesh_up_sample();
           break;
 
+          case 'd':
+          case 'D':
+          mesh_down_sample();
+          break;
+
           case 'i':
           case 'I':
           showHUD = !showHUD;
@@ -250,6 +262,14 @@ namespace CGL {
           case 'S':
           splitSelectedEdge();
           break;
+          case 'z':
+          case 'Z':
+          undo();
+          break;
+          case 'y':
+          case 'Y':
+          redo();
+          break;
           case 'n':
           case 'N':
           selectNextHalfedge();
@@ -266,6 +286,16 @@ namespace CGL {
           case 'Q':
           smoothShading = !smoothShading;
           break;
+          case 'v':
+          case 'V':
+          useBuffers = !useBuffers;
+          break;
+          case 'g':
+          case 'G':
+          // The pick framebuffer is only set up the first time it is needed.
+          if( gpuPicking || pickFramebuffer.isSupported() || pickFramebuffer.init() )
+          gpuPicking = !gpuPicking;
+          break;
           default:
           break;
         }
@@ -497,6 +527,10 @@ namespace CGL {
           MeshNode meshNode( polymesh );
           meshNodes.push_back( meshNode );
 
+          const HalfedgeMesh::BuildStats& stats = meshNode.mesh.buildStats();
+          cerr << "Built halfedge mesh: " << stats.nFaces << " faces, " << stats.nHalfedges << " halfedges in "
+               << stats.seconds << "s (" << stats.facesPerSecond() << " faces/sec)" << endl;
+
           // Ensure that the current selection always has a valid mesh pointer.
           selectedFeature.node = &meshNode;
 
@@ -530,6 +564,7 @@ namespace CGL {
 
         void MeshEdit::mouseP(e_mouse_button b)
         {
+          draggingVertex = false;
           switch (b) {
             case LEFT:
             if(!hoveredFeature.element) {
@@ -550,6 +585,7 @@ namespace CGL {
 
         void MeshEdit::mouseR(e_mouse_button b)
         {
+          draggingVertex = false;
           switch (b) {
             case LEFT:
             if(mouse_rotate)
@@ -574,7 +610,19 @@ namespace CGL {
           Vertex* v = selectedFeature.element -> getVertex();
           if(!mouse_rotate && v != NULL)
           {
+            // Record the position before the first step of each drag, so
+            // that the whole drag is undone at once.
+            if(!draggingVertex)
+            {
+              selectedFeature.node->journal.moveVertex( selectedFeature.node->mesh, v->halfedge()->vertex() );
+              recordEdit( selectedFeature.node );
+              draggingVertex = true;
+            }
             dragPosition(dx, dy, v->position);
+            selectedFeature.node->mesh.invalidateNormals( v->halfedge()->vertex() );
+            selectedFeature.node->buffer.updateVertex(v);
+            selectedFeature.node->bvh.updateVertex(v);
+            selectedFeature.node->pick.updateVertex(v);
             return;
           }
 
@@ -649,12 +697,40 @@ namespace CGL {
             return output;
           }
 
+          // Finds the ray o + t * d (t >= 0) of the points that PM projects to
+          // (ndc_x, ndc_y) in unit cube space.  Only the rows of PM giving x, y
+          // and w are used: the eye is where all three vanish, and the ray lies
+          // in the two planes where x = ndc_x * w and y = ndc_y * w.  (Unprojecting
+          // points at given depths instead loses all precision with the near and
+          // far planes this far apart, as OpenGL keeps its matrices in floats.)
+          inline void cursorRay(const Matrix4x4 & PM, double ndc_x, double ndc_y,
+                                Vector3D & o, Vector3D & d)
+          {
+            Matrix3x3 A;
+            int rows[3] = { 0, 1, 3 };
+            for(int r = 0; r < 3; r++)
+            for(int c = 0; c < 3; c++)
+            {
+              A(r, c) = PM(rows[r], c);
+            }
+            o = A.inv()*Vector3D( -PM(0, 3), -PM(1, 3), -PM(3, 3) );
+
+            Vector3D W( PM(3, 0), PM(3, 1), PM(3, 2) );
+            Vector3D X = Vector3D( PM(0, 0), PM(0, 1), PM(0, 2) ) - ndc_x*W;
+            Vector3D Y = Vector3D( PM(1, 0), PM(1, 1), PM(1, 2) ) - ndc_y*W;
+            d = cross( X, Y );
+
+            // Point away from the eye, where w grows.
+            if( dot( d, W ) < 0 ) d = -d;
+          }
+
           inline Vector2D MeshEdit::unitCubeToScreenSpace(Vector4D & in)
           {
             return Vector2D(screen_w*(in.x + 1)/2, screen_h*(in.y + 1)/2);
           }
 
           // IN :
+          //    PM --- the OpenGL projection matrix times the modelview matrix.
           //    selectionPoint --- coordinates of the cursor in screen space.
           //    A,B,C --- vertex coordinates of the triangle in model space.
           //
@@ -669,6 +745,7 @@ namespace CGL {
           //    barycentricCoordinates --- contains the screen space barycentric coordinates of selectionPoint.
           //
           inline bool MeshEdit::triangleSelectionTest(
+            const Matrix4x4 & PM,
             const Vector2D & selectionPoint,
             Vector4D & A, Vector4D & B, Vector4D & C,
             float & w,
@@ -706,36 +783,14 @@ namespace CGL {
               * 7. Note that opengl coordinate shceme is from lower left corner.
               */
 
-              // -- Step 1, extract relevant opengl matrices.
-
-              GLdouble projMatrix[16];
-              GLdouble modelMatrix[16];
-
-              for(int i = 0; i < 16; i++)
-              {
-                projMatrix[i]  = 0.0;
-                modelMatrix[i] = 0.0;
-              }
-
-              glGetDoublev(GL_PROJECTION_MATRIX, projMatrix);
-              glGetDoublev(GL_MODELVIEW_MATRIX,  modelMatrix);
-
-
-              Matrix4x4 P;
-              Matrix4x4 M;
-
-              for(int r = 0; r < 4; r++)
-              for(int c = 0; c < 4; c++)
-              {
-                P(r, c) = projMatrix [4*c + r];
-                M(r, c) = modelMatrix[4*c + r];
-              }
+              // -- Steps 1 & 2 (extracting the OpenGL matrices) are done once per
+              // -- picking query, by the caller.
 
               // -- Step 3 & 4. Apply Model transform, then Projection transform.
 
-              A = P*M*A;
-              B = P*M*B;
-              C = P*M*C;
+              A = PM*A;
+              B = PM*B;
+              C = PM*C;
 
               // -- Step 5. Projection divide.
               A /= A.w;
@@ -803,7 +858,8 @@ namespace CGL {
               }
 
               // Picking algorithm entry point.
-              // Linear in the number of triangles in the scene.
+              // Casts a ray through the cursor, and finds the nearest face it hits with
+              // the bounding volume hierarchy of each mesh.
               void MeshEdit::findMouseSelection(float x, float y)
               {
                 if(shadingMode)
@@ -813,14 +869,23 @@ namespace CGL {
                   return;
                 }
 
-                bool foundSelection = false; // Will be true if and only if we find a selection.
+                // Extract the OpenGL matrices, as in triangleSelectionTest().
+                GLdouble projMatrix[16];
+                GLdouble modelMatrix[16];
 
-                MeshFeature closestFeature;
-                MeshFeature currentFeature;
-                MeshNode* closestNode;
+                glGetDoublev(GL_PROJECTION_MATRIX, projMatrix);
+                glGetDoublev(GL_MODELVIEW_MATRIX,  modelMatrix);
 
-                Vector4D A, B, C;
-                Vector3D barycentric_min;
+                Matrix4x4 P;
+                Matrix4x4 M;
+
+                for(int r = 0; r < 4; r++)
+                for(int c = 0; c < 4; c++)
+                {
+                  P(r, c) = projMatrix [4*c + r];
+                  M(r, c) = modelMatrix[4*c + r];
+                }
+                Matrix4x4 PM = P*M;
 
                 /*
                 * IMPORTANT NOTE: OpenGL coordinate system orgin at bottom left of
@@ -828,51 +893,58 @@ namespace CGL {
                 */
                 const Vector2D selectionPoint = Vector2D( x, screen_h - y );
 
-                // Start out behind the camera.
-                float w = -1.0;
+                if( gpuPicking )
+                {
+                  findMouseSelectionOnGPU( PM, selectionPoint );
+                  return;
+                }
+
+                // The ray runs from the eye through the point under the cursor.
+                Vector3D o, d;
+                cursorRay( PM, 2*selectionPoint.x/screen_w - 1, 2*selectionPoint.y/screen_h - 1, o, d );
+
+                // Find the nearest face hit in any mesh.
+                double t = numeric_limits<double>::infinity();
+                MeshNode* closestNode = NULL;
+                FaceIter closestFace;
 
-                // Iterate through all meshes.
                 int num_meshes = meshNodes.size();
                 for(int mesh_index = 0; mesh_index < num_meshes; mesh_index++)
                 {
                   MeshNode& node = meshNodes[mesh_index];
-
-                  // Iterate through all triangles.
-                  for( FaceIter f = node.mesh.facesBegin(); f != node.mesh.facesEnd(); f++ )
+                  FaceIter f;
+                  if( node.bvh.intersect( node.mesh, o, d, t, f, t ) )
                   {
-                    // Build a mesh feature corresponding to the current face.
-                    currentFeature.element = elementAddress( f );
-                    currentFeature.node = &node;
-
-                    // Copy the three vertex coordinates of the face into 4D homogeneous coordinates.
-                    A = Vector4D( f->halfedge()->vertex()->position );
-                    B = Vector4D( f->halfedge()->next()->vertex()->position );
-                    C = Vector4D( f->halfedge()->next()->next()->vertex()->position );
-                    A.w = B.w = C.w = 1.;
-
-                    Vector3D barycentricCoordinates;
-                    if( triangleSelectionTest( selectionPoint, A, B, C, w, barycentricCoordinates ) )
-                    // If the cursor is inside triangle ABC --AND-- this triangle is closer to the viewer
-                    // than anything we've seen so far, we'll update the record of the closest feature
-                    // we've seen so far.
-                    {
-                      // Update the record of the closest feature seen so far; note that the value of w
-                      // was already updated in our call to triangleSelectionTest.
-                      barycentric_min = barycentricCoordinates;
-                      closestFeature = currentFeature;
-                      closestNode = &node;
-
-                      foundSelection = true;
-                    }
+                    closestNode = &node;
+                    closestFace = f;
+                  }
+                }
 
-                  } // Done iterating through all triangles.
+                // Work out which feature of the face is under the cursor from its
+                // screen space barycentric coordinates, as before.
+                Vector3D barycentric_min;
+                float w = -1.0;
+                if( closestNode != NULL )
+                {
+                  HalfedgeCIter h = closestFace->halfedge();
+                  Vector4D A = Vector4D( h->vertex()->position );
+                  Vector4D B = Vector4D( h->next()->vertex()->position );
+                  Vector4D C = Vector4D( h->next()->next()->vertex()->position );
+                  A.w = B.w = C.w = 1.;
 
-                } // Done iterating over meshes.
+                  if( !triangleSelectionTest( PM, selectionPoint, A, B, C, w, barycentric_min ) )
+                  {
+                    closestNode = NULL;
+                  }
+                }
 
                 // Update the Current hoveredFeature values.
-                if( foundSelection )
+                if( closestNode != NULL )
                 {
-                  closestFeature.node->fillFeatureStructure( this->hoveredFeature, closestFeature, barycentric_min, w );
+                  MeshFeature closestFeature;
+                  closestFeature.element = elementAddress( closestFace );
+                  closestFeature.node = closestNode;
+                  closestNode->fillFeatureStructure( this->hoveredFeature, closestFeature, barycentric_min, w );
                   hoveredFeature.node = closestNode;
                 }
                 else // If the cursor is not hovering over any element, clear the selection.
@@ -881,6 +953,70 @@ namespace CGL {
                 }
               }
 
+              void MeshEdit::findMouseSelectionOnGPU(const Matrix4x4 & PM, const Vector2D & selectionPoint)
+              {
+                // Draw the ids again if the view or any of the meshes has changed
+                // since they were last drawn.
+                bool stale = pick_w != screen_w || pick_h != screen_h;
+                for(int r = 0; r < 4 && !stale; r++)
+                for(int c = 0; c < 4 && !stale; c++)
+                {
+                  stale = PM(r, c) != pickMatrix(r, c);
+                }
+                for(size_t i = 0; i < meshNodes.size() && !stale; i++)
+                {
+                  stale = meshNodes[i].pick.changed( meshNodes[i].mesh );
+                }
+
+                if( stale )
+                {
+                  pickFramebuffer.begin( screen_w, screen_h );
+                  GLuint base = 0;
+                  for(size_t i = 0; i < meshNodes.size(); i++)
+                  {
+                    meshNodes[i].drawPickIDs( pickFramebuffer, base );
+                    base += meshNodes[i].pick.size();
+                  }
+                  pickFramebuffer.end();
+
+                  pickMatrix = PM;
+                  pick_w = screen_w;
+                  pick_h = screen_h;
+                }
+
+                float depth;
+                GLuint id = pickFramebuffer.read( (int) floor( selectionPoint.x ), (int) floor( selectionPoint.y ), depth );
+                this->hoveredFeature.invalidate();
+                if( id == 0 ) return;
+
+                // Find the mesh the halfedge naming the feature belongs to.
+                Index h = (id - 1) / 4;
+                PickBuffer::Kind kind = (PickBuffer::Kind) ((id - 1) % 4);
+                for(size_t i = 0; i < meshNodes.size(); i++)
+                {
+                  MeshNode& node = meshNodes[i];
+                  if( h >= node.pick.size() )
+                  {
+                    h -= node.pick.size();
+                    continue;
+                  }
+
+                  // Recover the w coordinate of the point under the cursor from its
+                  // depth: along the ray, w grows linearly from 0 at the eye, and z
+                  // linearly from a, so depth (z / w) fixes where the point is.
+                  Vector3D o, d;
+                  cursorRay( PM, 2*selectionPoint.x/screen_w - 1, 2*selectionPoint.y/screen_h - 1, o, d );
+                  double a = PM(2, 0)*o.x + PM(2, 1)*o.y + PM(2, 2)*o.z + PM(2, 3);
+                  double dz = PM(2, 0)*d.x + PM(2, 1)*d.y + PM(2, 2)*d.z;
+                  double dw = PM(3, 0)*d.x + PM(3, 1)*d.y + PM(3, 2)*d.z;
+
+                  hoveredFeature.element = node.pick.element( h, kind );
+                  hoveredFeature.node = &node;
+                  hoveredFeature.w = dw * a / ( (2*depth - 1)*dw - dz );
+                  return;
+                }
+              }
+
               // Copies 'hoveredFeature' to 'selectedFeature'.
               void MeshEdit::enactPotentialSelection()
               {
@@ -945,20 +1081,25 @@ namespace CGL {
                   // -- Geometric Operations
                   void MeshEdit::mesh_up_sample()
                   {
-                    HalfedgeMesh* mesh;
+                    MeshNode* node;
 
                     // If an element is selected, resample the mesh containing that
                     // element; otherwise, resample the first mesh in the scene.
                     if( selectedFeature.isValid() )
                     {
-                      mesh = &( selectedFeature.node->mesh );
+                      node = selectedFeature.node;
                     }
                     else
                     {
-                      mesh = &( meshNodes.begin()->mesh );
+                      node = &( *meshNodes.begin() );
                     }
 
-                    resampler.upsample( *mesh );
+                    // The journal cannot follow a global change to the mesh.
+                    clearJournal( node );
+                    resampler.upsampleParallel( node->mesh );
+                    node->buffer.invalidate();
+                    node->bvh.invalidate();
+                    node->pick.invalidate();
 
                     // Since the mesh may have changed, the selected and
                     // hovered features may no longer point to valid elements.
@@ -966,11 +1107,109 @@ namespace CGL {
                     hoveredFeature.invalidate();
                   }
 
+                  void MeshEdit::mesh_down_sample()
+                  {
+                    MeshNode* node;
+
+                    // Same choice of mesh as mesh_up_sample().
+                    if( selectedFeature.isValid() )
+                    {
+                      node = selectedFeature.node;
+                    }
+                    else
+                    {
+                      node = &( *meshNodes.begin() );
+                    }
+
+                    // Halve the number of faces, collapsing the cheapest edges first.
+                    clearJournal( node );
+                    resampler.downsample( node->mesh, node->mesh.nFaces() / 2 );
+                    node->buffer.invalidate();
+                    node->bvh.invalidate();
+                    node->pick.invalidate();
+
+                    selectedFeature.invalidate();
+                    hoveredFeature.invalidate();
+                  }
+
+                  void MeshEdit::recordEdit( MeshNode* node )
+                  {
+                    // A new operation can't be followed by the ones that were undone,
+                    // on this mesh or any other, so free the elements they created.
+                    for( size_t i = editsApplied; i < editNodes.size(); i++ )
+                    {
+                      MeshNode& dropped = meshNodes[ editNodes[i] ];
+                      dropped.journal.discardRedo( dropped.mesh );
+                    }
+                    editNodes.resize( editsApplied );
+                    editNodes.push_back( node - &meshNodes[0] );
+                    editsApplied++;
+                  }
+
+                  void MeshEdit::clearJournal( MeshNode* node )
+                  {
+                    node->journal.clear( node->mesh );
+
+                    size_t n = node - &meshNodes[0], kept = 0, keptApplied = 0;
+                    for( size_t i = 0; i < editNodes.size(); i++ )
+                    {
+                      if( editNodes[i] == n ) continue;
+                      if( i < editsApplied ) keptApplied++;
+                      editNodes[kept++] = editNodes[i];
+                    }
+                    editNodes.resize( kept );
+                    editsApplied = keptApplied;
+                  }
+
+                  void MeshEdit::undo()
+                  {
+                    // Undo on the mesh of the last operation, which is no
+                    // longer selected after a flip or split.
+                    if( editsApplied == 0 ) { cerr << "Nothing to undo." << endl; return; }
+                    MeshNode* node = &meshNodes[ editNodes[ editsApplied - 1 ] ];
+
+                    if( !node->journal.undo( node->mesh ) ) { cerr << "Nothing to undo." << endl; return; }
+                    editsApplied--;
+                    node->buffer.invalidate();
+                    node->bvh.invalidate();
+                    node->pick.invalidate();
+
+                    // The elements that were undone may have been selected.
+                    selectedFeature.invalidate();
+                    hoveredFeature.invalidate();
+                  }
+
+                  void MeshEdit::redo()
+                  {
+                    if( editsApplied == editNodes.size() ) { cerr << "Nothing to redo." << endl; return; }
+                    MeshNode* node = &meshNodes[ editNodes[ editsApplied ] ];
+
+                    if( !node->journal.redo( node->mesh ) ) { cerr << "Nothing to redo." << endl; return; }
+                    editsApplied++;
+                    node->buffer.invalidate();
+                    node->bvh.invalidate();
+                    node->pick.invalidate();
+
+                    selectedFeature.invalidate();
+                    hoveredFeature.invalidate();
+                  }
+
                   inline void MeshEdit::drawString(float x, float y, string str, size_t size, Color c)
                   {
-                    int line_index = text_mgr.add_line(( x*2/screen_w) - 1.0,
-                    (-y*2/screen_h) + 1.0, str, size, c);
-                    messages.push_back(line_index);
+                    float line_x = ( x*2/screen_w) - 1.0, line_y = (-y*2/screen_h) + 1.0;
+                    if( numMessages < messages.size() )
+                    {
+                      int line_index = messages[numMessages];
+                      text_mgr.set_anchor(line_index, line_x, line_y);
+                      text_mgr.set_text(line_index, str);
+                      text_mgr.set_size(line_index, size);
+                      text_mgr.set_color(line_index, c);
+                    }
+                    else
+                    {
+                      messages.push_back(text_mgr.add_line(line_x, line_y, str, size, c));
+                    }
+                    numMessages++;
                   }
 
                   /*
@@ -983,14 +1222,8 @@ namespace CGL {
                   void MeshEdit::drawHUD()
                   {
 
-                    // Delete the current Lines every time.
-                    int len = messages.size();
-                    for(int i = 0; i < len; i++)
-                    {
-                      int line_index = messages[i];
-                      text_mgr.del_line(line_index);
-                    }
-                    messages.clear();
+                    // Overwrite the current lines in order.
+                    numMessages = 0;
 
 
                     const size_t size = 16;
@@ -1113,6 +1346,13 @@ namespace CGL {
 
                     }
 
+                    // Delete the lines left over from the last frame.
+                    for(size_t i = numMessages; i < messages.size(); i++)
+                    {
+                      text_mgr.del_line(messages[i]);
+                    }
+                    messages.resize(numMessages);
+
                     // -- First draw a lovely black rectangle.
 
                     glPushAttrib( GL_VIEWPORT_BIT );
@@ -1180,13 +1420,18 @@ namespace CGL {
                     glColor3f(c.r, c.g, c.b);
                   }
 
-                  void MeshEdit::renderMesh( HalfedgeMesh& mesh )
+                  void MeshEdit::renderMesh( MeshNode& node )
                   {
+                    HalfedgeMesh& mesh = node.mesh;
+
                     if(shadingMode)
                     glUseProgram(shaderProgID);
                     else
                     glUseProgram(0);
                     glEnable(GL_LIGHTING);
+                    if( useBuffers )
+                    drawBufferedFaces( node );
+                    else
                     drawFaces( mesh );
                     glDisable(GL_LIGHTING);
 
@@ -1195,6 +1440,9 @@ namespace CGL {
                     if(!shadingMode)
                     {
                       // Edges are drawn with flat shading.
+                      if( useBuffers )
+                      drawBufferedEdges( node );
+                      else
                       drawEdges( mesh );
 
                       drawVertices( mesh );
@@ -1229,6 +1477,9 @@ namespace CGL {
 
                   void MeshEdit::drawFaces( HalfedgeMesh& mesh )
                   {
+                    // Bring the cached normals up to date (only those invalidated
+                    // by edits since the last frame are recomputed).
+                    mesh.updateNormals();
 
                     for( FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++ )
                     {
@@ -1274,6 +1525,52 @@ namespace CGL {
 
                   }
 
+                  void MeshEdit::drawBufferedFaces( MeshNode& node )
+                  {
+                    glEnable(GL_POLYGON_OFFSET_FILL);
+                    glPolygonOffset( 1.0, 1.0 );
+
+                    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
+                    glEnable(GL_COLOR_MATERIAL);
+
+                    // Draw every face in the default style at once...
+                    setColor( defaultStyle.faceColor );
+                    node.buffer.drawFaces( node.mesh, smoothShading );
+
+                    // ...then draw the hovered and selected faces over them, using
+                    // the very same vertices so they pass the depth test.
+                    glDepthFunc( GL_LEQUAL );
+                    MeshFeature* features[2] = { &hoveredFeature, &selectedFeature };
+                    for( int i = 0; i < 2; i++ )
+                    {
+                      if( !features[i]->isValid() || features[i]->node != &node ) continue;
+                      Face* f = features[i]->element->getFace();
+                      if( f == NULL ) continue;
+                      setElementStyle( f );
+                      node.buffer.drawFace( f );
+                    }
+                    glDepthFunc( GL_LESS );
+                  }
+
+                  void MeshEdit::drawBufferedEdges( MeshNode& node )
+                  {
+                    setColor( defaultStyle.edgeColor );
+                    glLineWidth( defaultStyle.strokeWidth );
+                    node.buffer.drawEdges( node.mesh );
+
+                    glDepthFunc( GL_LEQUAL );
+                    MeshFeature* features[2] = { &hoveredFeature, &selectedFeature };
+                    for( int i = 0; i < 2; i++ )
+                    {
+                      if( !features[i]->isValid() || features[i]->node != &node ) continue;
+                      Edge* e = features[i]->element->getEdge();
+                      if( e == NULL ) continue;
+                      setElementStyle( e );
+                      node.buffer.drawEdge( e );
+                    }
+                    glDepthFunc( GL_LESS );
+                  }
+
                   void MeshEdit::drawEdges( HalfedgeMesh& mesh )
                   {
                     for( EdgeIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++ ) // iterate over edges
@@ -1473,11 +1770,23 @@ namespace CGL {
                       return;
                     }
 
+                    void MeshNode::drawPickIDs( PickFramebuffer & framebuffer, GLuint base )
+                    {
+                      framebuffer.setMesh( base, low_threshold, mid_threshold, high_threshold );
+                      pick.draw( mesh );
+                    }
+
                     void MeshEdit :: flipSelectedEdge( void )
                     {
                       Edge* e = selectedFeature.element->getEdge();
                       if( e == NULL ) { cerr << "Must select an edge." << endl; return; }
-                      selectedFeature.node->mesh.flipEdge( e->halfedge()->edge() );
+                      // Boundary edges are left as they are, and not journaled.
+                      bool flippable = !e->isBoundary();
+                      EdgeIter flipped = selectedFeature.node->journal.flipEdge( selectedFeature.node->mesh, e->halfedge()->edge() );
+                      if( flippable ) recordEdit( selectedFeature.node );
+                      selectedFeature.node->buffer.invalidate();
+                      selectedFeature.node->bvh.updateVertex( elementAddress( flipped->halfedge()->vertex() ) );
+                      selectedFeature.node->pick.invalidate();
 
                       // Since the mesh may have changed, the selected and
                       // hovered features may no longer point to valid elements.
@@ -1489,7 +1798,11 @@ namespace CGL {
                     {
                       Edge* e = selectedFeature.element->getEdge();
                       if( e == NULL ) { cerr << "Must select an edge." << endl; return; }
-                      selectedFeature.node->mesh.splitEdge( e->halfedge()->edge() );
+                      VertexIter v = selectedFeature.node->journal.splitEdge( selectedFeature.node->mesh, e->halfedge()->edge() );
+                      recordEdit( selectedFeature.node );
+                      selectedFeature.node->buffer.invalidate();
+                      selectedFeature.node->bvh.updateVertex( elementAddress( v ) );
+                      selectedFeature.node->pick.invalidate();
 
                       // Since the mesh may have changed, the selected and
                       // hovered features may no longer point to valid elements.
@@ -12,6 +12,11 @@
 #include "mesh.h"
 #include "material.h"
 #include "halfEdgeMesh.h"
+#include "meshBuffer.h"
+#include "faceBVH.h"
+#include "pickBuffer.h"
+#include "meshJournal.h"
+#include "meshCache.h"
 #include "student_code.h"
 
 #include <string>
@@ -126,20 +131,10 @@ namespace CGL {
          MeshNode( Polymesh& polyMesh )
          {
 
-            // Construct a new array of index lists for the halfedgemesh structure.
-            vector< vector<size_t> > polygons;
-
             // Currently, the halfedge data structure only stores the connectivity of
-            // the mesh and the vertex positions; here we just want to copy the
-            // connectivity into our local array ("polygons").
-            for( PolyListIter p  = polyMesh.polygons.begin();
-                              p != polyMesh.polygons.end();
-                              p ++ )
-            {
-               polygons.push_back( p->vertex_indices );
-            }
-
-            mesh.build( polygons, polyMesh.vertices );
+            // the mesh and the vertex positions; this copies the connectivity (straight
+            // from the cached twins of the halfedges, if the mesh came from a cache).
+            buildHalfedgeMesh( polyMesh, mesh );
          }
 
          // Destructor --- this destructor shouldn't be needed according to the
@@ -177,10 +172,29 @@ namespace CGL {
                                    Vector3D    & barycentric_coords,
                                    float w);
 
+         /*
+          * Draws the ids of the features of the mesh into the given pick
+          * framebuffer (between its begin() and end()), offset by base, with
+          * the same thresholds as fillFeatureStructure().
+          */
+         void drawPickIDs(PickFramebuffer & framebuffer, GLuint base);
+
 
          // representation of the mesh geometry itself
          HalfedgeMesh mesh;
 
+         // copy of the mesh in OpenGL buffers, used when MeshEdit::useBuffers is set
+         MeshBuffer buffer;
+
+         // bounding volume hierarchy over the faces, used to find the face under the cursor
+         FaceBVH bvh;
+
+         // copy of the faces in an OpenGL buffer with element ids, used for picking on the GPU
+         PickBuffer pick;
+
+         // history of the local edits (flips, splits and vertex moves) made to the mesh
+         MeshJournal journal;
+
          // This vector gives us indexed hooks into the half edge structure,
          // which can be used to query information for the debugging messages.
          std::vector<Vertex*> half_edge_vertices;
@@ -242,6 +256,8 @@ class MeshEdit : public Renderer {
 
   bool shadingMode;
   bool smoothShading;
+  bool useBuffers; // draw faces and edges from vertex buffer objects rather than in immediate mode
+  bool gpuPicking; // find the element under the cursor in an id buffer drawn on the GPU rather than with a ray
 
   // Specify the location of eye and what it is pointing at.
   Vector3D view_focus;
@@ -279,9 +295,11 @@ class MeshEdit : public Renderer {
   void reset_camera();
 
   // Rendering functions.
-  void renderMesh   ( HalfedgeMesh& mesh );
+  void renderMesh   ( MeshNode& node );
   void drawFaces    ( HalfedgeMesh& mesh );
   void drawEdges    ( HalfedgeMesh& mesh );
+  void drawBufferedFaces( MeshNode& node );
+  void drawBufferedEdges( MeshNode& node );
   void drawVertices ( HalfedgeMesh& mesh );
   void drawHalfedges( HalfedgeMesh& mesh );
   void drawHalfedgeArrow( Halfedge* h );
@@ -315,6 +333,7 @@ class MeshEdit : public Renderer {
   bool left_down;
   bool right_down;
   bool middle_down;
+  bool draggingVertex; // the selected vertex has been moved since the button was pressed
 
   void mouseP(e_mouse_button b);// Mouse pressed.
   void mouseR(e_mouse_button b);// Mouse Released.
@@ -330,9 +349,16 @@ class MeshEdit : public Renderer {
   // Executes the picking algorithm.
   // result stored in 'hover_selection'.
   void findMouseSelection(float x, float y);
+  // The same, by reading back one pixel of the pick framebuffer, which is
+  // only drawn again when the view or a mesh has changed.
+  void findMouseSelectionOnGPU(const Matrix4x4 & PM, const Vector2D & selectionPoint);
   // Copies 'hover_selection' to 'current_selection' on mouse release.
   void enactPotentialSelection();
 
+  PickFramebuffer pickFramebuffer;
+  Matrix4x4 pickMatrix;    // projection-modelview matrix the ids were last drawn with
+  size_t pick_w, pick_h;   // size they were last drawn at (0 if never)
+
   /**
    * IN: screen_x_offset -- offset in screen space in x direction.
    *     screen_y_offset -- offset in screen space in y direction.
@@ -344,7 +370,8 @@ class MeshEdit : public Renderer {
 
 
   inline bool triangleSelectionTest
-	(const Vector2D & selectionPoint,
+	(const Matrix4x4 & PM,
+	 const Vector2D & selectionPoint,
 	 Vector4D & A, Vector4D & B, Vector4D & C,
 	 float & w,
          Vector3D& barycentricCoordinates );
@@ -359,6 +386,23 @@ class MeshEdit : public Renderer {
   void splitSelectedEdge( void );
   // Sets up and calls the MeshResampler with the appropiate operation.
   void mesh_up_sample();
+  void mesh_down_sample();
+  // Undoes or redoes the last local operation in the scene, on whichever
+  // mesh it was made.
+  void undo();
+  void redo();
+
+  // Mesh node (index into meshNodes) of each local operation that can be
+  // undone or redone, in the order they were made; the first editsApplied of
+  // them are applied.  The operations themselves are kept by the journal of
+  // each node.
+  vector<size_t> editNodes;
+  size_t editsApplied;
+  // Records a local operation just made through the journal of a node.
+  void recordEdit( MeshNode* node );
+  // Clears the journal of a node before a global change, forgetting its
+  // operations.
+  void clearJournal( MeshNode* node );
 
   // If a halfedge is selected, advances to the next or twin halfedge.
   void selectNextHalfedge( void );
@@ -371,7 +415,10 @@ class MeshEdit : public Renderer {
   // OSD text manager
   OSDText text_mgr;
 
+  // OSD lines of the HUD, reused from one frame to the next so that only
+  // the ones whose text changed have to be rebuilt.
   vector<int> messages;
+  size_t numMessages;
 
   // -- Debugging strings.
   bool showHUD;
@@ -0,0 +1,201 @@
+#include "meshJournal.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace CGL {
+
+  // Each entry holds a few dozen elements at most, so a linear search is
+  // the cheapest way to avoid saving one twice.
+  template<class I, class T>
+  static bool contains(const vector< pair<I, T> >& records, I i) {
+    for (Index k = 0; k < records.size(); k++) {
+      if (records[k].first == i) return true;
+    }
+    return false;
+  }
+
+  // (The element is taken as a pair<I, T>::first_type, rather than deduced,
+  // so that the links returned by the element accessors convert to I.)
+  template<class I, class T>
+  static void add(vector< pair<I, T> >& records, typename pair<I, T>::first_type i) {
+    if (!contains(records, i)) records.push_back(make_pair(i, *i));
+  }
+
+  void MeshJournal::addVertex(Entry& entry, VertexIter v) {
+    add(entry.vertices, v);
+  }
+
+  void MeshJournal::addEdge(Entry& entry, EdgeIter e) {
+    add(entry.edges, e);
+    add(entry.halfedges, e->halfedge());
+    add(entry.halfedges, e->halfedge()->twin());
+  }
+
+  void MeshJournal::addFace(Entry& entry, FaceIter f) {
+    // A face, everything on its boundary, and the halfedges just outside of
+    // it (including the boundary loop they belong to, if any).
+    add(entry.faces, f);
+    HalfedgeIter h = f->halfedge();
+    do {
+      add(entry.halfedges, h);
+      add(entry.halfedges, h->twin());
+      add(entry.vertices, h->vertex());
+      add(entry.edges, h->edge());
+      if (h->twin()->isBoundary()) add(entry.faces, h->twin()->face());
+      h = h->next();
+    } while (h != f->halfedge());
+  }
+
+  // Moves the elements of entry that were not saved in before to its lists of
+  // new elements.
+  void MeshJournal::addNew(Entry& entry, const Entry& before) {
+    for (Index k = 0; k < entry.halfedges.size(); k++) {
+      if (!contains(before.halfedges, entry.halfedges[k].first)) entry.newHalfedges.push_back(entry.halfedges[k].first);
+    }
+    for (Index k = 0; k < entry.vertices.size(); k++) {
+      if (!contains(before.vertices, entry.vertices[k].first)) entry.newVertices.push_back(entry.vertices[k].first);
+    }
+    for (Index k = 0; k < entry.edges.size(); k++) {
+      if (!contains(before.edges, entry.edges[k].first)) entry.newEdges.push_back(entry.edges[k].first);
+    }
+    for (Index k = 0; k < entry.faces.size(); k++) {
+      if (!contains(before.faces, entry.faces[k].first)) entry.newFaces.push_back(entry.faces[k].first);
+    }
+  }
+
+  MeshJournal& MeshJournal::operator=(const MeshJournal& journal) {
+    if (this != &journal) {
+      entries.clear();
+      current = 0;
+    }
+    return *this;
+  }
+
+  MeshJournal::Entry& MeshJournal::begin(HalfedgeMesh& mesh) {
+    discardRedo(mesh);
+    entries.push_back(Entry());
+    current = entries.size();
+    return entries.back();
+  }
+
+  EdgeIter MeshJournal::flipEdge(HalfedgeMesh& mesh, EdgeIter e) {
+    if (e->isBoundary()) return mesh.flipEdge(e);
+
+    Entry& entry = begin(mesh);
+    addEdge(entry, e);
+    addFace(entry, e->halfedge()->face());
+    addFace(entry, e->halfedge()->twin()->face());
+
+    return mesh.flipEdge(e);
+  }
+
+  VertexIter MeshJournal::splitEdge(HalfedgeMesh& mesh, EdgeIter e) {
+    Entry& entry = begin(mesh);
+    addEdge(entry, e);
+    if (!e->halfedge()->isBoundary()) addFace(entry, e->halfedge()->face());
+    if (!e->halfedge()->twin()->isBoundary()) addFace(entry, e->halfedge()->twin()->face());
+
+    VertexIter v = mesh.splitEdge(e);
+
+    // Everything the split created lies around the new vertex.
+    Entry after;
+    addVertex(after, v);
+    HalfedgeIter h = v->halfedge();
+    do {
+      addEdge(after, h->edge());
+      if (!h->isBoundary()) addFace(after, h->face());
+      else add(after.faces, h->face());
+      h = h->twin()->next();
+    } while (h != v->halfedge());
+    addNew(after, entry);
+
+    entry.newHalfedges.swap(after.newHalfedges);
+    entry.newVertices.swap(after.newVertices);
+    entry.newEdges.swap(after.newEdges);
+    entry.newFaces.swap(after.newFaces);
+
+    return v;
+  }
+
+  void MeshJournal::moveVertex(HalfedgeMesh& mesh, VertexIter v) {
+    Entry& entry = begin(mesh);
+    addVertex(entry, v);
+  }
+
+  // Exchanges the saved elements with the ones in the mesh, which turns the
+  // entry from "before" into "after", or vice versa.
+  void MeshJournal::swap(HalfedgeMesh& mesh, Entry& entry) {
+    for (Index k = 0; k < entry.halfedges.size(); k++) std::swap(*entry.halfedges[k].first, entry.halfedges[k].second);
+    for (Index k = 0; k < entry.vertices.size(); k++) mesh.exchange(entry.vertices[k].first, entry.vertices[k].second);
+    for (Index k = 0; k < entry.edges.size(); k++) std::swap(*entry.edges[k].first, entry.edges[k].second);
+    for (Index k = 0; k < entry.faces.size(); k++) mesh.exchange(entry.faces[k].first, entry.faces[k].second);
+
+    // The cached normals that were swapped in (and those of the neighbors,
+    // which were not saved) may belong to another state of the mesh.
+    for (Index k = 0; k < entry.vertices.size(); k++) mesh.invalidateNormals(entry.vertices[k].first);
+  }
+
+  bool MeshJournal::undo(HalfedgeMesh& mesh) {
+    if (!canUndo()) return false;
+    Entry& entry = entries[--current];
+
+    for (Index k = 0; k < entry.newHalfedges.size(); k++) mesh.detach(entry.newHalfedges[k]);
+    for (Index k = 0; k < entry.newVertices.size(); k++) mesh.detach(entry.newVertices[k]);
+    for (Index k = 0; k < entry.newEdges.size(); k++) mesh.detach(entry.newEdges[k]);
+    for (Index k = 0; k < entry.newFaces.size(); k++) mesh.detach(entry.newFaces[k]);
+    swap(mesh, entry);
+
+    return true;
+  }
+
+  bool MeshJournal::redo(HalfedgeMesh& mesh) {
+    if (!canRedo()) return false;
+    Entry& entry = entries[current++];
+
+    for (Index k = 0; k < entry.newHalfedges.size(); k++) mesh.attach(entry.newHalfedges[k]);
+    for (Index k = 0; k < entry.newVertices.size(); k++) mesh.attach(entry.newVertices[k]);
+    for (Index k = 0; k < entry.newEdges.size(); k++) mesh.attach(entry.newEdges[k]);
+    for (Index k = 0; k < entry.newFaces.size(); k++) mesh.attach(entry.newFaces[k]);
+    swap(mesh, entry);
+
+    return true;
+  }
+
+  // Drops the entries that were undone; the elements they created are
+  // detached from the mesh, and can now be destroyed.
+  void MeshJournal::discardRedo(HalfedgeMesh& mesh) {
+    for (Index i = current; i < entries.size(); i++) {
+      Entry& entry = entries[i];
+      for (Index k = 0; k < entry.newHalfedges.size(); k++) mesh.discard(entry.newHalfedges[k]);
+      for (Index k = 0; k < entry.newVertices.size(); k++) mesh.discard(entry.newVertices[k]);
+      for (Index k = 0; k < entry.newEdges.size(); k++) mesh.discard(entry.newEdges[k]);
+      for (Index k = 0; k < entry.newFaces.size(); k++) mesh.discard(entry.newFaces[k]);
+    }
+    entries.resize(current);
+  }
+
+  void MeshJournal::clear(HalfedgeMesh& mesh) {
+    discardRedo(mesh);
+    entries.clear();
+    current = 0;
+  }
+
+  Size MeshJournal::bytes() const {
+    Size n = entries.capacity() * sizeof(Entry);
+    for (Index i = 0; i < entries.size(); i++) {
+      const Entry& entry = entries[i];
+      n += entry.halfedges.capacity() * sizeof(entry.halfedges[0]);
+      n += entry.vertices.capacity() * sizeof(entry.vertices[0]);
+      n += entry.edges.capacity() * sizeof(entry.edges[0]);
+      n += entry.faces.capacity() * sizeof(entry.faces[0]);
+      n += entry.newHalfedges.capacity() * sizeof(HalfedgeIter);
+      n += entry.newVertices.capacity() * sizeof(VertexIter);
+      n += entry.newEdges.capacity() * sizeof(EdgeIter);
+      n += entry.newFaces.capacity() * sizeof(FaceIter);
+    }
+    return n;
+  }
+
+}
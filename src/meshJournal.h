@@ -0,0 +1,103 @@
+#ifndef CGL_MESHJOURNAL_H
+#define CGL_MESHJOURNAL_H
+
+#include "halfEdgeMesh.h"
+
+namespace CGL {
+
+  /**
+   * A MeshJournal keeps the undo/redo history of local edits to a
+   * HalfedgeMesh: edge flips, edge splits and vertex moves.
+   *
+   * Rather than a copy of the whole mesh, each entry stores a copy of just
+   * the elements the edit may change (the faces around the edge, with their
+   * halfedges, vertices and edges, or the moved vertex), plus a list of the
+   * elements it created.  Undoing an edit swaps the saved copies back in and
+   * detaches the created elements from the mesh; redoing it reattaches them
+   * and swaps again.  Created elements are never destroyed while they may
+   * still be redone, so every iterator stored in the journal stays valid,
+   * and the memory used is proportional to the size of the edits.
+   *
+   * The journal only knows about the edits made through it, and undo()
+   * expects the mesh to be exactly as the most recent edit left it.  So any
+   * other change to the connectivity of the mesh (e.g., resampling it) must
+   * be preceded by a call to clear().
+   */
+  class MeshJournal {
+  public:
+
+    MeshJournal() : current(0) {}
+
+    // Copies would hold iterators into a different mesh, so they start out
+    // empty, as after clear().
+    MeshJournal(const MeshJournal& journal) : current(0) {}
+    MeshJournal& operator=(const MeshJournal& journal);
+
+    /**
+     * Flips or splits the given edge, recording the change.
+     */
+    EdgeIter flipEdge(HalfedgeMesh& mesh, EdgeIter e);
+    VertexIter splitEdge(HalfedgeMesh& mesh, EdgeIter e);
+
+    /**
+     * Records the current state of a vertex that is about to be moved; call
+     * it once at the start of each drag, not for every step.
+     */
+    void moveVertex(HalfedgeMesh& mesh, VertexIter v);
+
+    /**
+     * Reverts the most recent edit (or replays the most recently reverted
+     * one).  Returns false if there is nothing to undo (redo).
+     */
+    bool undo(HalfedgeMesh& mesh);
+    bool redo(HalfedgeMesh& mesh);
+
+    bool canUndo() const { return current > 0; }
+    bool canRedo() const { return current < entries.size(); }
+
+    /**
+     * Forgets the whole history, destroying the elements created by edits
+     * that were undone.
+     */
+    void clear(HalfedgeMesh& mesh);
+
+    /**
+     * Forgets the edits that were undone (and could be redone), destroying
+     * the elements they created, as a new edit does.
+     */
+    void discardRedo(HalfedgeMesh& mesh);
+
+    /**
+     * Memory used by the saved elements, in bytes.
+     */
+    Size bytes() const;
+
+  private:
+
+    struct Entry {
+      vector< pair<HalfedgeIter, Halfedge> > halfedges;
+      vector< pair<VertexIter, Vertex> > vertices;
+      vector< pair<EdgeIter, Edge> > edges;
+      vector< pair<FaceIter, Face> > faces;       ///< interior faces and boundary loops
+
+      vector<HalfedgeIter> newHalfedges;
+      vector<VertexIter> newVertices;
+      vector<EdgeIter> newEdges;
+      vector<FaceIter> newFaces;
+    };
+
+    Entry& begin(HalfedgeMesh& mesh);
+    void swap(HalfedgeMesh& mesh, Entry& entry);
+
+    static void addEdge(Entry& entry, EdgeIter e);
+    static void addFace(Entry& entry, FaceIter f);
+    static void addVertex(Entry& entry, VertexIter v);
+    static void addNew(Entry& entry, const Entry& before);
+
+    vector<Entry> entries;
+    Size current;   ///< number of entries currently applied to the mesh
+  };
+
+}
+
+#endif // CGL_MESHJOURNAL_H
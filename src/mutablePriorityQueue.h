@@ -1,5 +1,5 @@
 /*
-* HalfedgeMesh.h
+* MutablePriorityQueue.h
 *
 * Written By Keenan Crane for 15-462 Assignment 2.
 */
@@ -7,15 +7,14 @@
 /**
 * A MutablePriorityQueue is a minimum-priority queue that
 * allows elements to be both inserted and removed from the
-* queue.  Together, one can easily change the priority of
-* an item by removing it, and re-inserting the same item
-* but with a different priority.  A priority queue, for
-* those who don't remember or haven't seen it before, is a
-* data structure that always keeps track of the item with
-* the smallest priority or "score," even as new elements
-* are inserted and removed.  Priority queues are often an
-* essential component of greedy algorithms, where one wants
-* to iteratively operate on the current "best" element.
+* queue, and the priority of an element already in the queue
+* to be changed.  A priority queue, for those who don't
+* remember or haven't seen it before, is a data structure that
+* always keeps track of the item with the smallest priority or
+* "score," even as new elements are inserted and removed.
+* Priority queues are often an essential component of greedy
+* algorithms, where one wants to iteratively operate on the
+* current "best" element.
 *
 * MutablePriorityQueue is templated on the type T of the object
 * being queued.  For this reason, T must define a comparison
@@ -23,8 +22,15 @@
 *
 *    bool operator<( const T& t1, const T& t2 )
 *
-* which returns true if and only if t1 is considered to have a
-* lower priority than t2.
+* which returns true if and only if t1 should come out of the
+* queue before t2.
+*
+* Every call to insert() returns a Handle, which names that
+* item until it leaves the queue (through pop() or remove()).
+* Handles are small integers, so a caller that needs to find
+* the queued copy of one of its own objects again can simply
+* keep them in an array.  Once an item has left the queue its
+* handle may be reused by a later insert().
 *
 * Basic use of a MutablePriorityQueue might look
 * something like this:
@@ -34,10 +40,11 @@
 *
 *    // add some items (which we assume have been created
 *    // elsewhere, each of which has its priority stored as
-*    // some kind of internal member variable)
-*    queue.insertItem( item1 );
-*    queue.insertItem( item2 );
-*    queue.insertItem( item3 );
+*    // some kind of internal member variable), remembering
+*    // their handles
+*    MutablePriorityQueue<myItemType>::Handle h1 = queue.insert( item1 );
+*    MutablePriorityQueue<myItemType>::Handle h2 = queue.insert( item2 );
+*    MutablePriorityQueue<myItemType>::Handle h3 = queue.insert( item3 );
 *
 *    // get the highest priority item currently in the queue
 *    myItemType highestPriorityItem = queue.top();
@@ -50,51 +57,210 @@
 *
 *    // Etc.
 *
-*    // We can also remove an item, making sure it is no
-*    // longer in the queue (note that this item may already
-*    // have been removed, if it was the 1st or 2nd-highest
-*    // priority item!)
-*    queue.remove( item2 );
+*    // We can also change the priority of an item, or
+*    // remove it outright (both return false, and do nothing,
+*    // if the item is no longer queued, e.g., because it was
+*    // the 1st or 2nd-highest priority item!)
+*    queue.update( h3, item3WithNewPriority );
+*    queue.remove( h2 );
 *
+* Internally the queue is a D-ary heap of handles (4-ary by
+* default, which is shallower and more cache friendly than a
+* binary heap), and the items themselves live contiguously in
+* a vector indexed by handle.  Every operation other than top()
+* therefore takes O(log n) time without allocating memory,
+* except when the queue grows.
 */
 
-#ifndef CGL_CAMERA_H
-#define CGL_CAMERA_H
+#ifndef CGL_MUTABLEPRIORITYQUEUE_H
+#define CGL_MUTABLEPRIORITYQUEUE_H
+
+#include <vector>
+#include <cstddef>
 
 namespace CGL
 {
 
-  template<class T>
+  template<class T, size_t D = 4>
   class MutablePriorityQueue
   {
   public:
-    void insert( const T& item )
+    typedef size_t Handle;
+
+    static const Handle none = (Handle) -1; ///< a handle that never names a queued item
+
+    Handle insert( const T& item )
     {
-      queue.insert( item );
+      Handle h;
+      if( !freeHandles.empty() )
+      {
+        h = freeHandles.back();
+        freeHandles.pop_back();
+        items[h] = item;
+      }
+      else
+      {
+        h = items.size();
+        items.push_back( item );
+        position.push_back( none );
+      }
+
+      position[h] = heap.size();
+      heap.push_back( h );
+      siftUp( position[h] );
+      return h;
     }
 
-    void remove( const T& item )
+    // Returns true if the handle named a queued item.
+    bool remove( Handle h )
     {
-      if( queue.find( item ) != queue.end() )
+      if( !contains( h ) ) return false;
+
+      size_t i = position[h];
+      size_t last = heap.size() - 1;
+      if( i != last )
+      {
+        place( heap[last], i );
+        heap.pop_back();
+        // The item moved into the hole may belong above or below it.
+        if( !siftUp( i ) ) siftDown( i );
+      }
+      else
       {
-        queue.erase( item );
+        heap.pop_back();
       }
+      release( h );
+      return true;
+    }
+
+    // Replaces a queued item, e.g., with a copy whose priority has changed.
+    // Returns true if the handle named a queued item.
+    bool update( Handle h, const T& item )
+    {
+      if( !contains( h ) ) return false;
+
+      items[h] = item;
+      if( !siftUp( position[h] ) ) siftDown( position[h] );
+      return true;
+    }
+
+    bool contains( Handle h ) const
+    {
+      return h < position.size() && position[h] != none;
+    }
+
+    const T& operator[]( Handle h ) const
+    {
+      return items[h];
     }
 
     const T& top( void ) const
     {
-      return *( queue.begin() );
+      return items[ heap[0] ];
+    }
+
+    Handle topHandle( void ) const
+    {
+      return heap[0];
     }
 
     void pop( void )
     {
-      queue.erase( queue.begin() );
+      remove( heap[0] );
+    }
+
+    bool empty( void ) const
+    {
+      return heap.empty();
+    }
+
+    size_t size( void ) const
+    {
+      return heap.size();
+    }
+
+    void reserve( size_t n )
+    {
+      items.reserve( n );
+      position.reserve( n );
+      heap.reserve( n );
+    }
+
+    void clear( void )
+    {
+      items.clear();
+      position.clear();
+      heap.clear();
+      freeHandles.clear();
     }
 
   protected:
-    set<T> queue;
+    bool before( size_t i, size_t j ) const
+    {
+      return items[ heap[i] ] < items[ heap[j] ];
+    }
+
+    void place( Handle h, size_t i )
+    {
+      heap[i] = h;
+      position[h] = i;
+    }
+
+    void release( Handle h )
+    {
+      position[h] = none;
+      freeHandles.push_back( h );
+    }
+
+    // Moves the entry at heap position i up to its place; returns true if it moved.
+    bool siftUp( size_t i )
+    {
+      Handle h = heap[i];
+      size_t start = i;
+      while( i > 0 )
+      {
+        size_t parent = (i-1) / D;
+        if( !( items[h] < items[ heap[parent] ] ) ) break;
+        place( heap[parent], i );
+        i = parent;
+      }
+      place( h, i );
+      return i != start;
+    }
+
+    // Moves the entry at heap position i down to its place.
+    void siftDown( size_t i )
+    {
+      Handle h = heap[i];
+      size_t n = heap.size();
+      while( true )
+      {
+        size_t first = D*i + 1;
+        if( first >= n ) break;
+
+        size_t best = first;
+        size_t end = first + D < n ? first + D : n;
+        for( size_t c = first + 1; c < end; c++ )
+        {
+          if( before( c, best ) ) best = c;
+        }
+
+        if( !( items[ heap[best] ] < items[h] ) ) break;
+        place( heap[best], i );
+        i = best;
+      }
+      place( h, i );
+    }
+
+    std::vector<T> items;              ///< queued items, indexed by handle
+    std::vector<size_t> position;      ///< heap position of each handle, or none if it is free
+    std::vector<Handle> heap;          ///< handles in heap order
+    std::vector<Handle> freeHandles;   ///< handles available for reuse
   };
 
+  template<class T, size_t D>
+  const typename MutablePriorityQueue<T,D>::Handle MutablePriorityQueue<T,D>::none;
+
 } // namespace CGL
 
-#endif // CGL_CAMERA_H
+#endif // CGL_MUTABLEPRIORITYQUEUE_H
@@ -0,0 +1,343 @@
+#include "pickBuffer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+using namespace std;
+
+namespace CGL {
+
+  //////////////////////
+  // PickBuffer       //
+  //////////////////////
+
+  PickBuffer::PickBuffer()
+  : vertexBuffer(0), valid(false), nFaces(0), nEdges(0), nHalfedges(0) {}
+
+  PickBuffer::PickBuffer(const PickBuffer& buffer)
+  : vertexBuffer(0), valid(false), nFaces(0), nEdges(0), nHalfedges(0) {}
+
+  PickBuffer& PickBuffer::operator=(const PickBuffer& buffer) {
+    if (this != &buffer) {
+        release();
+        valid = false;
+    }
+    return *this;
+  }
+
+  PickBuffer::~PickBuffer() {
+    release();
+  }
+
+  void PickBuffer::release() {
+    if (vertexBuffer) glDeleteBuffers(1, &vertexBuffer);
+    vertexBuffer = 0;
+  }
+
+  void PickBuffer::invalidate() {
+    valid = false;
+    dirtyFaces.clear();
+  }
+
+  void PickBuffer::updateVertex(const Vertex* v) {
+    if (!valid) return;
+
+    HalfedgeCIter h = v->halfedge();
+    do {
+        if (!h->face()->isBoundary()) dirtyFaces.push_back(h->face()->id());
+        h = h->twin()->next();
+    } while (h != v->halfedge());
+  }
+
+  bool PickBuffer::changed(const HalfedgeMesh& mesh) const {
+    return !valid || !dirtyFaces.empty() ||
+           mesh.nFaces() != nFaces || mesh.nEdges() != nEdges || mesh.nHalfedges() != nHalfedges;
+  }
+
+  void PickBuffer::writeFace(Index f) {
+    FaceCIter face = faces[f];
+    Index c = faceCorner[f];
+
+    // Fan out from the first corner.  The first side of the first triangle
+    // and the last side of the last one are edges of the polygon, as is the
+    // middle side of every triangle; the rest are diagonals.
+    HalfedgeCIter h0 = face->halfedge();
+    HalfedgeCIter h1 = h0->next();
+    do {
+        HalfedgeCIter h2 = h1->next();
+        GLuint sides = 2;
+        if (h1 == h0->next()) sides |= 1;
+        if (h2->next() == h0) sides |= 4;
+
+        HalfedgeCIter h[3] = { h0, h1, h2 };
+        for (int k = 0; k < 3; k++) {
+            const Vector3D& p = h[k]->vertex()->position;
+            Corner& corner = corners[c++];
+            corner.position[0] = (GLfloat) p.x;
+            corner.position[1] = (GLfloat) p.y;
+            corner.position[2] = (GLfloat) p.z;
+            corner.halfedges[0] = (GLuint) h0->id();
+            corner.halfedges[1] = (GLuint) h1->id();
+            corner.halfedges[2] = (GLuint) h2->id();
+            corner.halfedges[3] = sides;
+        }
+        h1 = h2;
+    } while (h1->next() != h0);
+  }
+
+  void PickBuffer::rebuild(HalfedgeMesh& mesh) {
+    mesh.enumerate();
+    nFaces = mesh.nFaces();
+    nEdges = mesh.nEdges();
+    nHalfedges = mesh.nHalfedges();
+
+    faces.clear();
+    faces.reserve(nFaces);
+    faceCorner.assign(1, 0);
+    for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+        faces.push_back(f);
+        faceCorner.push_back(faceCorner.back() + 3 * (f->degree() - 2));
+    }
+    corners.resize(faceCorner.back());
+
+    halfedges.clear();
+    halfedges.reserve(nHalfedges);
+    for (HalfedgeIter h = mesh.halfedgesBegin(); h != mesh.halfedgesEnd(); h++) halfedges.push_back(h);
+
+    #pragma omp parallel for
+    for (long f = 0; f < (long) nFaces; f++) writeFace(f);
+
+    if (!vertexBuffer) glGenBuffers(1, &vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(Corner), corners.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    dirtyFaces.clear();
+    valid = true;
+  }
+
+  void PickBuffer::sync(HalfedgeMesh& mesh) {
+    if (valid && (mesh.nFaces() != nFaces || mesh.nEdges() != nEdges || mesh.nHalfedges() != nHalfedges)) {
+        valid = false;
+    }
+
+    if (!valid) {
+        rebuild(mesh);
+        return;
+    }
+
+    if (dirtyFaces.empty()) return;
+
+    sort(dirtyFaces.begin(), dirtyFaces.end());
+    dirtyFaces.erase(unique(dirtyFaces.begin(), dirtyFaces.end()), dirtyFaces.end());
+
+    // Upload each run of consecutive faces with a single call.
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    for (Index i = 0; i < dirtyFaces.size(); ) {
+        Index j = i + 1;
+        while (j < dirtyFaces.size() && dirtyFaces[j] == dirtyFaces[j - 1] + 1) j++;
+
+        for (Index k = i; k < j; k++) writeFace(dirtyFaces[k]);
+        Index begin = faceCorner[dirtyFaces[i]];
+        Index end = faceCorner[dirtyFaces[j - 1] + 1];
+        glBufferSubData(GL_ARRAY_BUFFER, begin * sizeof(Corner), (end - begin) * sizeof(Corner), &corners[begin]);
+
+        i = j;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    dirtyFaces.clear();
+  }
+
+  void PickBuffer::draw(HalfedgeMesh& mesh) {
+    sync(mesh);
+    if (corners.empty()) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glEnableVertexAttribArray(PickFramebuffer::positionAttribute);
+    glVertexAttribPointer(PickFramebuffer::positionAttribute, 3, GL_FLOAT, GL_FALSE, sizeof(Corner),
+                          (const GLvoid*) offsetof(Corner, position));
+    glEnableVertexAttribArray(PickFramebuffer::halfedgesAttribute);
+    glVertexAttribIPointer(PickFramebuffer::halfedgesAttribute, 4, GL_UNSIGNED_INT, sizeof(Corner),
+                           (const GLvoid*) offsetof(Corner, halfedges));
+
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei) corners.size());
+
+    glDisableVertexAttribArray(PickFramebuffer::halfedgesAttribute);
+    glDisableVertexAttribArray(PickFramebuffer::positionAttribute);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  HalfedgeElement* PickBuffer::element(Index halfedge, Kind kind) {
+    if (halfedge >= halfedges.size()) return NULL;
+
+    HalfedgeIter h = halfedges[halfedge];
+    switch (kind) {
+      case FACE:     return elementAddress(h->face());
+      case VERTEX:   return elementAddress(h->vertex());
+      case EDGE:     return elementAddress(h->edge());
+      case HALFEDGE: return elementAddress(h);
+    }
+    return NULL;
+  }
+
+  //////////////////////
+  // PickFramebuffer  //
+  //////////////////////
+
+  PickFramebuffer::PickFramebuffer()
+  : program(0), framebuffer(0), colorBuffer(0), depthBuffer(0), width(0), height(0),
+    uniform_base(-1), uniform_thresholds(-1) {}
+
+  PickFramebuffer::~PickFramebuffer() {
+    release();
+    if (program) glDeleteProgram(program);
+  }
+
+  void PickFramebuffer::release() {
+    if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+    if (colorBuffer) glDeleteRenderbuffers(1, &colorBuffer);
+    if (depthBuffer) glDeleteRenderbuffers(1, &depthBuffer);
+    framebuffer = colorBuffer = depthBuffer = 0;
+    width = height = 0;
+  }
+
+  bool PickFramebuffer::init() {
+    if (!GLEW_VERSION_3_0) {
+      cerr << "GPU picking needs OpenGL 3.0" << endl;
+      return false;
+    }
+
+    const char* vert_shader_src = "#version 130"
+    "\nin vec3 position;"
+    "\nin uvec4 halfedges;"
+    "\nflat out uvec4 triangle;"
+    "\nnoperspective out vec3 barycentric;"
+    "\nvoid main(void) {"
+    "\n  gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 1.);"
+    "\n  triangle = halfedges;"
+    "\n  int corner = gl_VertexID % 3;"
+    "\n  barycentric = vec3(corner == 0, corner == 1, corner == 2);"
+    "\n}";
+
+    // The regions of MeshNode::fillFeatureStructure(), where x, y and z are
+    // the coordinates towards the first, second and third corner, leaving
+    // out the sides of the triangle that are diagonals of a polygon.
+    const char* frag_shader_src = "#version 130"
+    "\nuniform uint base;"
+    "\nuniform vec3 thresholds;" // low, mid, high
+    "\nflat in uvec4 triangle;"
+    "\nnoperspective in vec3 barycentric;"
+    "\nout uint id;"
+    "\nvoid main(void) {"
+    "\n  vec3 b = barycentric;"
+    "\n  bvec3 side = bvec3((triangle.w & 1u) != 0u, (triangle.w & 2u) != 0u, (triangle.w & 4u) != 0u);"
+    "\n  uint h = triangle.x, kind = 0u;"
+    "\n  if      (b.x > thresholds.z)           { h = triangle.x; kind = 1u; }"
+    "\n  else if (b.y > thresholds.z)           { h = triangle.y; kind = 1u; }"
+    "\n  else if (b.z > thresholds.z)           { h = triangle.z; kind = 1u; }"
+    "\n  else if (b.z < thresholds.x && side.x) { h = triangle.x; kind = 2u; }"
+    "\n  else if (b.x < thresholds.x && side.y) { h = triangle.y; kind = 2u; }"
+    "\n  else if (b.y < thresholds.x && side.z) { h = triangle.z; kind = 2u; }"
+    "\n  else if (b.z < thresholds.y && side.x) { h = triangle.x; kind = 3u; }"
+    "\n  else if (b.x < thresholds.y && side.y) { h = triangle.y; kind = 3u; }"
+    "\n  else if (b.y < thresholds.y && side.z) { h = triangle.z; kind = 3u; }"
+    "\n  id = 1u + 4u * (base + h) + kind;"
+    "\n}";
+
+    GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
+    GLuint frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(vert_shader, 1, &vert_shader_src, NULL);
+    glCompileShader(vert_shader);
+    glShaderSource(frag_shader, 1, &frag_shader_src, NULL);
+    glCompileShader(frag_shader);
+
+    program = glCreateProgram();
+    glAttachShader(program, vert_shader);
+    glAttachShader(program, frag_shader);
+    glBindAttribLocation(program, positionAttribute, "position");
+    glBindAttribLocation(program, halfedgesAttribute, "halfedges");
+    glBindFragDataLocation(program, 0, "id");
+    glLinkProgram(program);
+    glDeleteShader(vert_shader);
+    glDeleteShader(frag_shader);
+
+    GLint result = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if (result != GL_TRUE) {
+      GLint info_length = 0;
+      glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_length);
+      vector<char> program_errmsg(info_length + 1);
+      glGetProgramInfoLog(program, info_length, NULL, &program_errmsg[0]);
+      cerr << "Could not link the picking program: " << &program_errmsg[0] << endl;
+      glDeleteProgram(program);
+      program = 0;
+      return false;
+    }
+
+    uniform_base = glGetUniformLocation(program, "base");
+    uniform_thresholds = glGetUniformLocation(program, "thresholds");
+    return true;
+  }
+
+  void PickFramebuffer::begin(size_t w, size_t h) {
+    if (w != width || h != height) {
+        release();
+        width = w;
+        height = h;
+
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, (GLsizei) w, (GLsizei) h);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, (GLsizei) w, (GLsizei) h);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+          cerr << "The picking framebuffer is incomplete" << endl;
+        }
+    }
+
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, (GLsizei) width, (GLsizei) height);
+
+    const GLuint none[4] = { 0, 0, 0, 0 };
+    const GLfloat far = 1.f;
+    glClearBufferuiv(GL_COLOR, 0, none);
+    glClearBufferfv(GL_DEPTH, 0, &far);
+    glEnable(GL_DEPTH_TEST);
+
+    glUseProgram(program);
+  }
+
+  void PickFramebuffer::setMesh(GLuint base, float low, float mid, float high) {
+    glUniform1ui(uniform_base, base);
+    glUniform3f(uniform_thresholds, low, mid, high);
+  }
+
+  void PickFramebuffer::end() {
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  }
+
+  GLuint PickFramebuffer::read(int x, int y, float& depth) {
+    depth = 1.f;
+    if (!framebuffer || x < 0 || y < 0 || x >= (int) width || y >= (int) height) return 0;
+
+    GLuint id = 0;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, &id);
+    glReadPixels(x, y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return id;
+  }
+
+}
@@ -0,0 +1,167 @@
+#ifndef CGL_PICKBUFFER_H
+#define CGL_PICKBUFFER_H
+
+#include "GL/glew.h"
+
+#include "halfEdgeMesh.h"
+
+namespace CGL {
+
+  /**
+   * A PickBuffer mirrors the faces of a HalfedgeMesh in an OpenGL vertex
+   * buffer for picking on the GPU: drawn into a PickFramebuffer, it leaves
+   * the id of the vertex, edge, halfedge or face under each pixel, so that
+   * finding the element under the cursor only takes reading back one pixel.
+   *
+   * Every element is named by a halfedge (its own halfedge, the halfedge
+   * leaving the vertex, or a halfedge of the edge or face), so an id is
+   * 1 + 4 * (base + halfedge id) + kind, where base is the number of
+   * halfedges in the meshes drawn before this one, and 0 means nothing.
+   * Polygons are drawn as fans of unindexed triangles, each of whose corners
+   * carries the ids of the three halfedges of the triangle, and which sides
+   * of it are edges of the polygon rather than diagonals.
+   *
+   * Like MeshBuffer, it is brought up to date lazily, the next time it is
+   * drawn.  After moving a vertex, call updateVertex(); after changing the
+   * connectivity of the mesh (or replacing it), call invalidate().  A
+   * PickBuffer must only be used while an OpenGL context is current.
+   */
+  class PickBuffer {
+  public:
+
+    // What an id names, in its two lowest bits.
+    enum Kind { FACE = 0, VERTEX = 1, EDGE = 2, HALFEDGE = 3 };
+
+    PickBuffer();
+    ~PickBuffer();
+
+    // Copies share no OpenGL objects; they start out empty and are rebuilt
+    // the first time they are drawn.
+    PickBuffer(const PickBuffer& buffer);
+    PickBuffer& operator=(const PickBuffer& buffer);
+
+    /**
+     * Forces a complete rebuild, e.g., after the connectivity has changed.
+     */
+    void invalidate();
+
+    /**
+     * Records that the given vertex has moved.  Only the faces around it
+     * are uploaded again.
+     */
+    void updateVertex(const Vertex* v);
+
+    /**
+     * Returns true if the mesh may have changed since the last call to
+     * draw(), i.e., if the ids drawn then may be out of date.
+     */
+    bool changed(const HalfedgeMesh& mesh) const;
+
+    /**
+     * Draws all faces between PickFramebuffer::begin() and end().
+     */
+    void draw(HalfedgeMesh& mesh);
+
+    /**
+     * Returns the element named by the given halfedge id and kind, as of the
+     * last call to draw().
+     */
+    HalfedgeElement* element(Index halfedge, Kind kind);
+
+    // Number of halfedges numbered by the last call to draw().
+    Size size() const { return halfedges.size(); }
+
+  private:
+
+    struct Corner {
+      GLfloat position[3];
+      GLuint halfedges[4]; ///< halfedges of the triangle, then a bit for each side that is an edge
+    };
+
+    void sync(HalfedgeMesh& mesh);
+    void rebuild(HalfedgeMesh& mesh);
+    void writeFace(Index f);
+    void release();
+
+    std::vector<Corner> corners;
+    std::vector<Index> faceCorner;       ///< first corner of each face (by id), plus one past the last
+    std::vector<FaceCIter> faces;        ///< faces by id
+    std::vector<HalfedgeIter> halfedges; ///< halfedges by id
+    std::vector<Index> dirtyFaces;       ///< ids of faces to upload again
+
+    GLuint vertexBuffer;
+
+    bool valid;    ///< whether the buffer matches the connectivity of the mesh
+    Size nFaces, nEdges, nHalfedges; ///< size of the mesh at the last rebuild
+  };
+
+  /**
+   * A PickFramebuffer is the offscreen framebuffer PickBuffers are drawn
+   * into, with a single unsigned integer per pixel (and a depth buffer), and
+   * the shader program that draws them.  A fragment is given the id of the
+   * vertex, edge, halfedge or face of its triangle according to its screen
+   * space barycentric coordinates, with the same thresholds as
+   * MeshNode::fillFeatureStructure().
+   *
+   * Integer framebuffers need OpenGL 3.0 (which Mesa's software rasterizer
+   * also provides); init() returns false without it.
+   */
+  class PickFramebuffer {
+  public:
+
+    // Vertex attributes of the program, as laid out by PickBuffer.
+    static const GLuint positionAttribute = 0;
+    static const GLuint halfedgesAttribute = 1;
+
+    PickFramebuffer();
+    ~PickFramebuffer();
+
+    /**
+     * Compiles the shader program.  Returns false (and leaves the
+     * framebuffer unusable) if the OpenGL context does not support it.
+     */
+    bool init();
+
+    bool isSupported() const { return program != 0; }
+
+    /**
+     * Starts drawing a new set of ids at the given size, with the current
+     * OpenGL matrices.
+     */
+    void begin(size_t w, size_t h);
+
+    /**
+     * Sets up the next mesh to be drawn: its ids are offset by base (the
+     * number of halfedges in the meshes drawn before it), and its features
+     * are told apart with the given barycentric thresholds.
+     */
+    void setMesh(GLuint base, float low, float mid, float high);
+
+    /**
+     * Finishes drawing, and restores the default framebuffer.
+     */
+    void end();
+
+    /**
+     * Reads back the id and the depth (in [0, 1]) of the given pixel, as of
+     * the last call to end().  Pixels outside of the framebuffer read as 0.
+     */
+    GLuint read(int x, int y, float& depth);
+
+  private:
+
+    void release();
+
+    GLuint program;
+    GLuint framebuffer;
+    GLuint colorBuffer;
+    GLuint depthBuffer;
+    size_t width, height;
+    GLint viewport[4];   ///< viewport to restore in end()
+    GLint uniform_base;
+    GLint uniform_thresholds;
+  };
+
+}
+
+#endif // CGL_PICKBUFFER_H
@@ -11,17 +11,16 @@ namespace CGL
     // Perform one step of the Bezier curve's evaluation at t using de Casteljau's algorithm for subdivision.
     // Store all of the intermediate control points into the 2D vector evaluatedLevels.
     int levels = evaluatedLevels.size();
-    vector<Vector2D> most_recent_points = evaluatedLevels[levels - 1];
-    if (most_recent_points.size() == 1) { //check the most recent levels, if there's only one control points, then we're done
+    if (evaluatedLevels[levels - 1].size() == 1) { //check the most recent levels, if there's only one control points, then we're done
         return;
     } else {
-        vector<Vector2D> new_points;
-        for (int i = 0; i < most_recent_points.size() - 1; i++) {
-            Vector2D p1 = most_recent_points[i];
-            Vector2D p2 = most_recent_points[i + 1];
-            new_points.push_back(Vector2D((1 - t) * p1 + t * p2));
+        evaluatedLevels.resize(levels + 1); //fill the new level in place, rather than copying the most recent one
+        const vector<Vector2D>& most_recent_points = evaluatedLevels[levels - 1];
+        vector<Vector2D>& new_points = evaluatedLevels[levels];
+        new_points.resize(most_recent_points.size() - 1);
+        for (int i = 0; i < new_points.size(); i++) {
+            new_points[i] = (1 - t) * most_recent_points[i] + t * most_recent_points[i + 1];
         }
-        evaluatedLevels.push_back(new_points);
     }
     return;
   }
@@ -34,41 +33,34 @@ namespace CGL
     // (i.e. Unlike Part 1 where we performed one subdivision level per call to evaluateStep, this function
     // should apply de Casteljau's algorithm until it computes the final, evaluated point on the surface)
 
-    vector<Vector3D> curves;
+    Vector3D curves[4];
 
-    for (int i = 0; i < controlPoints.size(); i++) { //deal with 1D de Casteljau first.
-        curves.push_back(evaluate1D(controlPoints[i], u));
+    for (int i = 0; i < 4; i++) { //deal with 1D de Casteljau first.
+        curves[i] = evaluate1D(&controlPoints[i][0], u);
     }
 
     return evaluate1D(curves, v);
   }
 
-  Vector3D BezierPatch::evaluate1D(std::vector<Vector3D> points, double t) const
+  Vector3D BezierPatch::evaluate1D(const Vector3D points[4], double t) const
   {
     // TODO Part 2.
     // Optional helper function that you might find useful to implement as an abstraction when implementing BezierPatch::evaluate.
     // Given an array of 4 points that lie on a single curve, evaluates the Bezier curve at parameter t using 1D de Casteljau subdivision.
-    vector<Vector3D> temp1; //3 points
-    vector<Vector3D> temp2; //2 points
+    Vector3D temp[4] = { points[0], points[1], points[2], points[3] }; //each level overwrites the one before it
 
-    for (int i = 0; i < points.size() - 1; i++) {
-        Vector3D p1 = points[i];
-        Vector3D p2 = points[i + 1];
-        temp1.push_back(Vector3D((1 - t) * p1 + t * p2));
+    for (int level = 3; level > 0; level--) {
+        for (int i = 0; i < level; i++) {
+            temp[i] = (1 - t) * temp[i] + t * temp[i + 1];
+        }
     }
 
-  for (int i = 0; i < temp1.size() - 1; i++) {
-      Vector3D p1 = temp1[i];
-      Vector3D p2 = temp1[i + 1];
-      temp2.push_back(Vector3D((1 - t) * p1 + t * p2));
+    return temp[0];
   }
 
-  return Vector3D((1 - t) * temp2[0] + t * temp2[1]);
- }
-
 
 
-  Vector3D Vertex::normal( void ) const
+  Vector3D Vertex::computeNormal( void ) const
   {
     // Part 3.
     // Returns an approximate unit normal at this vertex, computed by
@@ -154,6 +146,9 @@ namespace CGL
         f0 -> halfedge() = h0;
         f1 -> halfedge() = h3;
 
+        // Both faces now touch the endpoints of the flipped edge.
+        invalidateNormals(e0 -> halfedge() -> vertex());
+
         return e0;
     }
   }
@@ -164,18 +159,18 @@ namespace CGL
     // This method should split the given edge and return an iterator to the newly inserted vertex.
     // The halfedge of this vertex should point along the edge that was split, rather than the new edges.
       if (e0 -> isBoundary()) { //deal with a boundary edge.
-          //all half edges
+          //all half edges; h0 is the one inside the (triangular) face, h3 the one on the boundary loop.
           HalfedgeIter h0 = e0 -> halfedge();
+          if (h0 -> isBoundary()) h0 = h0 -> twin();
           HalfedgeIter h1 = h0 -> next();
           HalfedgeIter h2 = h1 -> next();
           HalfedgeIter h3 = h0 -> twin();
-          HalfedgeIter h4 = h2 -> twin();
-          HalfedgeIter h5 = h3 -> twin();
+          HalfedgeIter h4 = h3 -> next();
 
           //all vertices
-          VertexIter v0 = h1 -> vertex();
-          VertexIter v1 = h2 -> vertex();
-          VertexIter v2 = h0 -> vertex();
+          VertexIter v0 = h0 -> vertex();
+          VertexIter v1 = h3 -> vertex();
+          VertexIter v2 = h2 -> vertex();
 
           //all edges, e0 is given to us
           EdgeIter e1 = h1 -> edge();
@@ -183,60 +178,61 @@ namespace CGL
 
           //all faces
           FaceIter f0 = h0 -> face();
+          FaceIter b0 = h3 -> face();
 
           //new elements
           //new half edges
+          HalfedgeIter h5 = newHalfedge();
           HalfedgeIter h6 = newHalfedge();
           HalfedgeIter h7 = newHalfedge();
           HalfedgeIter h8 = newHalfedge();
-          HalfedgeIter h9 = newHalfedge();
 
-          //new edges
+          //new edges: e3 continues the split edge, e4 joins the new vertex to the opposite one
           EdgeIter e3 = newEdge();
           EdgeIter e4 = newEdge();
-          e3 -> isNew = true;
+          e3 -> isNew = false;
           e4 -> isNew = true;
 
           //new vertices
           VertexIter v3 = newVertex();
-          v3 -> position = (v0 -> position + v2 -> position) / 2; //average the neighbor vertices
+          v3 -> position = (v0 -> position + v1 -> position) / 2; //average the neighbor vertices
           v3 -> isNew = true;
 
           //new faces
           FaceIter f1 = newFace();
 
           //reassign pointers
-          //half edges
-          h0->setNeighbors(h1, h3, v3, e0, f0);
-          h1->setNeighbors(h6, h5, v0, e1, f0);
-          h2->setNeighbors(h7, h4, v1, e2, f1);
-          h3->setNeighbors(h3 -> next(), h0, v0, e0, h3 -> face());
-          h4->setNeighbors(h4 -> next(), h2, v2, e2, h4 -> face());
-          h5->setNeighbors(h5 -> next(), h1, v1, e1, h5 -> face());
+          //half edges: f0 becomes (v0, v3, v2) and f1 is (v3, v1, v2)
+          h0->setNeighbors(h5, h8, v0, e0, f0);
+          h1->setNeighbors(h6, h1 -> twin(), v1, e1, f1);
+          h2->setNeighbors(h0, h2 -> twin(), v2, e2, f0);
+          h3->setNeighbors(h8, h7, v1, e3, b0);
 
           //new half edges
-          h6->setNeighbors(h0, h8, v1, e3, f0);
-          h7->setNeighbors(h8, h9, v2, e4, f1);
-          h8->setNeighbors(h2, h6, v3, e3, f1);
-          //TODO: deal with boundary edge here.
-          h9->setNeighbors(h7 -> next(), h7, v3, e4, newBoundary()); //set h3's next() to a new boundary faceIter.
+          h5->setNeighbors(h2, h6, v3, e4, f0);
+          h6->setNeighbors(h7, h5, v2, e4, f1);
+          h7->setNeighbors(h1, h3, v3, e3, f1);
+          h8->setNeighbors(h4, h0, v3, e0, b0); //the boundary loop now runs h3, h8, h4
 
           //vertices
-          v0->halfedge() = h1;
-          v1->halfedge() = h2;
-          v2->halfedge() = h4;
-          v3->halfedge() = h8;
+          v0->halfedge() = h0;
+          v1->halfedge() = h1;
+          v2->halfedge() = h2;
+          v3->halfedge() = h7;
 
           //edges
           e0->halfedge() = h0;
           e1->halfedge() = h1;
           e2->halfedge() = h2;
-          e3->halfedge() = h6;
-          e4->halfedge() = h7;
+          e3->halfedge() = h7;
+          e4->halfedge() = h5;
 
           //faces
           f0->halfedge() = h0;
-          f1->halfedge() = h2;
+          f1->halfedge() = h7;
+          b0->halfedge() = h3;
+
+          invalidateNormals(v3);
 
           return v3;
       } else {
@@ -342,12 +338,193 @@ namespace CGL
           f2->halfedge() = h13;
           f3->halfedge() = h12;
 
+          invalidateNormals(v4);
+
           return v4;
       }
   }
 
 
 
+  // Number of edges leaving v, counting edges on the boundary.
+  static Size valence( VertexCIter v )
+  {
+      Size n = 0;
+      HalfedgeCIter h = v -> halfedge();
+      do {
+          n++;
+          h = h -> twin() -> next();
+      } while (h != v -> halfedge());
+      return n;
+  }
+
+  VertexIter HalfedgeMesh::collapseEdge( EdgeIter e0 )
+  {
+    // Merges the first endpoint v0 of the edge into the second endpoint v1 (the caller decides where v1 goes).
+    // Each triangle on either side of the edge disappears, and its two remaining edges are glued into one.
+    // A boundary side just loses the edge from its boundary loop.
+      HalfedgeIter h0 = e0 -> halfedge(); // v0 -> v1
+      HalfedgeIter h1 = h0 -> twin();     // v1 -> v0
+      VertexIter v0 = h0 -> vertex();
+      VertexIter v1 = h1 -> vertex();
+      bool boundary0 = h0 -> isBoundary();
+      bool boundary1 = h1 -> isBoundary();
+
+      // Only triangles can be collapsed, and a boundary loop must not shrink to fewer than three edges.
+      if (boundary0 && boundary1) return verticesEnd();
+      if (boundary0 ? h0 -> face() -> degree() < 4 : h0 -> face() -> degree() != 3) return verticesEnd();
+      if (boundary1 ? h1 -> face() -> degree() < 4 : h1 -> face() -> degree() != 3) return verticesEnd();
+
+      // An interior edge joining two boundary vertices would pinch the surface into a bowtie.
+      if (!boundary0 && !boundary1 && v0 -> isBoundary() && v1 -> isBoundary()) return verticesEnd();
+
+      // Link condition: the only vertices adjacent to both v0 and v1 may be the apexes of the triangles on
+      // either side; otherwise the collapse would create a duplicate edge.
+      vector<VertexIter> neighbors0;
+      HalfedgeIter h = h0;
+      do {
+          neighbors0.push_back(h -> twin() -> vertex());
+          h = h -> twin() -> next();
+      } while (h != h0);
+      Size common = 0;
+      h = h1;
+      do {
+          VertexIter n = h -> twin() -> vertex();
+          if (find(neighbors0.begin(), neighbors0.end(), n) != neighbors0.end()) common++;
+          h = h -> twin() -> next();
+      } while (h != h1);
+      if (common != (boundary0 ? 0 : 1) + (boundary1 ? 0 : 1)) return verticesEnd();
+
+      // The apex of each triangle loses an edge; it must keep at least three (two on the boundary), which
+      // also rules out collapsing a tetrahedron flat.
+      if (!boundary0) {
+          VertexIter apex = h0 -> next() -> next() -> vertex();
+          if (valence(apex) <= (apex -> isBoundary() ? 2 : 3)) return verticesEnd();
+      }
+      if (!boundary1) {
+          VertexIter apex = h1 -> next() -> next() -> vertex();
+          if (valence(apex) <= (apex -> isBoundary() ? 2 : 3)) return verticesEnd();
+      }
+
+      // Every halfedge leaving v0 will leave v1 instead.
+      vector<HalfedgeIter> outgoing;
+      h = h0;
+      do {
+          outgoing.push_back(h);
+          h = h -> twin() -> next();
+      } while (h != h0);
+      for (Index i = 0; i < outgoing.size(); i++) {
+          outgoing[i] -> vertex() = v1;
+      }
+
+      // Side of h0: triangle (v0, v1, v2), whose edges v1v2 and v2v0 get glued together.
+      HalfedgeIter keep0 = h1; // some halfedge leaving v1 that survives
+      if (!boundary0) {
+          HalfedgeIter h0n = h0 -> next(); // v1 -> v2
+          HalfedgeIter h0p = h0n -> next(); // v2 -> v0
+          HalfedgeIter a = h0n -> twin();   // v2 -> v1
+          HalfedgeIter b = h0p -> twin();   // v0 -> v2
+          EdgeIter ea = h0n -> edge();
+          EdgeIter eb = h0p -> edge();
+          VertexIter v2 = h0p -> vertex();
+
+          a -> twin() = b;
+          b -> twin() = a;
+          b -> edge() = ea;
+          ea -> halfedge() = a;
+          v2 -> halfedge() = a;
+          keep0 = b;
+
+          deleteFace(h0 -> face());
+          deleteEdge(eb);
+          deleteHalfedge(h0n);
+          deleteHalfedge(h0p);
+      } else {
+          HalfedgeIter prev = h0;
+          while (prev -> next() != h0) prev = prev -> next();
+          prev -> next() = h0 -> next();
+          if (h0 -> face() -> halfedge() == h0) h0 -> face() -> halfedge() = h0 -> next();
+      }
+
+      // Side of h1: triangle (v1, v0, v3), whose edges v0v3 and v3v1 get glued together.
+      HalfedgeIter keep1 = h0;
+      if (!boundary1) {
+          HalfedgeIter h1n = h1 -> next(); // v0 -> v3
+          HalfedgeIter h1p = h1n -> next(); // v3 -> v1
+          HalfedgeIter c = h1n -> twin();   // v3 -> v0
+          HalfedgeIter d = h1p -> twin();   // v1 -> v3
+          EdgeIter ec = h1n -> edge();
+          EdgeIter ed = h1p -> edge();
+          VertexIter v3 = h1p -> vertex();
+
+          c -> twin() = d;
+          d -> twin() = c;
+          d -> edge() = ec;
+          ec -> halfedge() = c;
+          v3 -> halfedge() = c;
+          keep1 = d;
+
+          deleteFace(h1 -> face());
+          deleteEdge(ed);
+          deleteHalfedge(h1n);
+          deleteHalfedge(h1p);
+      } else {
+          HalfedgeIter prev = h1;
+          while (prev -> next() != h1) prev = prev -> next();
+          prev -> next() = h1 -> next();
+          if (h1 -> face() -> halfedge() == h1) h1 -> face() -> halfedge() = h1 -> next();
+      }
+
+      v1 -> halfedge() = boundary0 ? keep1 : keep0;
+
+      deleteHalfedge(h0);
+      deleteHalfedge(h1);
+      deleteEdge(e0);
+      deleteVertex(v0);
+
+      invalidateNormals(v1);
+
+      return v1;
+  }
+
+  EdgeRecord::EdgeRecord( EdgeIter& _edge ) : edge( link( _edge ) )
+  {
+    // The cost of collapsing an edge is measured by the quadric K = K0 + K1 of its endpoints: the best place for
+    // the merged vertex is the point x minimizing (x,1)^T K (x,1), i.e., the solution of A x = -b where A is the
+    // upper-left 3x3 block of K and b the first three entries of its last column. If A is (nearly) singular, e.g.
+    // on a flat region, we settle for whichever of the endpoints and the midpoint is cheapest.
+      VertexIter v0 = _edge -> halfedge() -> vertex();
+      VertexIter v1 = _edge -> halfedge() -> twin() -> vertex();
+      Matrix4x4 K = v0 -> quadric + v1 -> quadric;
+
+      Matrix3x3 A;
+      Vector3D b;
+      for (int i = 0; i < 3; i++) {
+          for (int j = 0; j < 3; j++) {
+              A(i, j) = K(i, j);
+          }
+          b[i] = -K(i, 3);
+      }
+
+      double scale = A.norm();
+      if (scale > 0. && fabs(A.det()) > 1e-6 * scale * scale * scale) {
+          optimalPoint = A.inv() * b;
+          Vector4D x(optimalPoint.x, optimalPoint.y, optimalPoint.z, 1.);
+          score = dot(x, K * x);
+      } else {
+          Vector3D candidates[3] = { v0 -> position, v1 -> position, (v0 -> position + v1 -> position) / 2. };
+          score = numeric_limits<double>::infinity();
+          for (int i = 0; i < 3; i++) {
+              Vector4D x(candidates[i].x, candidates[i].y, candidates[i].z, 1.);
+              double s = dot(x, K * x);
+              if (s < score) {
+                  score = s;
+                  optimalPoint = candidates[i];
+              }
+          }
+      }
+  }
+
   void MeshResampler::upsample( HalfedgeMesh& mesh )
   {
     // TODO Part 6.
@@ -380,16 +557,19 @@ namespace CGL
     // by setting the flat Edge::isNew.  Note that in this loop, we only want to iterate
     // over edges of the original mesh---otherwise, we'll end up splitting edges that we
     // just split (and the loop will never end!)
-    Size numOldEdges = mesh.nEdges();
-    int count = 0; //count the number of how many old edges we've gone through.
+    // Gather them first: with indexed storage, new edges may reuse free slots in front of
+    // the old ones, so "the first nEdges() edges" are not necessarily the old ones.
+    vector<EdgeIter> oldEdges;
+    oldEdges.reserve(mesh.nEdges());
     for (EdgeIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
-        if (count >= numOldEdges) {
-            break;
-        }
-        mesh.splitEdge(e) -> newPosition = e -> newPosition; //assigned the newPosition of the newly created
-                                                            // because when flipped the edge, the new vertex might
-                                                            // point to a new edges, which has no newPosition.
-        count++;
+        oldEdges.push_back(e);
+    }
+    for (size_t i = 0; i < oldEdges.size(); i++) {
+        EdgeIter e = oldEdges[i];
+        Vector3D edgePosition = e -> newPosition; // read this before splitting, since the split allocates new elements
+        mesh.splitEdge(e) -> newPosition = edgePosition; //assigned the newPosition of the newly created
+                                                         // because when flipped the edge, the new vertex might
+                                                         // point to a new edges, which has no newPosition.
     }
 
     //Now flip any new edge that connects an old and new vertex.
@@ -407,9 +587,235 @@ namespace CGL
   for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
       v -> position = v -> newPosition;
   }
+  mesh.invalidateNormals();
     return;
   }
 
+  // Same subdivision as upsample(), but rather than splitting and flipping edges one at a time, we compute all
+  // the new positions in parallel and then write down the connectivity of the refined mesh directly, using index
+  // arithmetic on the coarse mesh. Coarse vertex i keeps index i, the midpoint of coarse edge j gets index nV + j,
+  // and coarse triangle k = (v0,v1,v2) with midpoints m0, m1, m2 (mi on edge vi vi+1) becomes four triangles:
+  //
+  //    fine face 4k+i (i = 0,1,2): vi -> mi -> mi-1,  halfedges 12k+3i   (ai: vi -> mi)
+  //                                                             12k+3i+1 (di: mi -> mi-1)
+  //                                                             12k+3i+2 (bi: mi-1 -> vi)
+  //    fine face 4k+3:             m0 -> m1 -> m2,    halfedges 12k+9+i  (ci: mi -> mi+1)
+  //
+  // The twin of di is ci-1. If coarse halfedge vi -> vi+1 has twin vi+1 -> vi at corner j of face k', its two
+  // halves ai and bi+1 are the twins of bj+1 and aj of face k', respectively. The geometry of the result is the
+  // same as upsample(), but the elements come out in a different order.
+  void MeshResampler::upsampleParallel( HalfedgeMesh& mesh )
+  {
+    // Only triangle meshes can be refined this way; leave anything else to upsample().
+    for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+        if (f -> degree() != 3) {
+            upsample(mesh);
+            return;
+        }
+    }
+
+    const Index none = (Index) -1;
+
+    mesh.enumerate();
+    Size nV = mesh.nVertices();
+    Size nE = mesh.nEdges();
+    Size nF = mesh.nFaces();
+    Size nH = mesh.nHalfedges();
+
+    // Gather the elements into arrays, so that the loops below can be split across threads.
+    vector<VertexIter> vertices; vertices.reserve(nV);
+    vector<EdgeIter> edges; edges.reserve(nE);
+    vector<FaceIter> faces; faces.reserve(nF);
+    for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) vertices.push_back(v);
+    for (EdgeIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) edges.push_back(e);
+    for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) faces.push_back(f);
+
+    // Each vertex and edge only writes its own newPosition, so these loops need no synchronization.
+    vector<Vector3D> positions(nV + nE);
+    #pragma omp parallel for
+    for (long i = 0; i < (long) nV; i++) {
+        averagePosition(vertices[i]);
+        positions[i] = vertices[i] -> newPosition;
+    }
+    #pragma omp parallel for
+    for (long j = 0; j < (long) nE; j++) {
+        newVerticesPosition(edges[j]);
+        positions[nV + j] = edges[j] -> newPosition;
+    }
+
+    // For each coarse halfedge, find the face and corner it belongs to (3k+i), or none on the boundary.
+    vector<Index> corner(nH, none);
+    #pragma omp parallel for
+    for (long k = 0; k < (long) nF; k++) {
+        HalfedgeIter h = faces[k] -> halfedge();
+        for (Index i = 0; i < 3; i++, h = h -> next()) {
+            corner[h -> id()] = 3 * k + i;
+        }
+    }
+
+    // Write down the fine connectivity, one coarse triangle at a time.
+    vector<Index> faceStart(4 * nF + 1);
+    vector<Index> tail(12 * nF);
+    vector<Index> twin(12 * nF);
+    #pragma omp parallel for
+    for (long k = 0; k < (long) nF; k++) {
+        HalfedgeIter h[3];
+        h[0] = faces[k] -> halfedge();
+        h[1] = h[0] -> next();
+        h[2] = h[1] -> next();
+
+        Index base = 12 * k;
+        for (Index i = 0; i < 3; i++) {
+            Index prev = (i + 2) % 3;
+            Index v = h[i] -> vertex() -> id();
+            Index m = nV + h[i] -> edge() -> id();
+            Index mPrev = nV + h[prev] -> edge() -> id();
+
+            tail[base + 3 * i] = v;          // ai
+            tail[base + 3 * i + 1] = m;      // di
+            tail[base + 3 * i + 2] = mPrev;  // bi
+            tail[base + 9 + i] = m;          // ci
+
+            twin[base + 3 * i + 1] = base + 9 + prev;
+            twin[base + 9 + prev] = base + 3 * i + 1;
+
+            // ai and bi+1 are the two halves of coarse halfedge i.
+            Index c = corner[h[i] -> twin() -> id()];
+            Index next = (i + 1) % 3;
+            if (c == none) {
+                twin[base + 3 * i] = none;
+                twin[base + 3 * next + 2] = none;
+            } else {
+                Index kk = c / 3, j = c % 3;
+                twin[base + 3 * i] = 12 * kk + 3 * ((j + 1) % 3) + 2;
+                twin[base + 3 * next + 2] = 12 * kk + 3 * j;
+            }
+        }
+    }
+    for (Index n = 0; n <= 4 * nF; n++) {
+        faceStart[n] = 3 * n;
+    }
+
+    mesh.buildFromConnectivity(faceStart, tail, twin, positions);
+  }
+
+  // Returns true if moving the endpoints of e to p would flip (or flatten) any triangle that survives the collapse.
+  static bool collapseFlipsFaces( EdgeIter e, const Vector3D& p )
+  {
+      HalfedgeIter h0 = e -> halfedge();
+      VertexIter ends[2] = { h0 -> vertex(), h0 -> twin() -> vertex() };
+      for (int k = 0; k < 2; k++) {
+          HalfedgeIter h = ends[k] -> halfedge();
+          do {
+              FaceIter f = h -> face();
+              if (!f -> isBoundary() && h -> edge() != e && h -> next() -> next() -> edge() != e) {
+                  Vector3D a = h -> next() -> vertex() -> position;
+                  Vector3D b = h -> next() -> next() -> vertex() -> position;
+                  Vector3D before = cross(a - ends[k] -> position, b - ends[k] -> position);
+                  Vector3D after = cross(a - p, b - p);
+                  if (dot(before, after) <= 0.) return true;
+              }
+              h = h -> twin() -> next();
+          } while (h != ends[k] -> halfedge());
+      }
+      return false;
+  }
+
+  Size MeshResampler::downsample( HalfedgeMesh& mesh, Size targetFaces, double maxError )
+  {
+    for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+        if (f -> degree() != 3) {
+            cerr << "MeshResampler::downsample: only triangle meshes can be simplified" << endl;
+            return 0;
+        }
+    }
+
+    // The quadric of a face measures squared distance to its plane: K = p p^T, where p = (N, -N.x).
+    for (FaceIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) {
+        Vector3D N = f -> normal();
+        Vector3D x = f -> halfedge() -> vertex() -> position;
+        Vector4D p(N.x, N.y, N.z, -dot(N, x));
+        f -> quadric = outer(p, p);
+    }
+
+    // The quadric of a vertex is the sum of the quadrics of the faces around it.
+    for (VertexIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) {
+        v -> quadric.zero();
+        HalfedgeIter h = v -> halfedge();
+        do {
+            if (!h -> face() -> isBoundary()) v -> quadric += h -> face() -> quadric;
+            h = h -> twin() -> next();
+        } while (h != v -> halfedge());
+    }
+
+    // Queue every edge, keeping its handle by edge id so its record can be found again when its cost changes.
+    // Collapses only ever delete edges, so the ids assigned here stay valid throughout.
+    typedef MutablePriorityQueue<EdgeRecord> EdgeQueue;
+    mesh.enumerate();
+    EdgeQueue queue;
+    queue.reserve(mesh.nEdges());
+    vector<EdgeQueue::Handle> handle(mesh.nEdges(), EdgeQueue::none);
+    for (EdgeIter e = mesh.edgesBegin(); e != mesh.edgesEnd(); e++) {
+        e -> record = EdgeRecord(e);
+        handle[e -> id()] = queue.insert(e -> record);
+    }
+
+    Size collapses = 0;
+    vector<Index> ring;
+    vector<Size> updated(mesh.nEdges(), 0); // number of the last collapse that recomputed each edge
+    while (mesh.nFaces() > targetFaces && !queue.empty()) {
+        EdgeRecord best = queue.top();
+        if (best.score > maxError) break;
+        queue.pop();
+
+        // If e cannot be collapsed it stays out of the queue, until a collapse nearby gives it a new cost.
+        EdgeIter e = mesh.edgeOf(best);
+        handle[e -> id()] = EdgeQueue::none;
+        if (collapseFlipsFaces(e, best.optimalPoint)) continue;
+
+        VertexIter v0 = e -> halfedge() -> vertex();
+        VertexIter v1 = e -> halfedge() -> twin() -> vertex();
+        Matrix4x4 K = v0 -> quadric + v1 -> quadric;
+
+        // The edges around both endpoints either end up around the merged vertex or are deleted.
+        ring.clear();
+        VertexIter ends[2] = { v0, v1 };
+        for (int k = 0; k < 2; k++) {
+            HalfedgeIter h = ends[k] -> halfedge();
+            do {
+                if (h -> edge() != e) ring.push_back(h -> edge() -> id());
+                h = h -> twin() -> next();
+            } while (h != ends[k] -> halfedge());
+        }
+
+        VertexIter v = mesh.collapseEdge(e);
+        if (v == mesh.verticesEnd()) continue;
+        v -> position = best.optimalPoint; // collapseEdge() has already invalidated the normals around v
+        v -> quadric = K;
+        collapses++;
+
+        HalfedgeIter h = v -> halfedge();
+        do {
+            EdgeIter ee = h -> edge();
+            ee -> record = EdgeRecord(ee);
+            EdgeQueue::Handle& eh = handle[ee -> id()];
+            if (eh == EdgeQueue::none) eh = queue.insert(ee -> record);
+            else queue.update(eh, ee -> record);
+            updated[ee -> id()] = collapses;
+            h = h -> twin() -> next();
+        } while (h != v -> halfedge());
+
+        for (Index i = 0; i < ring.size(); i++) {
+            if (updated[ring[i]] != collapses && handle[ring[i]] != EdgeQueue::none) {
+                queue.remove(handle[ring[i]]);
+                handle[ring[i]] = EdgeQueue::none;
+            }
+        }
+    }
+
+    return collapses;
+  }
+
   //Iterate through v's neighboring vertices, return the averaged position by Loop subdivision rule, assigned it to v's
   //new position.
   void MeshResampler::averagePosition (VertexIter v) {
@@ -423,16 +829,20 @@ namespace CGL
           n++;
           h = h_twin->next(); // move to the next outgoing halfedge of the vertex.
       } while(h != v->halfedge());
-      float u = n == 3 ? 3.0 / 16.0 : 3.0 / (8.0 * (float) n);
+      float u = vertexNeighborWeight(n);
       v -> newPosition = (1 - u * n) * v -> position + u * new_position_sum;
   }
 
+  float MeshResampler::vertexNeighborWeight (Size degree) {
+      return (float) (degree == 3 ? 3.0 / 16.0 : 3.0 / (8.0 * (float) degree));
+  }
+
   void MeshResampler::newVerticesPosition (EdgeIter e) {
       HalfedgeIter h = e -> halfedge();
       VertexIter v0 = h -> vertex(); // get the near 4 vertices
       VertexIter v1 = h -> twin() -> vertex();
       VertexIter v2 = h -> next() -> next() -> vertex();
       VertexIter v3 = h -> twin() -> next() -> next() -> vertex();
-      e -> newPosition = (3.0 / 8.0) * (v0 -> position + v1 -> position) + (1.0 / 8.0) * (v2 -> position + v3 -> position);
+      e -> newPosition = edgeNearWeight() * (v0 -> position + v1 -> position) + edgeFarWeight() * (v2 -> position + v3 -> position);
   }
 }
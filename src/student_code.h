@@ -1,6 +1,8 @@
 #ifndef STUDENT_CODE_H
 #define STUDENT_CODE_H
 
+#include <limits>
+
 #include "halfEdgeMesh.h"
 #include "bezierPatch.h"
 #include "bezierCurve.h"
@@ -17,8 +19,19 @@ namespace CGL {
     ~MeshResampler(){}
 
     void upsample(HalfedgeMesh& mesh);
+    void upsampleParallel(HalfedgeMesh& mesh);
+
+    // Quadric error simplification: collapses the cheapest edge until the mesh has at most targetFaces faces,
+    // or the next collapse would move the surface by more than maxError (a sum of squared distances to the
+    // original planes). Returns the number of edges collapsed.
+    Size downsample(HalfedgeMesh& mesh, Size targetFaces, double maxError = numeric_limits<double>::infinity());
     void averagePosition(VertexIter v);
     void newVerticesPosition (EdgeIter e);
+
+    // Weights of the Loop subdivision rules used above (also used by LoopStencil).
+    static float vertexNeighborWeight(Size degree); // weight of each neighbor of an old vertex of the given degree
+    static double edgeNearWeight() { return 3.0 / 8.0; } // weight of each endpoint of a split edge
+    static double edgeFarWeight() { return 1.0 / 8.0; } // weight of each vertex opposite a split edge
   };
 }
 
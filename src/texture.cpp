@@ -1,6 +1,9 @@
 #include "texture.h"
 
 #include <assert.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 
@@ -24,27 +27,29 @@ inline void float_to_uint8( unsigned char* dst, float src[4] ) {
   dst_uint8[3] = (uint8_t) ( 255.f * max( 0.0f, min( 1.0f, src[3])));
 }
 
-void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
+Sampler2D::~Sampler2D() { }
 
-  // NOTE(sky):
-  // The starter code allocates the mip levels and generates a level
-  // map simply fills each level with a color that differs from its
-  // neighbours'. The reference solution uses trilinear filtering
-  // and it will only work when you have mipmaps.
+//////////////////////
+// Shared utilities //
+//////////////////////
 
-  // Task 7: Implement this
+// Allocates the levels below startLevel, each half the size of the one above
+// it (rounding down), up to a single texel or kMaxMipLevels levels. Returns
+// false if there is no such start level.
+static bool allocate_mips( Texture& tex, int startLevel ) {
 
   // check start level
-  if ( startLevel >= tex.mipmap.size() ) {
-    std::cerr << "Invalid start level";
+  if ( startLevel < 0 || startLevel >= (int) tex.mipmap.size() ) {
+    std::cerr << "Invalid start level " << startLevel << std::endl;
+    return false;
   }
 
   // allocate sublevels
-  int baseWidth  = tex.mipmap[startLevel].width;
-  int baseHeight = tex.mipmap[startLevel].height;
+  int baseWidth  = (int) tex.mipmap[startLevel].width;
+  int baseHeight = (int) tex.mipmap[startLevel].height;
   int numSubLevels = (int)(log2f( (float)max(baseWidth, baseHeight)));
 
-  numSubLevels = min(numSubLevels, kMaxMipLevels - startLevel - 1);
+  numSubLevels = max(0, min(numSubLevels, kMaxMipLevels - startLevel - 1));
   tex.mipmap.resize(startLevel + numSubLevels + 1);
 
   int width  = baseWidth;
@@ -63,15 +68,167 @@ void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
 
   }
 
-  // fill all 0 sub levels with interchanging colors
-  Color colors[3] = { Color(1,0,0,1), Color(0,1,0,1), Color(0,0,1,1) };
-  for(size_t i = 1; i < tex.mipmap.size(); ++i) {
+  return true;
+}
+
+// Texels [begin, end) of a row (or column) of n texels that texel i of a row
+// of m <= n texels on the next level averages. When n is odd, some texels of
+// the next level average three texels instead of two, so that every texel of
+// the level above is accounted for.
+inline void box_range( size_t i, size_t n, size_t m, size_t& begin, size_t& end ) {
+  begin = i * n / m;
+  end = (i + 1) * n / m;
+}
+
+inline float clamp01( float x ) {
+  return x > 0.f ? (x < 1.f ? x : 1.f) : 0.f; // also maps NaN to 0
+}
+
+// Level of detail for a footprint of u_scale by v_scale texels of the base
+// level (i.e., the number of texels a pixel covers along u and v).
+inline float level_of_detail( const Texture& tex, float u_scale, float v_scale ) {
+  float d = max(u_scale, v_scale);
+  if ( !(d > 1.f) ) return 0.f; // magnification
+  return min(log2f(d), (float) (tex.mipmap.size() - 1));
+}
+
+//////////////////////////////
+// Fixed point texel access //
+//////////////////////////////
+
+// Texels are handled as packed 32 bit RGBA values, two channels at a time in
+// the 16 bit halves of a word (red and blue, then green and alpha), so that a
+// single integer multiply weights two channels at once.
+
+static const unsigned char kMagenta[4] = { 255, 0, 255, 255 };
 
-    Color c = colors[i % 3];
-    MipLevel& mip = tex.mipmap[i];
+// Selects the red and blue (or, shifted right by 8, green and alpha) lanes.
+static const uint32_t kLanes = 0x00FF00FF;
+
+inline uint32_t load_texel( const MipLevel& mip, size_t x, size_t y ) {
+  uint32_t t;
+  memcpy(&t, &mip.texels[4 * (y * mip.width + x)], 4);
+  return t;
+}
+
+inline Color texel_to_color( uint32_t t ) {
+  unsigned char c[4];
+  float f[4];
+  memcpy(c, &t, 4);
+  uint8_to_float(f, c);
+  return Color(f[0], f[1], f[2], f[3]);
+}
+
+// Interpolates from a to b by f / 256, for f in [0, 256], rounding to
+// nearest. No 16 bit lane can overflow: 255 * 256 + 128 < 65536.
+inline uint32_t lerp_texel( uint32_t a, uint32_t b, uint32_t f ) {
+  uint32_t g = 256 - f;
+  uint32_t a_rb = a & kLanes, a_ga = (a >> 8) & kLanes;
+  uint32_t b_rb = b & kLanes, b_ga = (b >> 8) & kLanes;
+  uint32_t rb = (a_rb * g + b_rb * f + 0x00800080) >> 8;
+  uint32_t ga = (a_ga * g + b_ga * f + 0x00800080) >> 8;
+  // keep the 8 bit result of each lane
+  return (rb & kLanes) | ((ga & kLanes) << 8);
+}
+
+// Rounded average of four texels.
+inline uint32_t average_texels( uint32_t a, uint32_t b, uint32_t c, uint32_t d ) {
+  uint32_t rb = ((a & kLanes) + (b & kLanes) + (c & kLanes) + (d & kLanes) + 0x00020002) >> 2;
+  uint32_t ga = (((a >> 8) & kLanes) + ((b >> 8) & kLanes) +
+                 ((c >> 8) & kLanes) + ((d >> 8) & kLanes) + 0x00020002) >> 2;
+  // keep the 8 bit result of each lane
+  return (rb & kLanes) | ((ga & kLanes) << 8);
+}
+
+// Texel centers are at (i + 1/2) / size, as in OpenGL, and texture
+// coordinates are clamped to [0, 1] (i.e., clamped to the edge).
+inline uint32_t nearest_texel( const MipLevel& mip, float u, float v ) {
+  size_t x = min((size_t) (clamp01(u) * (float) mip.width), mip.width - 1);
+  size_t y = min((size_t) (clamp01(v) * (float) mip.height), mip.height - 1);
+  return load_texel(mip, x, y);
+}
+
+// Positions are measured in 1/256ths of a texel from the center of the first
+// one, so that the weights of the four texels around them are 8 bit
+// fractions, and the rest of the filtering needs no floating point at all.
+inline uint32_t bilinear_texel( const MipLevel& mip, float u, float v ) {
+  int x = (int) (clamp01(u) * (float) (mip.width  * 256)) - 128;
+  int y = (int) (clamp01(v) * (float) (mip.height * 256)) - 128;
+  int x0 = x >> 8, y0 = y >> 8; // floor, also for the half texel before the first center
+  uint32_t fx = (uint32_t) (x & 255), fy = (uint32_t) (y & 255);
+  int x1 = min(x0 + 1, (int) mip.width  - 1);
+  int y1 = min(y0 + 1, (int) mip.height - 1);
+  x0 = max(x0, 0);
+  y0 = max(y0, 0);
+
+  uint32_t top    = lerp_texel(load_texel(mip, x0, y0), load_texel(mip, x1, y0), fx);
+  uint32_t bottom = lerp_texel(load_texel(mip, x0, y1), load_texel(mip, x1, y1), fx);
+  return lerp_texel(top, bottom, fy);
+}
+
+inline uint32_t trilinear_texel( const Texture& tex, float u, float v,
+                                 float u_scale, float v_scale ) {
+  int lod = (int) (level_of_detail(tex, u_scale, v_scale) * 256.f);
+  int level = lod >> 8;
+  uint32_t f = (uint32_t) (lod & 255);
+  uint32_t t = bilinear_texel(tex.mipmap[level], u, v);
+  if ( f == 0 ) return t; // also the case on the last level
+  return lerp_texel(t, bilinear_texel(tex.mipmap[level + 1], u, v), f);
+}
+
+//////////////////
+// Sampler2DImp //
+//////////////////
+
+void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
+
+  if ( !allocate_mips(tex, startLevel) ) return;
+
+  // Box filter each level down from the one above it. The levels depend on
+  // each other, so only the rows of a level are filtered in parallel.
+  for (size_t l = startLevel + 1; l < tex.mipmap.size(); l++) {
+
+    const MipLevel& src = tex.mipmap[l - 1];
+    MipLevel& dst = tex.mipmap[l];
+
+    if ( src.width == 2 * dst.width && src.height == 2 * dst.height ) {
+
+      // Even sizes: every texel averages exactly 2 x 2 texels above it
+      #pragma omp parallel for
+      for (long y = 0; y < (long) dst.height; y++) {
+        for (size_t x = 0; x < dst.width; x++) {
+          uint32_t t = average_texels(load_texel(src, 2 * x, 2 * y),     load_texel(src, 2 * x + 1, 2 * y),
+                                      load_texel(src, 2 * x, 2 * y + 1), load_texel(src, 2 * x + 1, 2 * y + 1));
+          memcpy(&dst.texels[4 * (y * dst.width + x)], &t, 4);
+        }
+      }
+
+    } else {
+
+      // Odd sizes (or a side already down to one texel): 1 to 3 texels along
+      // each axis
+      #pragma omp parallel for
+      for (long y = 0; y < (long) dst.height; y++) {
+        size_t y0, y1;
+        box_range(y, src.height, dst.height, y0, y1);
+        for (size_t x = 0; x < dst.width; x++) {
+          size_t x0, x1;
+          box_range(x, src.width, dst.width, x0, x1);
+
+          uint32_t sum[4] = { 0, 0, 0, 0 };
+          for (size_t sy = y0; sy < y1; sy++) {
+            const unsigned char* texel = &src.texels[4 * (sy * src.width + x0)];
+            for (size_t sx = x0; sx < x1; sx++, texel += 4) {
+              sum[0] += texel[0]; sum[1] += texel[1]; sum[2] += texel[2]; sum[3] += texel[3];
+            }
+          }
+
+          uint32_t count = (uint32_t) ((x1 - x0) * (y1 - y0));
+          unsigned char* texel = &dst.texels[4 * (y * dst.width + x)];
+          for (int c = 0; c < 4; c++) texel[c] = (unsigned char) ((sum[c] + count / 2) / count);
+        }
+      }
 
-    for(size_t i = 0; i < 4 * mip.width * mip.height; i += 4) {
-      float_to_uint8( &mip.texels[i], &c.r );
     }
   }
 
@@ -81,10 +238,10 @@ Color Sampler2DImp::sample_nearest(Texture& tex,
                                    float u, float v,
                                    int level) {
 
-  // Task ?: Implement nearest neighbour interpolation
-
   // return magenta for invalid level
-  return Color(1,0,1,1);
+  if ( level < 0 || level >= (int) tex.mipmap.size() ) return Color(1,0,1,1);
+
+  return texel_to_color(nearest_texel(tex.mipmap[level], u, v));
 
 }
 
@@ -92,10 +249,10 @@ Color Sampler2DImp::sample_bilinear(Texture& tex,
                                     float u, float v,
                                     int level) {
 
-  // Task ?: Implement bilinear filtering
-
   // return magenta for invalid level
-  return Color(1,0,1,1);
+  if ( level < 0 || level >= (int) tex.mipmap.size() ) return Color(1,0,1,1);
+
+  return texel_to_color(bilinear_texel(tex.mipmap[level], u, v));
 
 }
 
@@ -103,10 +260,143 @@ Color Sampler2DImp::sample_trilinear(Texture& tex,
                                      float u, float v,
                                      float u_scale, float v_scale) {
 
-  // Task 8: Implement trilinear filtering
+  // return magenta for invalid level
+  if ( tex.mipmap.empty() ) return Color(1,0,1,1);
+
+  return texel_to_color(trilinear_texel(tex, u, v, u_scale, v_scale));
+
+}
+
+void Sampler2DImp::sample(Texture& tex,
+                          const float* uv, const float* scale, size_t n,
+                          unsigned char* rgba, int level) {
+
+  bool trilinear = method == TRILINEAR && scale;
+  if ( method == TRILINEAR ) level = 0;
 
   // return magenta for invalid level
-  return Color(1,0,1,1);
+  if ( level >= (int) tex.mipmap.size() || level < 0 ) {
+    for (size_t i = 0; i < n; i++) memcpy(rgba + 4 * i, kMagenta, 4);
+    return;
+  }
+
+  const MipLevel& mip = tex.mipmap[level];
+
+  // Small batches (e.g., a single span) are not worth waking up the threads
+  #pragma omp parallel for if (n >= 4096)
+  for (long i = 0; i < (long) n; i++) {
+    float u = uv[2 * i], v = uv[2 * i + 1];
+    uint32_t t;
+    if ( trilinear ) {
+      t = trilinear_texel(tex, u, v, scale[2 * i], scale[2 * i + 1]);
+    } else if ( method == NEAREST ) {
+      t = nearest_texel(mip, u, v);
+    } else {
+      t = bilinear_texel(mip, u, v);
+    }
+    memcpy(rgba + 4 * i, &t, 4);
+  }
+
+}
+
+//////////////////
+// Sampler2DRef //
+//////////////////
+
+// A straightforward floating point implementation of the same filters, one
+// channel at a time, to check Sampler2DImp against and to measure it by.
+
+static Color texel_color( const MipLevel& mip, size_t x, size_t y ) {
+  float f[4];
+  uint8_to_float(f, const_cast<unsigned char*>(&mip.texels[4 * (y * mip.width + x)]));
+  return Color(f[0], f[1], f[2], f[3]);
+}
+
+static Color bilinear_color( const MipLevel& mip, float u, float v ) {
+  float x = clamp01(u) * (float) mip.width  - .5f;
+  float y = clamp01(v) * (float) mip.height - .5f;
+  float fx0 = floorf(x), fy0 = floorf(y);
+  float s = x - fx0, t = y - fy0;
+
+  int x0 = (int) fx0, y0 = (int) fy0;
+  int x1 = min(x0 + 1, (int) mip.width  - 1);
+  int y1 = min(y0 + 1, (int) mip.height - 1);
+  x0 = max(x0, 0);
+  y0 = max(y0, 0);
+
+  Color top    = texel_color(mip, x0, y0) * (1.f - s) + texel_color(mip, x1, y0) * s;
+  Color bottom = texel_color(mip, x0, y1) * (1.f - s) + texel_color(mip, x1, y1) * s;
+  return top * (1.f - t) + bottom * t;
+}
+
+void Sampler2DRef::generate_mips(Texture& tex, int startLevel) {
+
+  if ( !allocate_mips(tex, startLevel) ) return;
+
+  for (size_t l = startLevel + 1; l < tex.mipmap.size(); l++) {
+
+    const MipLevel& src = tex.mipmap[l - 1];
+    MipLevel& dst = tex.mipmap[l];
+
+    for (size_t y = 0; y < dst.height; y++) {
+      for (size_t x = 0; x < dst.width; x++) {
+        size_t x0, x1, y0, y1;
+        box_range(x, src.width, dst.width, x0, x1);
+        box_range(y, src.height, dst.height, y0, y1);
+
+        Color sum(0, 0, 0, 0);
+        for (size_t sy = y0; sy < y1; sy++) {
+          for (size_t sx = x0; sx < x1; sx++) sum += texel_color(src, sx, sy);
+        }
+
+        // round to nearest, as float_to_uint8 truncates
+        Color c = sum * (1.f / (float) ((x1 - x0) * (y1 - y0))) + Color(.5f, .5f, .5f, .5f) * (1.f / 255.f);
+        float_to_uint8(&dst.texels[4 * (y * dst.width + x)], &c.r);
+      }
+    }
+  }
+
+}
+
+Color Sampler2DRef::sample_nearest(Texture& tex,
+                                   float u, float v,
+                                   int level) {
+
+  // return magenta for invalid level
+  if ( level < 0 || level >= (int) tex.mipmap.size() ) return Color(1,0,1,1);
+
+  const MipLevel& mip = tex.mipmap[level];
+  size_t x = min((size_t) floorf(clamp01(u) * (float) mip.width), mip.width - 1);
+  size_t y = min((size_t) floorf(clamp01(v) * (float) mip.height), mip.height - 1);
+  return texel_color(mip, x, y);
+
+}
+
+Color Sampler2DRef::sample_bilinear(Texture& tex,
+                                    float u, float v,
+                                    int level) {
+
+  // return magenta for invalid level
+  if ( level < 0 || level >= (int) tex.mipmap.size() ) return Color(1,0,1,1);
+
+  return bilinear_color(tex.mipmap[level], u, v);
+
+}
+
+Color Sampler2DRef::sample_trilinear(Texture& tex,
+                                     float u, float v,
+                                     float u_scale, float v_scale) {
+
+  // return magenta for invalid level
+  if ( tex.mipmap.empty() ) return Color(1,0,1,1);
+
+  float lod = level_of_detail(tex, u_scale, v_scale);
+  size_t level = (size_t) lod;
+  float t = lod - (float) level;
+
+  Color c = bilinear_color(tex.mipmap[level], u, v);
+  if ( level + 1 >= tex.mipmap.size() ) return c;
+  return c * (1.f - t) + bilinear_color(tex.mipmap[level + 1], u, v) * t;
 
 }
 
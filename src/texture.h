@@ -30,7 +30,7 @@ namespace CGL {
 
     Sampler2D( SampleMethod method ) : method ( method ) { }
 
-    ~Sampler2D();
+    virtual ~Sampler2D();
 
     virtual void generate_mips( Texture& tex, int startLevel ) = 0;
 
@@ -75,6 +75,17 @@ namespace CGL {
                 float u, float v,
                 float u_scale, float v_scale);
 
+              /**
+               * Samples n points at once with the method given to the
+               * constructor, writing 4 bytes of RGBA per point to rgba.  uv
+               * holds n (u, v) pairs; for TRILINEAR, scale holds n
+               * (u_scale, v_scale) pairs, and otherwise all points are
+               * sampled from the given level.
+               */
+              void sample(Texture& tex,
+                const float* uv, const float* scale, size_t n,
+                unsigned char* rgba, int level = 0);
+
               }; // class sampler2DImp
 
               class Sampler2DRef : public Sampler2D {
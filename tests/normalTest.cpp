@@ -0,0 +1,125 @@
+#include "halfEdgeMesh.h"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace CGL;
+
+// Checks that the normals HalfedgeMesh::updateNormals() brings up to date
+// after a local edit match those of a full recompute, on an open mesh, where
+// the vertex normals also depend on the normal of the boundary loop.
+//
+// usage: normalTest
+//
+// Exits with a nonzero status if any normal is off by more than 1e-9.
+
+static const double tolerance = 1e-9;
+
+// A slightly bumpy n x n grid of triangulated quads, open on all four sides.
+void makeGrid(HalfedgeMesh& mesh, Index n) {
+  vector<Vector3D> positions;
+  for (Index i = 0; i <= n; i++) {
+    for (Index j = 0; j <= n; j++) {
+      positions.push_back(Vector3D((double) i, (double) j, .1 * sin((double) (i * 7 + j * 3))));
+    }
+  }
+
+  vector< vector<Index> > polygons;
+  for (Index i = 0; i < n; i++) {
+    for (Index j = 0; j < n; j++) {
+      Index a = i * (n + 1) + j, b = (i + 1) * (n + 1) + j;
+      Index c = (i + 1) * (n + 1) + j + 1, d = i * (n + 1) + j + 1;
+      vector<Index> t0, t1;
+      t0.push_back(a); t0.push_back(b); t0.push_back(c);
+      t1.push_back(a); t1.push_back(c); t1.push_back(d);
+      polygons.push_back(t0);
+      polygons.push_back(t1);
+    }
+  }
+
+  mesh.build(polygons, positions);
+}
+
+// Largest difference between the cached normals of the mesh and those of a
+// full recompute.
+double normalError(HalfedgeMesh& mesh) {
+  vector<Vector3D> vertexNormals, faceNormals;
+  for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++) vertexNormals.push_back(v->normal());
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++) faceNormals.push_back(f->normal());
+  for (FaceCIter b = mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++) faceNormals.push_back(b->normal());
+
+  mesh.invalidateNormals();
+  mesh.updateNormals();
+
+  double error = 0.;
+  size_t i = 0;
+  for (VertexCIter v = mesh.verticesBegin(); v != mesh.verticesEnd(); v++, i++) {
+    error = max(error, (v->normal() - vertexNormals[i]).norm());
+  }
+  i = 0;
+  for (FaceCIter f = mesh.facesBegin(); f != mesh.facesEnd(); f++, i++) {
+    error = max(error, (f->normal() - faceNormals[i]).norm());
+  }
+  for (FaceCIter b = mesh.boundariesBegin(); b != mesh.boundariesEnd(); b++, i++) {
+    error = max(error, (b->normal() - faceNormals[i]).norm());
+  }
+  return error;
+}
+
+// Drags a vertex as MeshEdit does, then updates the normals it invalidated.
+void drag(HalfedgeMesh& mesh, VertexIter v, const Vector3D& offset) {
+  v->position += offset;
+  mesh.invalidateNormals(v);
+  mesh.updateNormals();
+}
+
+bool check(const char* name, double error) {
+  bool ok = error <= tolerance;
+  cout << (ok ? "ok    " : "FAILED") << " " << name << " (error " << error << ")" << endl;
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  bool ok = true;
+
+  // A vertex in the middle of one side of the grid
+  {
+    HalfedgeMesh mesh;
+    makeGrid(mesh, 8);
+    mesh.updateNormals();
+
+    VertexIter v = mesh.verticesBegin();
+    while (!(v->isBoundary() && v->position.x == 0. && v->position.y == 4.)) v++;
+    drag(mesh, v, Vector3D(-.5, .3, 1.2));
+    ok = check("drag boundary vertex", normalError(mesh)) && ok;
+  }
+
+  // A corner of the grid, dragged twice between updates
+  {
+    HalfedgeMesh mesh;
+    makeGrid(mesh, 8);
+    mesh.updateNormals();
+
+    VertexIter v = mesh.verticesBegin();
+    while (!(v->position.x == 8. && v->position.y == 8.)) v++;
+    drag(mesh, v, Vector3D(.2, .2, -2.));
+    drag(mesh, v, Vector3D(0., -.4, .5));
+    ok = check("drag corner vertex", normalError(mesh)) && ok;
+  }
+
+  // An interior vertex, for comparison
+  {
+    HalfedgeMesh mesh;
+    makeGrid(mesh, 8);
+    mesh.updateNormals();
+
+    VertexIter v = mesh.verticesBegin();
+    while (!(v->position.x == 4. && v->position.y == 4.)) v++;
+    drag(mesh, v, Vector3D(.1, -.2, .7));
+    ok = check("drag interior vertex", normalError(mesh)) && ok;
+  }
+
+  return ok ? 0 : 1;
+}